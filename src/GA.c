@@ -33,6 +33,16 @@ static char GA_ID[33];
 #define ID_STUB "id="
 #define MATURE_BABY_OK "OK\n"
 
+/* batched commands fetch and return several babies per request over
+   a single keep-alive connection:
+   GA_URL/cgi-bin/GAEngine.py?op=get_babies&n=N
+   GA_URL/cgi-bin/GAEngine.py?op=mature_babies  (POST, one "id fit" per line)
+   get_babies answers <BABIES><BABY><ID VALUE=../><VARIABLES>..</BABY>..
+   and an empty <BABIES/> once the engine has nothing left to evaluate */
+#define GET_BABIES "op=get_babies"
+#define MATURE_BABIES "op=mature_babies"
+#define N_STUB "n="
+
 /* structure for holding the weight/value pairs */
 #define WEIGHT_LEN 256
 typedef struct _weight_value_
@@ -44,6 +54,32 @@ typedef struct _weight_value_
 static weight_value weights[MAX_WEIGHTS];
 static unsigned nweights = 0;
 
+/* structures for batched operation, a batch holds the babies from one
+   get_babies response and all of their weights in a single pool */
+typedef struct _ga_baby_
+{
+  char id[33];
+  unsigned first, count;   /* slice of the batch weight pool */
+  double fit;
+} ga_baby;
+
+typedef struct _ga_batch_
+{
+  ga_baby *babies;
+  unsigned nbabies, maxbabies;
+  weight_value *pool;
+  unsigned npool, maxpool;
+} ga_batch;
+
+static unsigned gaBatch = 1;       /* babies per request, 1 = original protocol */
+static int gaTimeout = 60;         /* seconds before the engine is declared dead */
+static HTTP_Conn *gaConn = NULL;   /* keep-alive connection to the engine */
+static ga_batch gaBatches[2];      /* current batch and the prefetched one */
+static ga_batch *gaCurrent = gaBatches, *gaNext = gaBatches + 1;
+static unsigned gaIndex = 0;       /* next baby to hand out from gaCurrent */
+static int gaPending = 0;          /* a get_babies request is outstanding,
+                                      2 if it was queued behind fits */
+
 /* string case normalizers...converts string to uppercase */
 static char *upcase(char *str)
 {
@@ -113,20 +149,64 @@ static int insertWeight(const char *str, double val)
 /* global variable to know when we are in the variable section */
 static unsigned char varFlag = 0;
 
-/* event handler for beginning tags */
+/* add a weight to the last baby of a batch */
+static void batchWeight(ga_batch *b, const char *str, double val)
+{
+  if (b->npool == b->maxpool)
+    {
+      b->maxpool = b->maxpool ? 2 * b->maxpool : 256;
+      b->pool = realloc(b->pool, b->maxpool * sizeof (weight_value));
+      if (b->pool == NULL) errorExit("GA batch: out of memory");
+    }
+  strncpy(b->pool[b->npool].weight, str, WEIGHT_LEN-1);
+  b->pool[b->npool].weight[WEIGHT_LEN-1] = '\0';
+  upcase(b->pool[b->npool].weight);
+  b->pool[b->npool].value = val;
+  b->npool += 1;
+  b->babies[b->nbabies-1].count += 1;
+}
+
+/* event handler for beginning tags, data is the batch being filled
+   or NULL for the single baby protocol */
 static void startHandler(void *data, const char *el, const char **attr)
 {
+  ga_batch *b = (ga_batch *)data;
+
+  /* a new baby in a batch response */
+  if (b != NULL && !strcasecmp(el, "BABY"))
+    {
+      if (b->nbabies == b->maxbabies)
+        {
+          b->maxbabies = b->maxbabies ? 2 * b->maxbabies : 16;
+          b->babies = realloc(b->babies, b->maxbabies * sizeof (ga_baby));
+          if (b->babies == NULL) errorExit("GA batch: out of memory");
+        }
+      memset(b->babies + b->nbabies, 0, sizeof (ga_baby));
+      b->babies[b->nbabies].first = b->npool;
+      b->nbabies += 1;
+    }
   /* if we are the start of the variables section flag it */
-  if (!strcasecmp(el, "VARIABLES")) varFlag = 1;
+  else if (!strcasecmp(el, "VARIABLES")) varFlag = 1;
   /* if we are <ID> get value into GA_ID otherwise
      if we are in <variable> region insert the VALUES for the keys */
   else if (!strcasecmp(el, "ID"))
     { 
-      if (!strcasecmp(attr[0], "VALUE")) strcpy(GA_ID,attr[1]);
+      if (attr[0] && !strcasecmp(attr[0], "VALUE"))
+        {
+          if (b != NULL && b->nbabies > 0)
+            strncpy(b->babies[b->nbabies-1].id, attr[1], 32);
+          else
+            strncpy(GA_ID, attr[1], 32);
+        }
     }
   else if (varFlag)
-    if (!strcasecmp(attr[0], "VALUE"))
-      insertWeight(el,atof(attr[1])); /* insert into array of weights*/
+    if (attr[0] && !strcasecmp(attr[0], "VALUE"))
+      {
+        if (b != NULL && b->nbabies > 0)
+          batchWeight(b, el, atof(attr[1]));
+        else
+          insertWeight(el,atof(attr[1])); /* insert into array of weights*/
+      }
 }
 /* event handler for ending tags */
 static void endHandler(void *data, const char *el)
@@ -134,8 +214,8 @@ static void endHandler(void *data, const char *el)
   /* reset the varFlag when we close the </variables> section */
   if (!strcasecmp(el,"VARIABLES")) varFlag = 0;
 }
-/* actual string parser */
-void XMLParseString(char *str, int len)
+/* actual string parser, data is passed through to the handlers */
+static void XMLParse(char *str, int len, void *data)
 {
   XML_Parser p; /* the parser */
 
@@ -148,6 +228,7 @@ void XMLParseString(char *str, int len)
 
   /* set the tag handlers */
   XML_SetElementHandler(p,startHandler,endHandler);
+  XML_SetUserData(p, data);
 
   /* now actually parse through the string */
   if (!XML_Parse(p, str, len, 1))
@@ -160,14 +241,201 @@ void XMLParseString(char *str, int len)
   XML_ParserFree(p);
 }
 
+void XMLParseString(char *str, int len)
+{
+  XMLParse(str, len, NULL);
+}
+
 /****************************************************************
  **                        Main API                            **
  ****************************************************************/
+/****************************************************************
+ **                    Batched protocol                        **
+ ****************************************************************/
+
+/* (re)connect to the engine if the keep-alive connection was lost */
+static void gaConnect(void)
+{
+  if (gaConn != NULL && gaConn->iSocket != -1) return;
+
+  http_close(gaConn);
+  if ((gaConn = http_open(GA_URL, gaTimeout)) == NULL)
+    {
+      sprintf(estring, "GA engine %s unreachable\n", GA_URL);
+      errorExit(estring);
+    }
+}
+
+/* queue a get_babies request, the response is collected by gaCollect.
+   idle says nothing else is outstanding on the connection, only then
+   can a dropped socket be replaced and the request sent again */
+static void gaRequest(int idle)
+{
+  char url_cmd[MAX_URL_LEN];
+
+  sprintf(url_cmd, "%s/%s?%s&%s%u", GA_URL, ROOT_CMD, GET_BABIES,
+          N_STUB, gaBatch);
+  gaConnect();
+  if (!http_send(gaConn, url_cmd, NULL, kHMethodGet))
+    {
+      if (!idle)
+        errorExit("Error GAsendFit: connection lost before the fit "
+                  "batch was acknowledged\n");
+
+      /* one retry on a fresh connection, servers drop idle sockets */
+      http_close(gaConn);
+      gaConn = NULL;
+      gaConnect();
+      if (!http_send(gaConn, url_cmd, NULL, kHMethodGet))
+        errorExit("Error GAnextBaby: unable to request babies\n");
+    }
+  gaPending = idle ? 1 : 2;
+}
+
+/* wait for the outstanding get_babies response and parse it into b */
+static void gaCollect(ga_batch *b)
+{
+  HTTP_Response hResponse;
+
+  b->nbabies = b->npool = 0;
+  hResponse = http_recv(gaConn);
+  if (hResponse.lSize < 0)
+    {
+      /* a request queued behind a fit batch can't be told apart from
+         babies the engine already handed out, so only ask again for
+         one sent on an idle connection */
+      if (gaPending != 1)
+        errorExit("Error GAnextBaby: connection lost waiting for "
+                  "prefetched babies\n");
+      http_close(gaConn);
+      gaConn = NULL;
+      gaRequest(1);
+      hResponse = http_recv(gaConn);
+    }
+  gaPending = 0;
+
+  if (hResponse.lSize <= 0 || strncmp(hResponse.szHCode, "200", 3))
+    {
+      sprintf(estring, "Error GAnextBaby: bad batch response (%s)\n",
+              hResponse.szHCode);
+      errorExit(estring);
+    }
+  varFlag = 0;
+  XMLParse(hResponse.pData, hResponse.lSize, b);
+  free(hResponse.pData);
+
+  if (debug)
+    fprintf(stderr, "GA batch: received %u babies\n", b->nbabies);
+}
+
+/* return the fitness of every baby in the batch with one request,
+   optionally queueing the request for the batch after next */
+static void gaReturnFits(ga_batch *b, int prefetch)
+{
+  char *body, *ptr;
+  unsigned i;
+  HTTP_Extra extra = { NULL, NULL, 0 };
+  HTTP_Response hResponse;
+  char url_cmd[MAX_URL_LEN];
+
+  if (b->nbabies == 0) return;
+
+  body = (char *)getMem(b->nbabies * 64 + 1, "GA fitness batch");
+  for (i=0, ptr=body; i<b->nbabies; i++)
+    ptr += sprintf(ptr, "%s %f\n", b->babies[i].id, b->babies[i].fit);
+
+  sprintf(url_cmd, "%s/%s?%s", GA_URL, ROOT_CMD, MATURE_BABIES);
+  extra.PostData = body;
+  extra.PostLen = ptr - body;
+
+  gaConnect();
+  if (!http_send(gaConn, url_cmd, &extra, kHMethodPost))
+    errorExit("Error GAsendFit: Error sending fit batch\n");
+
+  /* keep the engine busy: the next batch is requested before the
+     acknowledgement is read so it is computed while we evaluate */
+  if (prefetch)
+    gaRequest(0);
+
+  hResponse = http_recv(gaConn);
+  if (hResponse.lSize <= 0 || strcasecmp(hResponse.pData, MATURE_BABY_OK))
+    errorExit("Error GAsendFit: Error sending fit batch\n");
+  free(hResponse.pData);
+  freeMem(body);
+  b->nbabies = b->npool = 0;
+}
+
+/* make the next baby of the current batch the active set of weights,
+   returns 0 when the engine has no more babies */
+static int GAnextBaby(void)
+{
+  ga_batch *tmp;
+  ga_baby *baby;
+  unsigned i;
+
+  if (gaIndex >= gaCurrent->nbabies)
+    {
+      /* first call, nothing prefetched yet */
+      if (!gaPending)
+        gaRequest(1);
+      gaCollect(gaNext);
+
+      /* return the finished batch (queues the following prefetch) */
+      if (gaCurrent->nbabies > 0)
+        gaReturnFits(gaCurrent, gaNext->nbabies > 0);
+      else if (gaNext->nbabies > 0)
+        gaRequest(1);
+
+      tmp = gaCurrent; gaCurrent = gaNext; gaNext = tmp;
+      gaIndex = 0;
+      if (gaCurrent->nbabies == 0)
+        return 0;
+    }
+
+  baby = gaCurrent->babies + gaIndex;
+  baby->fit = 0.0;
+  strcpy(GA_ID, baby->id);
+  nweights = 0;
+  for (i=0; i<baby->count; i++)
+    insertWeight(gaCurrent->pool[baby->first+i].weight,
+                 gaCurrent->pool[baby->first+i].value);
+  gaIndex += 1;
+  return 1;
+}
+
+/* set the number of babies fetched per request and the network
+   timeout, a batch size of 1 selects the original protocol */
+void GAsetBatch(int batch, int timeout)
+{
+  gaBatch = (batch > 1) ? batch : 1;
+  gaTimeout = (timeout > 0) ? timeout : 0;
+}
+
+/* flush any fitness values still held by the batched protocol */
+void GAfinish(void)
+{
+  if (gaBatch == 1 || gaConn == NULL) return;
+
+  if (gaPending)
+    {
+      gaCollect(gaNext);
+      gaNext->nbabies = 0;
+    }
+  if (gaIndex > 0)
+    {
+      gaCurrent->nbabies = gaIndex;
+      gaReturnFits(gaCurrent, 0);
+      gaIndex = 0;
+    }
+  http_close(gaConn);
+  gaConn = NULL;
+}
+
 /* initialize the interface to the GA engine by contacting the engine
    at url and getting a set of weights in the form of an XML file. 
    Parse out the weights and the ID and put them into static global 
-   variables */
-void GAinit(const char *url)
+   variables.  Returns 0 if the engine has no more babies to offer. */
+int GAinit(const char *url)
 {
   char url_cmd[MAX_URL_LEN];
   HTTP_Response hResponse;
@@ -192,6 +460,10 @@ void GAinit(const char *url)
       GA_URL[strlen(GA_URL) - 1] == '\\' ) 
     GA_URL[strlen(GA_URL) - 1] = '\0';
   
+  /* batched protocol keeps its own connection and prefetch queue */
+  if (gaBatch > 1)
+    return GAnextBaby();
+
   /* construct the get baby cmd url */
   sprintf(url_cmd, "%s/%s?%s", GA_URL, ROOT_CMD, GET_BABY);
 
@@ -208,6 +480,7 @@ void GAinit(const char *url)
 
   /* we have to free up the pData from the response when done */
   if (hResponse.pData) free(hResponse.pData);
+  return 1;
 }
 
 /* return the value for the weight given by str or dflt if it doesn't exist */
@@ -232,6 +505,14 @@ void GAsendFit(double fit)
   if (debug)
      fprintf(stderr, "GAsendFit: fitness = %f\n", fit);
 
+  /* batched fits are returned together when the batch is exhausted */
+  if (gaBatch > 1)
+    {
+      if (gaIndex > 0)
+        gaCurrent->babies[gaIndex-1].fit = fit;
+      return;
+    }
+
   /* construct the mature baby cmd url */
   sprintf(url_cmd, "%s/%s?%s&%s%s&%s%f",
 	  GA_URL, ROOT_CMD, MATURE_BABY,
@@ -7,7 +7,9 @@
 
 #ifndef GA_H
 #define GA_H
-void GAinit(const char *url);
+void GAsetBatch(int batch, int timeout);
+int GAinit(const char *url);
 double GAgetData(const char *str, double dflt);
 void GAsendFit(double fit);
+void GAfinish(void);
 #endif
@@ -20,16 +20,31 @@
 
 /* Start off badly by statically allocating the number of variables
 ** that can be read/processed from the SME configuration file.
+**
+** Variables are found through an open addressing hash of their names
+** and numeric values are parsed once when the variable is set, so the
+** SMEget* routines are cheap enough to use inside the year loop.
 */
+#define MAXVARS      4000
+#define VARHASHSIZE  8192            // power of two, > 2 * MAXVARS
+
 static struct {
     char  varname[80];
     char  *mapname;
     float fdata;
-} vardata[4000]; 
+    unsigned hash;
+    int   ivalid, dvalid;         // mapname parsed as an int/double
+    int   ival;
+    double dval;
+} vardata[MAXVARS]; 
 
 static int idx = 0;
+static int varhash[VARHASHSIZE];  // index+1 into vardata, 0 is empty
 static char *datapath, *mappath;
 
+static int seeded = 0;            // config file seeded drand48
+static long seed;
+
 
 const char *SMEgetDataPath()
 {
@@ -42,31 +57,172 @@ const char *SMEgetMapPath()
 }
 
 
+/* FNV-1a hash of a variable name */
+static unsigned hashName(char *name)
+{
+    unsigned h = 2166136261u;
+
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+/* return the index of a variable or -1 if not defined */
+static int findVar(char *name)
+{
+    unsigned h = hashName(name), slot;
+
+    for (slot=h&(VARHASHSIZE-1); varhash[slot]; slot=(slot+1)&(VARHASHSIZE-1))
+        if (vardata[varhash[slot]-1].hash == h &&
+            !strcmp(vardata[varhash[slot]-1].varname, name))
+            return varhash[slot] - 1;
+
+    return -1;
+}
+
+/* enter a new variable (already in vardata[i]) into the hash */
+static void hashVar(int i)
+{
+    unsigned slot;
+
+    for (slot=vardata[i].hash&(VARHASHSIZE-1); varhash[slot]; 
+         slot=(slot+1)&(VARHASHSIZE-1))
+        ;
+    varhash[slot] = i + 1;
+}
+
+/* pre-parse the numeric forms of a variable's value */
+static void parseVar(int i)
+{
+    char *endptr;
+
+    vardata[i].ival = strtol(vardata[i].mapname, &endptr, 10);
+    vardata[i].ivalid = (endptr != vardata[i].mapname);
+    vardata[i].dval = strtod(vardata[i].mapname, &endptr);
+    vardata[i].dvalid = (endptr != vardata[i].mapname);
+}
+
+
 void SMEaddVar(char *name, char *value)
 {
     int i;
 
     /* check for existing instance of the variable and replace it */
-    for (i=0; i<idx; i+=1)  {
-        if (!strcmp(vardata[i].varname, name))  {
-            free(vardata[i].mapname);
-            vardata[i].mapname = strdup(value);
-            if (vardata[i].mapname == NULL)  {
-                sprintf(estring, "out of memory allocating %s\n", name);
-                errorExit(estring);
-            }
-            return;
+    if ((i = findVar(name)) < 0)  {
+
+        /* new varible, so add it */
+        if (idx == MAXVARS || strlen(name) >= sizeof vardata[0].varname)  {
+            sprintf(estring, "unable to add SME variable %s\n", name);
+            errorExit(estring);
         }
+        i = idx++;
+        strcpy(vardata[i].varname, name);
+        vardata[i].hash = hashName(name);
+        hashVar(i);
     }
+    else
+        freeMem(vardata[i].mapname);
 
-    /* new varible, so add it */
-    strcpy(vardata[idx].varname, name);
-    vardata[idx].mapname = strdup(value);
-    if (vardata[idx].mapname == NULL)  {
-        sprintf(estring, "out of memory allocating %s\n", name);
-        errorExit(estring);
+    vardata[i].mapname = getMem(strlen(value) + 1, "SME variable");
+    strcpy(vardata[i].mapname, value);
+    parseVar(i);
+}
+
+/* Helpers for the packed configuration table.  Values are copied
+** byte-wise so the table needs no alignment.
+*/
+#define PUT(p, v)  (memcpy((p), &(v), sizeof (v)), (p) += sizeof (v))
+#define GET(p, v)  (memcpy(&(v), (p), sizeof (v)), (p) += sizeof (v))
+
+/* Pack the variable table, seed and graphs into buf (or just size
+** it if buf is NULL).  Each entry carries its hash and pre-parsed
+** values so receivers never touch the strings except to copy them.
+*/
+static int SMEpack(char *buf)
+{
+    int i, size;
+    unsigned short klen;
+    int vlen;
+    char *p = buf;
+
+    size = 4 * sizeof (int) + sizeof (long);
+    for (i=0; i<idx; i+=1)
+        size += sizeof (unsigned) + 4 * sizeof (int) + sizeof (double)
+                + sizeof (unsigned short) + strlen(vardata[i].varname)
+                + strlen(vardata[i].mapname);
+    size += GRAPHpack(NULL);
+    if (buf == NULL)
+        return size;
+
+    PUT(p, idx); PUT(p, debug); PUT(p, seeded); PUT(p, seed);
+    for (i=0; i<idx; i+=1)  {
+        klen = strlen(vardata[i].varname);
+        vlen = strlen(vardata[i].mapname);
+        PUT(p, vardata[i].hash);
+        PUT(p, vardata[i].ivalid); PUT(p, vardata[i].ival);
+        PUT(p, vardata[i].dvalid); PUT(p, vardata[i].dval);
+        PUT(p, klen); PUT(p, vlen);
+        memcpy(p, vardata[i].varname, klen); p += klen;
+        memcpy(p, vardata[i].mapname, vlen); p += vlen;
+    }
+    p += GRAPHpack(p);
+
+    return p - buf;
+}
+
+static void SMEunpack(char *p)
+{
+    int i, n;
+    unsigned short klen;
+    int vlen;
+
+    GET(p, n); GET(p, debug); GET(p, seeded); GET(p, seed);
+    for (i=0; i<n; i+=1)  {
+        GET(p, vardata[i].hash);
+        GET(p, vardata[i].ivalid); GET(p, vardata[i].ival);
+        GET(p, vardata[i].dvalid); GET(p, vardata[i].dval);
+        GET(p, klen); GET(p, vlen);
+        memcpy(vardata[i].varname, p, klen); p += klen;
+        vardata[i].varname[klen] = '\0';
+        vardata[i].mapname = getMem(vlen + 1, "SME variable");
+        memcpy(vardata[i].mapname, p, vlen); p += vlen;
+        hashVar(i);
+    }
+    idx = n;
+    p = GRAPHunpack(p);
+
+    if (seeded)
+        srand48(seed);
+}
+
+/* Share the configuration parsed by rank 0 with every other rank
+** as a single packed table.  Only rank 0 reads the config and graph
+** files which keeps large jobs from hammering the shared filesystem.
+*/
+static void SMEbroadcast()
+{
+    int size;
+    char *buf = NULL;
+
+    if (nproc == 1) return;
+
+    if (myrank == 0)  {
+        size = SMEpack(NULL);
+        buf = getMem(size, "SME config table");
+        SMEpack(buf);
     }
-    idx += 1;
+    MPI_Bcast(&size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (myrank != 0)
+        buf = getMem(size, "SME config table");
+    MPI_Bcast(buf, size, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    if (myrank != 0)
+        SMEunpack(buf);
+    freeMem(buf);
+
+    if (debug && myrank == 0)
+        fprintf(stderr, "SME config table: %d variables, %d bytes\n",
+                idx, size);
 }
 
 /* Parse the SME configuration file and build variable database.
@@ -96,8 +252,11 @@ void SMEparseConfig(char *path, char *proj, char *fname)
         if (!strcmp(ptr, "#") && !strcasecmp(strtok(NULL, delimit), 
                 "global"))  {
             while ((ptr = strtok(NULL, delimit)) != NULL)  {
-                if (!strcasecmp(ptr, "s"))
-                    srand48(atol(strtok(NULL, delimit)));
+                if (!strcasecmp(ptr, "s"))  {
+                    seed = atol(strtok(NULL, delimit));
+                    seeded = 1;
+                    srand48(seed);
+                }
                 else if (!strcmp(ptr, "d"))
                     debug = atol(strtok(NULL, delimit)); 
                 else if (!strcmp(ptr, "OT"))  {
@@ -176,9 +335,8 @@ char *SMEgetFileName(char *var)
 {
     int i;
 
-    for (i=0; i<idx; i+=1)
-        if (!strcmp(var, vardata[i].varname))
-            return vardata[i].mapname;
+    if ((i = findVar(var)) >= 0)
+        return vardata[i].mapname;
 
     return NULL;
 }
@@ -187,10 +345,8 @@ char *SMEgetString(char *var, char *def)
 {
     int i;
 
-    for (i=0; i<idx; i+=1)  {
-        if (!strcmp(var, vardata[i].varname))
-            return strdup(vardata[i].mapname);
-    }
+    if ((i = findVar(var)) >= 0)
+        return strdup(vardata[i].mapname);
 
     if (def != NULL)
         return strdup(def);
@@ -201,18 +357,10 @@ char *SMEgetString(char *var, char *def)
 
 int SMEgetInt(char *var, int def)
 {
-    int i, x;
-    char *endptr;
+    int i;
 
-    for (i=0; i<idx; i+=1)  {
-        if (!strcmp(var, vardata[i].varname))  {
-            x = strtol(vardata[i].mapname, &endptr, 10);
-            if (vardata[i].mapname == endptr)
-                return def;
-            else
-                return x;
-        }
-    }
+    if ((i = findVar(var)) >= 0 && vardata[i].ivalid)
+        return vardata[i].ival;
 
     return def;
 }
@@ -220,18 +368,9 @@ int SMEgetInt(char *var, int def)
 double SMEgetFloat(char *var, float def)
 {
     int i;
-    double x;
-    char *endptr;
 
-    for (i=0; i<idx; i+=1)  {
-        if (!strcmp(var, vardata[i].varname))  {
-            x = strtod(vardata[i].mapname, &endptr);
-            if (vardata[i].mapname == endptr)
-                return def;
-            else
-                return x;
-        }
-    }
+    if ((i = findVar(var)) >= 0 && vardata[i].dvalid)
+        return vardata[i].dval;
 
     return def;
 }
@@ -241,10 +380,8 @@ float SMEgetData(char *var, float dval)
 {
     int i;
 
-    for (i=0; i<idx; i+=1)
-        if (!strcmp(var, vardata[i].varname))  {
-            return vardata[i].fdata;
-        }
+    if ((i = findVar(var)) >= 0)
+        return vardata[i].fdata;
 
     return dval;
 }
@@ -314,6 +451,8 @@ void SMEparseOptions(int argc, char *argv[])
         runName = strdup(cfile);
         if ((cptr = strrchr(runName, '.')) != NULL)
             *cptr = '\0';
-        SMEparseConfig(ppath, project, cfile);
+        if (myrank == 0 || nproc == 1)
+            SMEparseConfig(ppath, project, cfile);
+        SMEbroadcast();
     }
 }
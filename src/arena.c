@@ -0,0 +1,160 @@
+/*
+** Grid arena.  Each rank reserves one slab of address space and carves
+** grid buffers out of it so that every grid is ARENA_ALIGN aligned at
+** its first active cell and sits on huge pages where the kernel allows.
+**
+** The slab is mapped without reserving swap, so only pages that are
+** actually touched count against the rank.  Fresh slab memory is zero
+** and is first written by the rank that owns it, so pages land on that
+** rank's NUMA node.  Freed grids are kept on a list and handed back out
+** for the next request of the same size (probmaps reloaded every
+** keyframe, staging grids for quantized layers).  When the slab is
+** exhausted grids fall back to posix_memalign with the same layout.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "arena.h"
+
+#define ARENA_MAGIC 0x414e5247
+
+#define ROUNDUP(x, a)  (((x) + (a) - 1) / (a) * (a))
+
+/* header in front of the leading halo, one cache line long */
+typedef struct arenablk {
+    size_t size;                 /* total bytes including header */
+    struct arenablk *next;       /* free list link */
+    int label;                   /* MEMtrack slot */
+    int bytes;                   /* tracked bytes (lead + bytes) */
+    int magic;
+    int slab;                    /* carved from the slab */
+    char pad[ARENA_ALIGN - sizeof (size_t) - sizeof (void *)
+             - 4*sizeof (int)];
+} arenablk;
+
+static char *slab = NULL;
+static size_t slabsize = 0, used = 0;
+static arenablk *freelist = NULL;
+static int overflow = 0;
+static pthread_mutex_t arenalock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Reserve the slab.  bytes <= 0 leaves the arena empty and every
+** grid is allocated separately (still aligned and recycled).
+*/
+void ARENAinit(long bytes)
+{
+    char *p;
+    size_t len;
+
+    if (bytes <= 0 || slab != NULL)
+        return;
+
+    slabsize = ROUNDUP((size_t)bytes, ARENA_HUGE);
+    len = slabsize + ARENA_HUGE;
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)  {
+        if (debug)
+            fprintf(stderr, "P%d: unable to reserve %lu MB grid arena\n",
+                    myrank, (unsigned long)(slabsize >> 20));
+        slabsize = 0;
+        return;
+    }
+
+    /* trim to a huge page boundary so the whole slab can be promoted */
+    slab = (char *)ROUNDUP((size_t)p, ARENA_HUGE);
+    if (slab > p)
+        munmap(p, slab - p);
+    if (slab + slabsize < p + len)
+        munmap(slab + slabsize, (p + len) - (slab + slabsize));
+
+#ifdef MADV_HUGEPAGE
+    madvise(slab, slabsize, MADV_HUGEPAGE);
+#endif
+
+    if (debug)
+        fprintf(stderr, "P%d: grid arena of %lu MB reserved\n",
+                myrank, (unsigned long)(slabsize >> 20));
+}
+
+/* Allocate a zeroed grid of lead + bytes bytes.  The returned pointer
+** is ARENA_ALIGN aligned and has lead bytes in front of it (the upper
+** halo row for initGridMap).
+*/
+char *ARENAalloc(int lead, int bytes, char *label)
+{
+    arenablk *b, **pb;
+    size_t size;
+    void *p = NULL;         /* stops warnings, errorExit isn't noreturn */
+
+    size = sizeof (arenablk) + ROUNDUP((size_t)lead, ARENA_ALIGN)
+           + ROUNDUP((size_t)bytes, ARENA_ALIGN);
+
+    pthread_mutex_lock(&arenalock);
+    for (pb=&freelist; *pb != NULL; pb=&(*pb)->next)
+        if ((*pb)->size == size)
+            break;
+
+    if ((b = *pb) != NULL)  {
+        *pb = b->next;
+        pthread_mutex_unlock(&arenalock);
+        memset(b + 1, 0, size - sizeof (arenablk));
+    }
+    else if (used + size <= slabsize)  {
+        b = (arenablk *)(slab + used);
+        used += size;
+        pthread_mutex_unlock(&arenalock);
+        b->slab = 1;
+    }
+    else  {
+        if (debug && slabsize && !overflow)
+            fprintf(stderr, "P%d: grid arena full, allocating %s "
+                    "separately\n", myrank, label);
+        overflow += 1;
+        pthread_mutex_unlock(&arenalock);
+        if (posix_memalign(&p, ARENA_ALIGN, size))  {
+            sprintf(estring, "Insufficient Memory for %s, %d bytes requested",
+                    label, lead + bytes);
+            errorExit(estring);
+        }
+        memset(p, 0, size);
+        b = (arenablk *)p;
+        b->slab = 0;
+    }
+
+    b->size = size;
+    b->next = NULL;
+    b->bytes = lead + bytes;
+    b->magic = ARENA_MAGIC;
+    b->label = MEMtrack(label, b->bytes);
+
+    return (char *)(b + 1) + ROUNDUP((size_t)lead, ARENA_ALIGN);
+}
+
+/* Return a grid to the free list, lead must match ARENAalloc.
+*/
+void ARENAfree(char *ptr, int lead)
+{
+    arenablk *b;
+
+    if (ptr == NULL) return;
+    b = (arenablk *)(ptr - ROUNDUP((size_t)lead, ARENA_ALIGN)) - 1;
+    if (b->magic != ARENA_MAGIC)
+        errorExit("ARENAfree called on memory not from ARENAalloc");
+
+    MEMuntrack(b->label, b->bytes);
+
+    pthread_mutex_lock(&arenalock);
+    b->next = freelist;
+    freelist = b;
+    pthread_mutex_unlock(&arenalock);
+}
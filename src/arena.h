@@ -0,0 +1,22 @@
+/* arena.c header file
+**
+** Per rank arena for grid buffers.  Grids are carved from one slab
+** reserved up front (with huge page advice where available), the
+** first cell after the leading halo is ARENA_ALIGN aligned, and freed
+** grids are recycled for the next allocation of the same size.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#define ARENA_ALIGN  64              /* cache line and AVX-512 width */
+#define ARENA_HUGE   (2 << 20)       /* huge page size */
+#define ARENA_GRIDS  64              /* default slab, in float grids */
+
+extern void ARENAinit(long bytes);
+extern char *ARENAalloc(int lead, int bytes, char *label);
+extern void ARENAfree(char *ptr, int lead);
+
+#endif
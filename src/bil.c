@@ -244,6 +244,36 @@ FILE *BILopenBinary(char *fname, char *mode)
 }
 
 
+/* Write count elements to an open BIL file at the current position,
+** used to stream a grid out a block at a time.
+*/
+int BILwriteBlock(FILE *f, void *data, int count, int size)
+{
+    int n;
+
+    /* swap data IN PLACE and back afterwards */
+    if (size > 1) byteswap(data, count, size);
+    n = fwrite(data, size, count, f);
+    if (size > 1) byteswap(data, count, size);
+
+    if (n != count)  {
+        sprintf(estring, "could not write %d elements.", count);
+        errorExit(estring);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/* Exported byteswap for other readers of little-endian data.
+*/
+void BILbyteswap(void *p, int n, int size)
+{
+    byteswap(p, n, size);
+}
+
+
 /* Wrapper for fclose.  Not needed but provides a matching function
 ** MAP2openBinary and we might as well be consistant.
 */
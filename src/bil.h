@@ -17,7 +17,9 @@ extern int BILwriteHeader(char *, int, int, int, char *,
                           float, float, float, float);
 extern FILE *BILopenBinary(char *, char *);
 extern void BILclose(FILE *);
+extern void BILbyteswap(void *, int, int);
 extern int BILreadBuffer(char *, int, char *, int, int);
 extern int BILwriteBuffer(char *, int, void *, int, int);
+extern int BILwriteBlock(FILE *, void *, int, int);
 
 #endif
@@ -0,0 +1,328 @@
+/*
+** Cost distance for the in-model attractors (COST_ATTRACTORS).
+**
+** COSTupdate gives every cell the least cost of travel to a source
+** cell, moving between the 8 neighbors.  A move costs the mean
+** friction of the two cells times the length of the step, frictions
+** come from the land use class (see COSTconfig) and a negative one
+** makes the cell impassable.  Costs are integers, a cell at friction
+** 1 costs COST_FIX, and anything above the reach is left at COST_FAR.
+**
+** Each rank runs Dijkstra on its own rows with its own priority
+** queue, a bucket per cost as the costs are bounded integers.  The
+** rows next to a strip boundary are then sent to the neighbors (the
+** passive rows), each rank lowers its edge rows from them and runs
+** Dijkstra again from the cells that changed.  The rounds stop when no
+** rank changed a cell.  Paths crossing several
+** strips take a round a crossing, those within the reach are short.
+**
+** Between years the land use only gains sources and its friction only
+** falls (undeveloped to developed or road), so the old costs are upper
+** bounds.  The update pushes the new sources and the cells around
+** those whose friction fell and lets the same rounds lower what they
+** reach.  A lost source or a friction that rose means starting over.
+**
+** The costs are integer path minimums, which don't depend on the
+** order cells are settled in, so the result is the same for any
+** number of ranks.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "cost.h"
+#include "perf.h"
+
+extern int srow, erow, elements;
+
+/* impassable (negative) friction ranks above any other */
+#define COSTRANK(f)  (((f) < 0) ? INT_MAX : (f))
+
+static int friction[256];           // per lu value, COST_FIX/2 units
+static int *bucket = NULL, nbucket; // first queued node of each cost
+static int *qcell, *qnext;          // queued nodes
+static int qn = 0, qcap = 0, qlow;  // nodes used, lowest bucket used
+
+static const int ndr[8] = { -1, -1, -1,  0, 0,  1, 1, 1 };
+static const int ndc[8] = { -1,  0,  1, -1, 1, -1, 0, 1 };
+
+
+/* Friction of the land use classes, a negative value is impassable.
+*/
+void COSTconfig(float road, float developed, float undeveloped,
+                float water, float wetland)
+{
+    int v;
+    float f;
+
+    for (v=0; v<256; v+=1)  {
+        switch (v)  {
+        case LU_ROAD:                    f = road;         break;
+        case LU_LRES: case LU_HRES:
+        case LU_COM:                     f = developed;    break;
+        case LU_WATER:                   f = water;        break;
+        case LU_WET: case LU_HWET:       f = wetland;      break;
+        default:                         f = undeveloped;
+        }
+        friction[v] = (f < 0.0) ? -1 : (int)(f * COST_FIX / 2 + 0.5);
+    }
+}
+
+/* Friction of a land use value as used by the moves.
+*/
+int COSTfriction(int lu)
+{
+    return friction[lu];
+}
+
+COST_T *COSTinit(LU_FLAG flags, unsigned char *extra, float reach)
+{
+    int i;
+    COST_T *c;
+
+    if (reach <= 0.0 || reach * COST_FIX >= INT_MAX / 2)
+        errorExit("cost reach out of range");
+
+    c = (COST_T *)getMem(sizeof (COST_T), "cost");
+    c->flags = flags;
+    c->extra = extra;
+    c->reach = (int)(reach * COST_FIX);
+    c->valid = 0;
+    c->cost = (int *)initGridMap(NULL, elements, sizeof (int));
+    c->fric = (int *)initGridMap(NULL, elements, sizeof (int));
+    for (i=-gCols; i<elements+gCols; i+=1)  {
+        c->cost[i] = COST_FAR;
+        c->fric[i] = -1;
+    }
+    c->source = (unsigned char *)getMem(elements, "cost sources");
+    memset(c->source, 0, elements);
+    c->grid = (unsigned char *)initGridMap(NULL, elements, 1);
+
+    if (bucket == NULL || c->reach >= nbucket)  {
+        if (bucket != NULL)
+            freeMem(bucket);
+        nbucket = c->reach + 1;
+        bucket = (int *)getMem(nbucket * sizeof (int), "cost buckets");
+        for (i=0; i<nbucket; i+=1)
+            bucket[i] = -1;
+        qlow = nbucket;
+    }
+    if (qcap == 0)  {
+        qcap = elements / 2 + 1024;
+        qcell = (int *)getMem(2 * qcap * sizeof (int), "cost queue");
+        qnext = qcell + qcap;
+    }
+
+    return c;
+}
+
+static void push(int cost, int cell)
+{
+    int *t;
+
+    if (qn == qcap)  {
+        t = (int *)getMem(4 * qcap * sizeof (int), "cost queue");
+        memcpy(t, qcell, qn * sizeof (int));
+        memcpy(t + 2 * qcap, qnext, qn * sizeof (int));
+        freeMem(qcell);
+        qcell = t;
+        qnext = t + 2 * qcap;
+        qcap *= 2;
+    }
+
+    qcell[qn] = cell;
+    qnext[qn] = bucket[cost];
+    bucket[cost] = qn++;
+    if (cost < qlow)
+        qlow = cost;
+}
+
+/* Empty the queue.
+*/
+static void clear(int reach)
+{
+    int k;
+
+    for (k=qlow; k<=reach; k+=1)
+        bucket[k] = -1;
+    qn = 0;
+    qlow = nbucket;
+}
+
+/* cost of the move between cells of friction fa and fb */
+static int move(int fa, int fb, int diagonal)
+{
+    return (diagonal) ? (int)((fa + fb) * M_SQRT2 + 0.5) : fa + fb;
+}
+
+/* Dijkstra on the local rows from the queued cells.  A move costs at
+** least 0 so a bucket only gains cells while it is being emptied.
+*/
+static void settle(COST_T *c)
+{
+    int k, q, i, n, r, j, x, fi, fx, v, nrows = erow - srow + 1;
+
+    for (k=qlow; k<=c->reach; k+=1)  {
+        while ((q = bucket[k]) >= 0)  {
+            bucket[k] = qnext[q];
+            i = qcell[q];
+            if (k > c->cost[i] || (fi = c->fric[i]) < 0)
+                continue;
+
+            r = i / gCols;
+            j = i % gCols;
+            for (n=0; n<8; n+=1)  {
+                if (r + ndr[n] < 0 || r + ndr[n] >= nrows ||
+                    j + ndc[n] < 0 || j + ndc[n] >= gCols)
+                    continue;
+                x = i + ndr[n] * gCols + ndc[n];
+                if ((fx = c->fric[x]) < 0)
+                    continue;
+                v = k + move(fi, fx, ndr[n] && ndc[n]);
+                if (v <= c->reach && v < c->cost[x])  {
+                    c->cost[x] = v;
+                    push(v, x);
+                }
+            }
+        }
+    }
+    qn = 0;
+    qlow = nbucket;
+}
+
+/* Lower the edge rows from the neighbors' rows in the passive rows,
+** returns the number of cells lowered.
+*/
+static int ghosts(COST_T *c)
+{
+    int side, row, ghost, j, dc, i, g, v, n = 0, nrows = erow - srow + 1;
+
+    for (side=0; side<2; side+=1)  {
+        if ((side == 0) ? srow == 0 : erow == gRows - 1)
+            continue;
+        row = (side == 0) ? 0 : nrows - 1;
+        ghost = (side == 0) ? -1 : nrows;
+
+        for (j=0; j<gCols; j+=1)  {
+            i = row * gCols + j;
+            if (c->fric[i] < 0)
+                continue;
+            for (dc=-1; dc<=1; dc+=1)  {
+                if (j + dc < 0 || j + dc >= gCols)
+                    continue;
+                g = ghost * gCols + j + dc;
+                if (c->cost[g] == COST_FAR || c->fric[g] < 0)
+                    continue;
+                v = c->cost[g] + move(c->fric[i], c->fric[g], dc != 0);
+                if (v <= c->reach && v < c->cost[i])  {
+                    c->cost[i] = v;
+                    push(v, i);
+                    n += 1;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+/* Queue cell i and its local neighbors that have a cost.
+*/
+static void pushAround(COST_T *c, int i)
+{
+    int n, r = i / gCols, j = i % gCols, x, nrows = erow - srow + 1;
+
+    if (c->cost[i] != COST_FAR)
+        push(c->cost[i], i);
+    for (n=0; n<8; n+=1)  {
+        if (r + ndr[n] < 0 || r + ndr[n] >= nrows ||
+            j + ndc[n] < 0 || j + ndc[n] >= gCols)
+            continue;
+        x = i + ndr[n] * gCols + ndc[n];
+        if (c->cost[x] != COST_FAR)
+            push(c->cost[x], x);
+    }
+}
+
+/* Bring c up to date with the land use lu, from scratch if full is
+** set, returns 1 if it started from scratch.  Must be called by all
+** ranks.
+*/
+int COSTupdate(COST_T *c, unsigned char *lu, int full)
+{
+    int i, f, s, n, total, lost = 0, rounds = 0;
+    unsigned char issource[256];
+
+    PERFstart(PERF_DISTANCE);
+
+    for (i=0; i<256; i+=1)
+        issource[i] = (SPATIALdiffusionClass(i) & c->flags) != 0;
+
+    /* queue what changed, the old costs are kept */
+    clear(c->reach);
+    for (i=0; i<elements; i+=1)  {
+        s = issource[lu[i]] || (c->extra != NULL && c->extra[i]);
+        f = friction[lu[i]];
+        if (c->valid)  {
+            if ((c->source[i] && !s) ||
+                COSTRANK(f) > COSTRANK(c->fric[i]))
+                lost += 1;
+            else if (s && !c->source[i])  {
+                c->cost[i] = 0;
+                push(0, i);
+            }
+            else if (COSTRANK(f) < COSTRANK(c->fric[i]))  {
+                c->fric[i] = f;
+                pushAround(c, i);
+            }
+        }
+        c->source[i] = s;
+        c->fric[i] = f;
+    }
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(&lost, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&total, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    full = full || !c->valid || total > 0;
+    if (full)  {
+        clear(c->reach);
+        for (i=-gCols; i<elements+gCols; i+=1)
+            c->cost[i] = COST_FAR;
+        for (i=0; i<elements; i+=1)
+            if (c->source[i])  {
+                c->cost[i] = 0;
+                push(0, i);
+            }
+        c->valid = 1;
+    }
+    shareGrid(c->fric, elements, MPI_INT);
+
+    do  {
+        settle(c);
+        shareGrid(c->cost, elements, MPI_INT);
+        n = ghosts(c);
+        PERFstart(PERF_COLLECTIVE);
+        MPI_Reduce(&n, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&total, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        PERFstop(PERF_COLLECTIVE);
+        rounds += 1;
+    }  while (total > 0);
+
+    for (i=0; i<elements; i+=1)
+        c->grid[i] = (c->cost[i] > c->reach) ? 1 :
+            COST_CODE - (int)(((long)(COST_CODE-1) * c->cost[i]
+                               + c->reach / 2) / c->reach);
+
+    if (debug && myrank == 0)
+        fprintf(stderr, "cost: %s, %d rounds\n",
+                (full) ? "full" : "incremental", rounds);
+    PERFstop(PERF_DISTANCE);
+    return full;
+}
@@ -0,0 +1,34 @@
+/* cost.c header file
+**
+** Travel cost from every cell to the nearest source cell over a
+** friction surface taken from the land use, the in-model stand-in for
+** the attractor maps prepared in GIS.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef COST_H
+#define COST_H
+
+#define COST_CODE   255             /* attractor code of a source cell */
+#define COST_FIX    256             /* cost of a cell at friction 1 */
+#define COST_FAR    0x7fffffff      /* beyond the reach */
+
+typedef struct {
+    LU_FLAG flags;                  /* source classes */
+    unsigned char *extra;           /* other source cells, may be NULL */
+    int   reach;                    /* largest cost kept, COST_FIX units */
+    int   valid;                    /* cost holds the sources below */
+    int   *cost;                    /* cost to the nearest source */
+    int   *fric;                    /* friction of the last update */
+    unsigned char *source;          /* sources of the last update */
+    unsigned char *grid;            /* attractor codes 1..COST_CODE */
+} COST_T;
+
+extern void COSTconfig(float road, float developed, float undeveloped,
+                       float water, float wetland);
+extern COST_T *COSTinit(LU_FLAG flags, unsigned char *extra, float reach);
+extern int COSTupdate(COST_T *c, unsigned char *lu, int full);
+extern int COSTfriction(int lu);
+
+#endif
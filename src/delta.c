@@ -0,0 +1,184 @@
+/*
+** Sparse delta layers.
+**
+** Year specific inputs (probmap_YYYY and the like) usually differ
+** from the previous year in a small fraction of cells.  Rather than
+** shipping full BIL grids a delta file lists only the runs of
+** changed cells.  File layout, all little-endian like the BIL data:
+**
+**    int32    magic, version, rows, cols, typesize, runs
+**    uint32   index[rows+1]     byte offset of each row's runs
+**                               relative to the start of the data
+**    data     per row: int32 col, int32 len, len * typesize values
+**
+** A processor reads the index entries for its rows (halo included)
+** and then its slice of the data in one read, so a year with no
+** change moves almost no data.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "bil.h"
+#include "delta.h"
+
+#define HEADER_INTS 6
+
+
+int DELTAisDelta(char *fname)
+{
+    int len = strlen(fname), elen = strlen(DELTA_EXT);
+
+    return (len > elen && !strcmp(fname + len - elen, DELTA_EXT));
+}
+
+static void readBytes(FILE *f, char *fname, long offset, void *ptr, int n)
+{
+    if (fseek(f, offset, SEEK_SET) || fread(ptr, 1, n, f) != n)  {
+        sprintf(estring, "unable to read %d bytes at %ld from %s", 
+                n, offset, fname);
+        errorExit(estring);
+    }
+}
+
+/* Apply delta file to grid.  The grid holds rows [row0, row0+nrows)
+** of the full rows x cols grid and only runs in those rows are read.
+** Returns the number of cells updated.
+*/
+int DELTAapply(char *fname, char *grid, int row0, int nrows,
+               int rows, int cols, int typesize)
+{
+    FILE *f;
+    int hdr[HEADER_INTS], r, col, len, cells = 0;
+    unsigned *index;
+    char *data, *p, *end;
+    long base;
+
+    f = BILopenBinary(fname, "rb");
+    readBytes(f, fname, 0, hdr, sizeof hdr);
+    BILbyteswap(hdr, HEADER_INTS, sizeof (int));
+    if (hdr[0] != DELTA_MAGIC || hdr[1] != DELTA_VERSION)  {
+        sprintf(estring, "%s is not a delta file", fname);
+        errorExit(estring);
+    }
+    if (hdr[2] != rows || hdr[3] != cols || hdr[4] != typesize)  {
+        sprintf(estring, "delta %s has wrong dimensions or type", fname);
+        errorExit(estring);
+    }
+
+    /* index entries for our rows plus the end of the last row */
+    index = (unsigned *)getMem((nrows+1) * sizeof (unsigned), "delta index");
+    readBytes(f, fname, sizeof hdr + row0 * sizeof (unsigned), index,
+              (nrows+1) * sizeof (unsigned));
+    BILbyteswap(index, nrows+1, sizeof (unsigned));
+
+    base = sizeof hdr + (rows + 1) * sizeof (unsigned);
+    len = index[nrows] - index[0];
+    if (len > 0)  {
+        data = getMem(len, "delta data");
+        readBytes(f, fname, base + index[0], data, len);
+
+        for (r=0; r<nrows; r+=1)  {
+            p = data + index[r] - index[0];
+            end = data + index[r+1] - index[0];
+            while (p < end)  {
+                memcpy(&col, p, sizeof (int));
+                memcpy(&len, p + sizeof (int), sizeof (int));
+                BILbyteswap(&col, 1, sizeof (int));
+                BILbyteswap(&len, 1, sizeof (int));
+                p += 2 * sizeof (int);
+                if (col < 0 || len < 0 || col + len > cols ||
+                    p + len * typesize > end)  {
+                    sprintf(estring, "corrupt delta %s, row %d", fname,
+                            row0 + r);
+                    errorExit(estring);
+                }
+                memcpy(grid + (r * cols + col) * typesize, p, len * typesize);
+                BILbyteswap(grid + (r * cols + col) * typesize, len, 
+                            typesize);
+                p += len * typesize;
+                cells += len;
+            }
+        }
+        freeMem(data);
+    }
+
+    freeMem(index);
+    BILclose(f);
+
+    if (debug)
+        fprintf(stderr, "P%d: DELTAapply %s, %d cells\n", myrank, fname, cells);
+    return cells;
+}
+
+
+/* Write the delta taking full grid base to grid.  Unchanged gaps
+** shorter than a run header are folded into the surrounding run.
+** Written byte order matches the host, so only for little-endian
+** hosts (as are the BIL files).  Returns the number of runs.
+*/
+int DELTAwrite(char *fname, char *base, char *grid, int rows,
+               int cols, int typesize)
+{
+    FILE *f;
+    int hdr[HEADER_INTS], r, c, start, last, len, runs = 0;
+    int gap = (2 * sizeof (int) + typesize - 1) / typesize;
+    unsigned *index, offset = 0;
+    char *b, *g;
+
+    if ((f = fopen(fname, "wb")) == NULL)  {
+        sprintf(estring, "unable to create %s", fname);
+        errorExit(estring);
+    }
+
+    /* the index is written once the row sizes are known */
+    index = (unsigned *)getMem((rows+1) * sizeof (unsigned), "delta index");
+    fseek(f, sizeof hdr + (rows+1) * sizeof (unsigned), SEEK_SET);
+
+    for (r=0; r<rows; r+=1)  {
+        index[r] = offset;
+        b = base + r * cols * typesize;
+        g = grid + r * cols * typesize;
+
+        for (c=0; c<cols; )  {
+            if (!memcmp(b + c*typesize, g + c*typesize, typesize))  {
+                c += 1;
+                continue;
+            }
+
+            /* extend the run while gaps are short */
+            start = last = c;
+            for (c+=1; c<cols && c-last<=gap; c+=1)
+                if (memcmp(b + c*typesize, g + c*typesize, typesize))
+                    last = c;
+            c = last + 1;
+
+            len = last - start + 1;
+            fwrite(&start, sizeof (int), 1, f);
+            fwrite(&len, sizeof (int), 1, f);
+            fwrite(g + start * typesize, typesize, len, f);
+            offset += 2 * sizeof (int) + len * typesize;
+            runs += 1;
+        }
+    }
+    index[rows] = offset;
+
+    hdr[0] = DELTA_MAGIC;  hdr[1] = DELTA_VERSION;
+    hdr[2] = rows;  hdr[3] = cols;  hdr[4] = typesize;  hdr[5] = runs;
+    fseek(f, 0, SEEK_SET);
+    fwrite(hdr, sizeof hdr, 1, f);
+    fwrite(index, sizeof (unsigned), rows+1, f);
+
+    if (ferror(f))  {
+        sprintf(estring, "error writing %s", fname);
+        errorExit(estring);
+    }
+    fclose(f);
+    freeMem(index);
+
+    return runs;
+}
@@ -0,0 +1,23 @@
+/* delta.c header file
+**
+** Sparse delta layers.  A delta (.dlt) file holds only the cells of
+** a grid that differ from the previous version of the layer, stored
+** as row-runs with a per-row index so each processor reads just the
+** rows it holds.  Deltas are applied in place to a resident grid.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#define DELTA_EXT      ".dlt"
+#define DELTA_MAGIC    0x544c4447        /* "GDLT" little-endian */
+#define DELTA_VERSION  1
+
+extern int DELTAisDelta(char *fname);
+extern int DELTAapply(char *fname, char *grid, int row0, int nrows,
+                      int rows, int cols, int typesize);
+extern int DELTAwrite(char *fname, char *base, char *grid, int rows,
+                      int cols, int typesize);
+#endif
@@ -0,0 +1,351 @@
+/*
+** Distance transform for the proximity driver layers.
+**
+** DISTupdate gives every cell its exact squared Euclidean distance,
+** in cells, to the nearest cell of a set of land use classes.  The
+** distances are capped at the reach, anything further is just far.
+** The full transform is separable,
+**
+**   g(i,j) = min_k (j-k)^2          over the features k of row i
+**   d(i,j) = min_k (i-k)^2 + g(k,j) over all rows k
+**
+** The row pass is a forward and a backward scan of each row, local to
+** the rank.  The column pass is the lower envelope of the parabolas
+** along each column (Felzenszwalb and Huttenlocher) and needs whole
+** columns, so g is transposed with one all-to-all to give each rank a
+** range of columns for all rows, the envelopes are taken there a tile
+** of columns at a time and the result goes back with a second
+** all-to-all.  Both passes are linear in the cells.
+**
+** The model only ever adds features to the land use and a new feature
+** only brings the cells within the reach of it closer.  When the new
+** features are few enough that their disks cost less than a transform
+** they are gathered on every rank and each rank lowers the distances
+** in the disks that cross its rows.  A lost feature (a new run going
+** back to the initial land use) means a full transform.
+**
+** The distances are integers so the result is the same for any number
+** of ranks and whichever way it was updated.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "distance.h"
+#include "perf.h"
+
+extern int srow, erow, elements, gElements;
+
+#define DIST_TILE  16               /* columns per envelope pass */
+
+static int *rowcounts = NULL;       // rows of each rank
+static int *colstart, *colcounts;   // columns of each rank, transposed
+static int *scounts, *sdispls, *rcounts, *rdispls;
+static int *rowbuf, *colbuf;        // g by rank rows and by columns
+static int *tile, *sites, *fsite;   // envelope scratch
+static double *bound;
+
+
+/* Transpose layout and scratch, the same for every DIST_T.
+*/
+static void distSetup()
+{
+    int p, nrows, ncols;
+
+    if (rowcounts != NULL)
+        return;
+
+    rowcounts = (int *)getMem(7 * nproc * sizeof (int), "distance counts");
+    colstart = rowcounts + nproc;
+    colcounts = colstart + nproc;
+    scounts = colcounts + nproc;
+    sdispls = scounts + nproc;
+    rcounts = sdispls + nproc;
+    rdispls = rcounts + nproc;
+
+    nrows = erow - srow + 1;
+    MPI_Allgather(&nrows, 1, MPI_INT, rowcounts, 1, MPI_INT, MPI_COMM_WORLD);
+    for (p=0; p<nproc; p+=1)  {
+        colcounts[p] = gCols / nproc + ((p < gCols % nproc) ? 1 : 0);
+        colstart[p] = (p == 0) ? 0 : colstart[p-1] + colcounts[p-1];
+    }
+
+    ncols = colcounts[myrank];
+    for (p=0; p<nproc; p+=1)  {
+        scounts[p] = nrows * colcounts[p];
+        rcounts[p] = rowcounts[p] * ncols;
+        sdispls[p] = (p == 0) ? 0 : sdispls[p-1] + scounts[p-1];
+        rdispls[p] = (p == 0) ? 0 : rdispls[p-1] + rcounts[p-1];
+    }
+
+    rowbuf = (int *)getMem(elements * sizeof (int), "distance rows");
+    colbuf = (int *)getMem((gRows * ncols + 1) * sizeof (int),
+                           "distance columns");
+    tile = (int *)getMem(DIST_TILE * gRows * sizeof (int), "distance tile");
+    sites = (int *)getMem(2 * gRows * sizeof (int), "distance envelope");
+    fsite = sites + gRows;
+    bound = (double *)getMem(gRows * sizeof (double), "distance envelope");
+}
+
+DIST_T *DISTinit(LU_FLAG flags, int reach)
+{
+    int i;
+    DIST_T *d;
+
+    if (reach < 1 || reach > DIST_MAXREACH)  {
+        sprintf(estring, "distance reach %d outside 1..%d", reach,
+                DIST_MAXREACH);
+        errorExit(estring);
+    }
+
+    d = (DIST_T *)getMem(sizeof (DIST_T), "distance");
+    d->flags = flags;
+    d->reach = reach;
+    d->valid = 0;
+    d->d2 = (int *)getMem(elements * sizeof (int), "distance grid");
+    d->feature = (unsigned char *)getMem(elements, "distance features");
+    memset(d->feature, 0, elements);
+    d->grid = (unsigned char *)initGridMap(NULL, elements, 1);
+    d->codes = (unsigned char *)getMem(reach * reach + 2, "distance codes");
+    for (i=0; i<=reach*reach+1; i+=1)
+        d->codes[i] = DISTcode(i, reach);
+    distSetup();
+
+    return d;
+}
+
+/* Proximity code of a squared distance, DIST_CODE on a feature falling
+** linearly to 1 at the reach and beyond.
+*/
+unsigned char DISTcode(int d2, int reach)
+{
+    if (d2 > reach * reach)
+        return 1;
+    return DIST_CODE - (int)((DIST_CODE-1) * sqrtf((float)d2) / reach
+                             + 0.5f);
+}
+
+/* g for the local rows into d2, at most far.
+*/
+static void rowPass(DIST_T *d, int far)
+{
+    int i, j, k, last, *g;
+    unsigned char *f;
+
+    for (i=0; i<elements; i+=gCols)  {
+        f = d->feature + i;
+        g = d->d2 + i;
+
+        last = -gCols - d->reach - 1;
+        for (j=0; j<gCols; j+=1)  {
+            if (f[j]) last = j;
+            g[j] = j - last;
+        }
+
+        last = 2 * gCols + d->reach + 1;
+        for (j=gCols-1; j>=0; j-=1)  {
+            if (f[j]) last = j;
+            k = (last - j < g[j]) ? last - j : g[j];
+            g[j] = (k > d->reach) ? far : k * k;
+        }
+    }
+}
+
+/* f[q] = min_k (q-k)^2 + f[k] over the n values of f, at most far.
+** Sites at far can't bring anything closer and are left out.
+*/
+static void envelope(int *f, int n, int far, int reach)
+{
+    int q, k = -1, j, p, dq, v;
+    double s;
+
+    for (q=0; q<n; q+=1)  {
+        if (f[q] >= far)
+            continue;
+        s = -HUGE_VAL;
+        while (k >= 0)  {
+            p = sites[k];
+            s = ((f[q] + (double)q * q) - (fsite[k] + (double)p * p))
+                / (2.0 * (q - p));
+            if (s > bound[k])
+                break;
+            k -= 1;
+            s = -HUGE_VAL;
+        }
+        k += 1;
+        sites[k] = q;
+        fsite[k] = f[q];
+        bound[k] = s;
+    }
+
+    if (k < 0)  {
+        for (q=0; q<n; q+=1)
+            f[q] = far;
+        return;
+    }
+
+    for (q=0, j=0; q<n; q+=1)  {
+        while (j < k && bound[j+1] <= q)
+            j += 1;
+        dq = q - sites[j];
+        v = (dq > reach || dq < -reach) ? far : dq * dq + fsite[j];
+        f[q] = (v > reach * reach) ? far : v;
+    }
+}
+
+/* Column pass on the transposed rows, a tile of columns at a time so
+** each row of colbuf is read once.
+*/
+static void columnPass(int far, int reach)
+{
+    int c, t, n, r, ncols = colcounts[myrank];
+
+    for (c=0; c<ncols; c+=DIST_TILE)  {
+        n = (ncols - c < DIST_TILE) ? ncols - c : DIST_TILE;
+        for (r=0; r<gRows; r+=1)
+            for (t=0; t<n; t+=1)
+                tile[t * gRows + r] = colbuf[r * ncols + c + t];
+        for (t=0; t<n; t+=1)
+            envelope(tile + t * gRows, gRows, far, reach);
+        for (r=0; r<gRows; r+=1)
+            for (t=0; t<n; t+=1)
+                colbuf[r * ncols + c + t] = tile[t * gRows + r];
+    }
+}
+
+static void transform(DIST_T *d)
+{
+    int p, i, nrows = erow - srow + 1;
+    int far = d->reach * d->reach + 1;
+
+    rowPass(d, far);
+
+    for (p=0; p<nproc; p+=1)
+        for (i=0; i<nrows; i+=1)
+            memcpy(rowbuf + sdispls[p] + i * colcounts[p],
+                   d->d2 + i * gCols + colstart[p],
+                   colcounts[p] * sizeof (int));
+
+    PERFstart(PERF_COLLECTIVE);
+    PERFcount(PERF_BYTES_MPI, 2L * elements * sizeof (int));
+    MPI_Alltoallv(rowbuf, scounts, sdispls, MPI_INT,
+                  colbuf, rcounts, rdispls, MPI_INT, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    columnPass(far, d->reach);
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Alltoallv(colbuf, rcounts, rdispls, MPI_INT,
+                  rowbuf, scounts, sdispls, MPI_INT, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    for (p=0; p<nproc; p+=1)
+        for (i=0; i<nrows; i+=1)
+            memcpy(d->d2 + i * gCols + colstart[p],
+                   rowbuf + sdispls[p] + i * colcounts[p],
+                   colcounts[p] * sizeof (int));
+
+    for (i=0; i<elements; i+=1)
+        d->grid[i] = d->codes[d->d2[i]];
+}
+
+/* Lower the distances within the reach of the n new features (global
+** cell indices) to the local rows.
+*/
+static void disks(DIST_T *d, int *cells, int n)
+{
+    int s, r, c, i, j, lo, hi, dr, w, v, x, *d2;
+    int reach = d->reach;
+
+    for (s=0; s<n; s+=1)  {
+        r = cells[s] / gCols;
+        c = cells[s] % gCols;
+        lo = (r - reach > srow) ? r - reach : srow;
+        hi = (r + reach < erow) ? r + reach : erow;
+
+        for (i=lo; i<=hi; i+=1)  {
+            dr = i - r;
+            x = reach * reach - dr * dr;
+            w = (int)sqrt((double)x);
+            while (w * w > x) w -= 1;
+            while ((w+1) * (w+1) <= x) w += 1;
+
+            d2 = d->d2 + (i - srow) * gCols;
+            for (j=(c-w > 0) ? c-w : 0; j<=c+w && j<gCols; j+=1)  {
+                v = dr * dr + (j - c) * (j - c);
+                if (v < d2[j])  {
+                    d2[j] = v;
+                    d->grid[(i - srow) * gCols + j] = d->codes[v];
+                }
+            }
+        }
+    }
+}
+
+/* Bring d up to date with the land use lu, by a full transform if full
+** is set, returns 1 if a full transform was done.  Must be called by
+** all ranks.
+*/
+int DISTupdate(DIST_T *d, unsigned char *lu, int full)
+{
+    int i, p, n[2], total[2], *counts, *displs, *cells;
+    unsigned char f, isfeature[256];
+    double window = (2.0 * d->reach + 1) * (2.0 * d->reach + 1);
+
+    PERFstart(PERF_DISTANCE);
+
+    for (i=0; i<256; i+=1)
+        isfeature[i] = (SPATIALdiffusionClass(i) & d->flags) != 0;
+
+    /* rowbuf collects the new features */
+    n[0] = n[1] = 0;
+    for (i=0; i<elements; i+=1)  {
+        f = isfeature[lu[i]];
+        if (f && !d->feature[i])
+            rowbuf[n[0]++] = srow * gCols + i;
+        else if (!f && d->feature[i])
+            n[1] += 1;
+        d->feature[i] = f;
+    }
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(n, total, 2, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Bcast(total, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    if (full || !d->valid || total[1] > 0 || total[0] * window > gElements)  {
+        transform(d);
+        d->valid = 1;
+        PERFstop(PERF_DISTANCE);
+        return 1;
+    }
+
+    if (total[0] > 0)  {
+        counts = (int *)getMem(2 * nproc * sizeof (int), "distance counts");
+        displs = counts + nproc;
+        cells = (int *)getMem(total[0] * sizeof (int), "new features");
+
+        PERFstart(PERF_COLLECTIVE);
+        PERFcount(PERF_BYTES_MPI, (long)total[0] * sizeof (int));
+        MPI_Allgather(n, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+        for (p=0; p<nproc; p+=1)
+            displs[p] = (p == 0) ? 0 : displs[p-1] + counts[p-1];
+        MPI_Allgatherv(rowbuf, n[0], MPI_INT, cells, counts, displs,
+                       MPI_INT, MPI_COMM_WORLD);
+        PERFstop(PERF_COLLECTIVE);
+
+        disks(d, cells, total[0]);
+        freeMem(cells);
+        freeMem(counts);
+    }
+
+    if (debug && myrank == 0)
+        fprintf(stderr, "distance: %d new features\n", total[0]);
+    PERFstop(PERF_DISTANCE);
+    return 0;
+}
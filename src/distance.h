@@ -0,0 +1,30 @@
+/* distance.c header file
+**
+** Exact Euclidean distance from every cell to the nearest cell of a
+** set of land use classes, kept up to date as the land use develops
+** and turned into a byte proximity layer for the drivers.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#define DIST_CODE      255          /* proximity code of a feature cell */
+#define DIST_MAXREACH  1024         /* largest reach, in cells */
+
+typedef struct {
+    LU_FLAG flags;                  /* classes measured to */
+    int   reach;                    /* distances are capped at reach */
+    int   valid;                    /* d2 holds the features below */
+    int   *d2;                      /* squared distance, cells */
+    unsigned char *feature;         /* features of the last update */
+    unsigned char *grid;            /* proximity codes 1..DIST_CODE */
+    unsigned char *codes;           /* DISTcode of d2 up to far */
+} DIST_T;
+
+extern DIST_T *DISTinit(LU_FLAG flags, int reach);
+extern int DISTupdate(DIST_T *d, unsigned char *lu, int full);
+extern unsigned char DISTcode(int d2, int reach);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+** Driver layers.  A driver is a byte grid of scores (higher is more
+** attractive) and a weight per sub-model.  The contribution of a cell
+** is ((1 + value) / (1 + scale))^w, so a weight of 0 switches the layer
+** off and the factor stays positive and finite for any value and any
+** sign of the weight.
+**
+** The factors are tabulated once per weight setting, evaluating the
+** layers is then a gather from a 1KB table per layer which stays in
+** L1 however many layers are active.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "driver.h"
+
+
+void DRIVERreset(DRIVER_T *d)
+{
+    d->nlayers = 0;
+}
+
+/* Add a layer, ignored if there is no grid or the weight is zero.
+*/
+void DRIVERadd(DRIVER_T *d, unsigned char *grid, float w, float scale)
+{
+    int v;
+    float *t;
+
+    if (grid == NULL || w == 0.0)
+        return;
+
+    if (d->nlayers == DRIVER_MAX)
+        errorExit("too many driver layers");
+
+    d->grid[d->nlayers] = grid;
+    t = d->table[d->nlayers];
+    for (v=0; v<256; v+=1)
+        t[v] = (w == 1.0) ? (1.0f + v) / (1.0f + scale) :
+                            powf((1.0f + v) / (1.0f + scale), w);
+    d->nlayers += 1;
+}
+
+/* Replace d by next if the layers or tables differ, bumping its version
+** so results cached from d are recomputed.  Returns 1 if d changed.
+*/
+int DRIVERupdate(DRIVER_T *d, const DRIVER_T *next)
+{
+    int l;
+
+    if (d->nlayers == next->nlayers)  {
+        for (l=0; l<d->nlayers; l+=1)
+            if (d->grid[l] != next->grid[l] ||
+                memcmp(d->table[l], next->table[l], sizeof(d->table[l])))
+                break;
+        if (l == d->nlayers)
+            return 0;
+    }
+
+    d->nlayers = next->nlayers;
+    for (l=0; l<next->nlayers; l+=1)  {
+        d->grid[l] = next->grid[l];
+        memcpy(d->table[l], next->table[l], sizeof(d->table[l]));
+    }
+    d->version += 1;
+    return 1;
+}
+
+/* Multiply f[j] by the driver factor of local cell idx[j].
+*/
+void DRIVERblock(const DRIVER_T *d, const int *idx, int k, float *f)
+{
+    int j, l;
+    const float *t, *u;
+    const unsigned char *g, *h;
+
+    /* two layers a pass halves the passes over f */
+    for (l=0; l+1<d->nlayers; l+=2)  {
+        t = d->table[l];    g = d->grid[l];
+        u = d->table[l+1];  h = d->grid[l+1];
+        for (j=0; j<k; j+=1)
+            f[j] *= t[g[idx[j]]] * u[h[idx[j]]];
+    }
+
+    if (l < d->nlayers)  {
+        t = d->table[l];  g = d->grid[l];
+        for (j=0; j<k; j+=1)
+            f[j] *= t[g[idx[j]]];
+    }
+}
@@ -0,0 +1,31 @@
+/* driver.c header file
+**
+** Byte valued driver layers (attractors, slope, census scores) enter
+** the probability as a product of value^weight factors.  Each layer's
+** factor is tabulated for the 256 possible values whenever its weight
+** changes, so any number of layers costs one table lookup and one
+** multiply per cell.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#define DRIVER_MAX   16           /* layers per sub-model */
+
+typedef struct {
+    int   nlayers;
+    int   version;                /* bumped by DRIVERupdate on change */
+    unsigned char *grid[DRIVER_MAX];
+    float table[DRIVER_MAX][256];
+} DRIVER_T;
+
+extern void DRIVERreset(DRIVER_T *d);
+extern void DRIVERadd(DRIVER_T *d, unsigned char *grid, float w,
+                      float scale);
+extern int  DRIVERupdate(DRIVER_T *d, const DRIVER_T *next);
+extern void DRIVERblock(const DRIVER_T *d, const int *idx, int k,
+                        float *f);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+** gastub is a minimal stand-in for the external GA engine.  It speaks
+** both the original one-baby-per-request protocol and the batched
+** keep-alive protocol (see GA.c) and hands out random weights, so the
+** calibration loop can be exercised without the real engine.
+**
+** Usage: gastub [-p port] [-n babies] [-s seed] [WEIGHT ...]
+**
+** Then point the model at it with "* GA_ENGINE URL http://localhost:port"
+** and optionally "* GA_BATCH pm N".  Returned fitness values are
+** printed on stdout.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define BUFSIZE  65536
+
+static char *defaultWeights[] = {
+    "W_UTILITIES_RES", "W_RES_SPONTANEOUS", "W_RES_NEIGHBORS",
+    "W_UTILITIES_COM", "W_COM_IND_SPONTANEOUS", "W_COM_IND_NEIGHBORS",
+};
+
+static char **weights = defaultWeights;
+static int nweights = sizeof defaultWeights / sizeof (char *);
+static int babies = 20;          /* total babies to hand out */
+static int issued = 0, matured = 0;
+
+
+/* append one baby (ID plus random weights) to the XML buffer */
+static int writeBaby(char *buf)
+{
+    int i, len;
+
+    len = sprintf(buf, "<BABY><ID VALUE=\"%08x\"/><VARIABLES>", ++issued);
+    for (i=0; i<nweights; i+=1)
+        len += sprintf(buf+len, "<%s VALUE=\"%f\"/>", weights[i],
+                       2.0 * drand48());
+    len += sprintf(buf+len, "</VARIABLES></BABY>");
+    return len;
+}
+
+static void reply(int s, char *body)
+{
+    char hdr[256];
+    int len = strlen(body);
+
+    sprintf(hdr, "HTTP/1.1 200 OK\r\nContent-Type: text/xml\r\n"
+            "Content-Length: %d\r\nConnection: keep-alive\r\n\r\n", len);
+    send(s, hdr, strlen(hdr), MSG_NOSIGNAL);
+    send(s, body, len, MSG_NOSIGNAL);
+}
+
+/* handle a single request, body is the POST payload (may be empty) */
+static void handle(int s, char *path, char *body)
+{
+    static char out[BUFSIZE];
+    char *op, *arg, *line, id[64];
+    double fit;
+    int n, len;
+
+    op = strstr(path, "op=");
+    op = (op == NULL) ? "" : op + 3;
+
+    if (!strncmp(op, "get_babies", 10))  {
+        n = ((arg = strstr(path, "n=")) != NULL) ? atoi(arg+2) : 1;
+        len = sprintf(out, "<BABIES>");
+        while (n-- > 0 && issued < babies && len < BUFSIZE - 4096)
+            len += writeBaby(out+len);
+        sprintf(out+len, "</BABIES>\n");
+        reply(s, out);
+    }
+
+    else if (!strncmp(op, "get_baby", 8))  {
+        len = sprintf(out, "<GA>");
+        len += writeBaby(out+len);
+        sprintf(out+len, "</GA>\n");
+        reply(s, out);
+    }
+
+    else if (!strncmp(op, "mature_babies", 13))  {
+        for (line=strtok(body, "\n"); line; line=strtok(NULL, "\n"))
+            if (sscanf(line, "%63s %lf", id, &fit) == 2)  {
+                printf("%s %f\n", id, fit);
+                matured += 1;
+            }
+        fflush(stdout);
+        reply(s, "OK\n");
+    }
+
+    else if (!strncmp(op, "mature_baby", 11))  {
+        arg = strstr(path, "id=");
+        op = strstr(path, "fit=");
+        printf("%.8s %f\n", arg ? arg+3 : "?", op ? atof(op+4) : 0.0);
+        fflush(stdout);
+        matured += 1;
+        reply(s, "OK\n");
+    }
+
+    else
+        reply(s, "<ERROR/>\n");
+}
+
+/* serve requests on a connection until the client closes it */
+static void serve(int s)
+{
+    static char buf[BUFSIZE+1];
+    char path[4096], version[16], *end, *cl;
+    int have = 0, n, hlen, clen;
+
+    for (;;)  {
+        buf[have] = '\0';
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL)  {
+            if (have == BUFSIZE || (n = recv(s, buf+have, BUFSIZE-have, 0)) <= 0)
+                return;
+            have += n;
+            buf[have] = '\0';
+        }
+        hlen = end - buf + 4;
+        cl = strcasestr(buf, "Content-Length:");
+        clen = (cl != NULL && cl < end) ? atoi(cl + 15) : 0;
+        while (have < hlen + clen)  {
+            if ((n = recv(s, buf+have, BUFSIZE-have, 0)) <= 0)
+                return;
+            have += n;
+        }
+
+        if (sscanf(buf, "%*s %4095s %15s", path, version) != 2)
+            return;
+        end = buf + hlen + clen;
+        n = *end;  *end = '\0';
+        handle(s, path, buf + hlen);
+        *end = n;
+
+        /* the original protocol reads until the connection closes */
+        if (!strcmp(version, "HTTP/1.0"))
+            return;
+
+        have -= hlen + clen;
+        memmove(buf, buf + hlen + clen, have);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int i, ls, s, port = 8080, on = 1;
+    long seed = 1;
+    struct sockaddr_in addr;
+
+    for (i=1; i<argc; i+=1)  {
+        if (!strcmp(argv[i], "-p") && i+1 < argc)
+            port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i+1 < argc)
+            babies = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i+1 < argc)
+            seed = atol(argv[++i]);
+        else if (argv[i][0] == '-')  {
+            fprintf(stderr, "Usage: %s [-p port] [-n babies] [-s seed] "
+                    "[WEIGHT ...]\n", argv[0]);
+            exit(1);
+        }
+        else
+            break;
+    }
+    if (i < argc)  {
+        weights = argv + i;
+        nweights = argc - i;
+    }
+    srand48(seed);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((ls = socket(PF_INET, SOCK_STREAM, 0)) == -1)  {
+        perror("socket");
+        exit(1);
+    }
+    setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(ls, (struct sockaddr *)&addr, sizeof addr) || listen(ls, 4))  {
+        perror("bind");
+        exit(1);
+    }
+    fprintf(stderr, "gastub: serving %d babies on port %d\n", babies, port);
+
+    while ((s = accept(ls, NULL, NULL)) != -1)  {
+        serve(s);
+        close(s);
+        if (issued >= babies && matured >= babies)
+            break;
+    }
+
+    close(ls);
+    return 0;
+}
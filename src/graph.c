@@ -184,6 +184,51 @@ void GRAPHreadFile(char *fname)
   fclose(f);
 }
 
+/* Pack the graph table into buf for broadcast by SME.c, or just
+** return the packed size when buf is NULL.
+*/
+int GRAPHpack(char *buf)
+{
+  int i, size = sizeof (int);
+  char *p = buf;
+
+  for (i=0; i<gidx; i+=1)
+    size += sizeof graphs[i].name + sizeof (int)
+            + graphs[i].len * sizeof (float);
+  if (buf == NULL)
+    return size;
+
+  memcpy(p, &gidx, sizeof (int));  p += sizeof (int);
+  for (i=0; i<gidx; i+=1)  {
+    memcpy(p, graphs[i].name, sizeof graphs[i].name);
+    p += sizeof graphs[i].name;
+    memcpy(p, &graphs[i].len, sizeof (int));  p += sizeof (int);
+    memcpy(p, graphs[i].data, graphs[i].len * sizeof (float));
+    p += graphs[i].len * sizeof (float);
+  }
+
+  return size;
+}
+
+/* Add the graphs packed by GRAPHpack, returns the end of the table */
+char *GRAPHunpack(char *p)
+{
+  int i, n, len;
+  char name[256];
+  float databuf[DATABUFSIZE];
+
+  memcpy(&n, p, sizeof (int));  p += sizeof (int);
+  for (i=0; i<n; i+=1)  {
+    memcpy(name, p, sizeof name);  p += sizeof name;
+    memcpy(&len, p, sizeof (int));  p += sizeof (int);
+    memcpy(databuf, p, len * sizeof (float));
+    p += len * sizeof (float);
+    GRAPHaddGraph(name, len, databuf);
+  }
+
+  return p;
+}
+
 void GRAPHinit()
 {
   int i;
@@ -651,6 +651,311 @@ HTTP_Response http_request( char *in_URL, HTTP_Extra *in_Extra, HTTP_Method in_M
     return( hResponse );
 }
 
+/*
+ * Function Name:   http_open
+ *
+ * Parameters:      char *in_URL        http URL of the server
+ *                  int in_Timeout      seconds to wait on connect, send
+ *                                      and receive (0 waits forever)
+ *
+ * Description:     open a persistent HTTP/1.1 connection to the server
+ *                  (or the http_proxy) named in the URL.  Unlike
+ *                  http_request() the connection is kept open so that
+ *                  several requests can share it, and may be pipelined.
+ *
+ * Returns:         pointer to an HTTP_Conn, NULL on failure
+ *
+ */
+HTTP_Conn *http_open( char *in_URL, int in_Timeout )
+{
+    HTTP_Conn *conn;
+    char scheme[50], *path, *proxy;
+    struct hostent *nameinfo;
+    struct sockaddr_in addr;
+    struct timeval tv;
+
+    conn = (HTTP_Conn *)calloc( 1, sizeof (HTTP_Conn) );
+    if( conn == NULL )
+        return( NULL );
+    conn->iSocket = -1;
+    conn->iTimeout = in_Timeout;
+
+    if( (proxy = getenv( "http_proxy" )) != NULL )
+    {
+        path = parse_url( proxy, scheme, conn->szHost, &conn->iPort );
+        conn->iProxy = 1;
+    }
+    else
+        path = parse_url( in_URL, scheme, conn->szHost, &conn->iPort );
+    if( path ) free( path );
+
+    if( !conn->iProxy && strcasecmp( scheme, "http" ) != 0 )
+    {
+        fprintf( stderr, "http_open cannot operate on %s URLs without a proxy\n", scheme );
+        free( conn );
+        return( NULL );
+    }
+
+    if( (nameinfo = gethostbyname( conn->szHost )) == NULL )
+    {
+        addr.sin_addr.s_addr = inet_addr( conn->szHost );
+        if( (int)addr.sin_addr.s_addr == -1 )
+        {
+            fprintf( stderr, "Unknown host %s\n", conn->szHost );
+            free( conn );
+            return( NULL );
+        }
+    }
+    else
+        memcpy( (char *)&addr.sin_addr.s_addr, nameinfo->h_addr, nameinfo->h_length );
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( conn->iPort );
+
+    if( (conn->iSocket = socket( PF_INET, SOCK_STREAM, 0 )) == -1 )
+    {
+        free( conn );
+        return( NULL );
+    }
+
+    /* Bound every blocking call on the socket (connect included on
+     * most systems) so a stalled server can't hang the caller. */
+    if( in_Timeout > 0 )
+    {
+        tv.tv_sec = in_Timeout;
+        tv.tv_usec = 0;
+        setsockopt( conn->iSocket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv );
+        setsockopt( conn->iSocket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv );
+    }
+
+    if( connect( conn->iSocket, (struct sockaddr *)&addr, sizeof(addr) ) == -1 )
+    {
+        fprintf( stderr, "http_open: connect to %s:%d failed (%s)\n",
+                 conn->szHost, conn->iPort, strerror( errno ) );
+        close( conn->iSocket );
+        free( conn );
+        return( NULL );
+    }
+
+    return( conn );
+}
+
+/*
+ * Function Name:   http_send
+ *
+ * Parameters:      HTTP_Conn *conn     connection from http_open()
+ *                  char *in_URL        http URL to request
+ *                  HTTP_Extra *in_Extra  extra headers and POST data
+ *                  int in_Method       enum for method type
+ *
+ * Description:     write one HTTP/1.1 request on the connection without
+ *                  waiting for the response.  Only GET and POST are
+ *                  supported.
+ *
+ * Returns:         1 on success, 0 if the connection failed
+ *
+ */
+int http_send( HTTP_Conn *conn, char *in_URL, HTTP_Extra *in_Extra, HTTP_Method in_Method )
+{
+    char *pRequest, *path, scheme[50], host[MAXPATHLEN];
+    int port, len, sent, n, postlen;
+
+    if( conn == NULL || conn->iSocket == -1 )
+        return( 0 );
+
+    path = parse_url( in_URL, scheme, host, &port );
+    if( path == NULL )
+        return( 0 );
+
+    postlen = (in_Method == kHMethodPost && in_Extra != NULL
+               && in_Extra->PostData != NULL) ? in_Extra->PostLen : 0;
+
+    len = strlen( in_URL ) + 1024;
+    if( in_Extra != NULL && in_Extra->Headers != NULL )
+        len += strlen( in_Extra->Headers );
+    pRequest = (char *)calloc( 1, len + postlen );
+    if( pRequest == NULL )
+    {
+        free( path );
+        return( 0 );
+    }
+
+    sprintf( pRequest, "%s %s HTTP/1.1\r\nHost: %s\r\n",
+             (in_Method == kHMethodPost) ? "POST" : "GET",
+             conn->iProxy ? in_URL : path, host );
+    strcat( pRequest, "User-Agent: hget/"  LIBHTTP_VERSION "\r\n");
+    strcat( pRequest, "Connection: keep-alive\r\n" );
+    if( in_Method == kHMethodPost )
+    {
+        sprintf( pRequest + strlen( pRequest ), "Content-Length: %d\r\n", postlen );
+        strcat( pRequest, "Content-Type: text/plain\r\n" );
+    }
+    if( in_Extra != NULL && in_Extra->Headers != NULL )
+    {
+        strcat( pRequest, in_Extra->Headers );
+        strcat( pRequest, "\r\n" );
+    }
+    strcat( pRequest, "Accept: */*\r\n\r\n" );
+
+    /* header and payload go out together so that a pipelined server
+     * never sees a partial request */
+    len = strlen( pRequest );
+    if( postlen > 0 )
+        memcpy( pRequest + len, in_Extra->PostData, postlen );
+    len += postlen;
+
+    for( sent = 0; sent < len; sent += n )
+    {
+        n = send( conn->iSocket, pRequest + sent, len - sent, MSG_NOSIGNAL );
+        if( n <= 0 )
+        {
+            fprintf( stderr, "http_send: write to %s failed (%s)\n",
+                     conn->szHost, strerror( errno ) );
+            close( conn->iSocket );
+            conn->iSocket = -1;
+            break;
+        }
+    }
+
+    free( path );
+    free( pRequest );
+    return( conn->iSocket != -1 );
+}
+
+/* read more bytes from the connection into the connection buffer,
+ * returns the number of bytes read, 0 on close, -1 on error or timeout */
+static long http_fill( HTTP_Conn *conn )
+{
+    long bytes;
+
+    if( conn->lAlloc - conn->lBuf < BUFLEN )
+    {
+        conn->pBuf = realloc( conn->pBuf, conn->lAlloc + XFERLEN + 1 );
+        if( conn->pBuf == NULL )
+            return( -1 );
+        conn->lAlloc += XFERLEN;
+    }
+
+    bytes = recv( conn->iSocket, conn->pBuf + conn->lBuf, BUFLEN, 0 );
+    if( bytes > 0 )
+    {
+        conn->lBuf += bytes;
+        conn->pBuf[conn->lBuf] = '\0';
+    }
+    return( bytes );
+}
+
+/*
+ * Function Name:   http_recv
+ *
+ * Parameters:      HTTP_Conn *conn     connection from http_open()
+ *
+ * Description:     collect the response to the oldest outstanding
+ *                  request sent with http_send().  The response must
+ *                  carry a Content-Length unless the server closes the
+ *                  connection after it.
+ *
+ * Returns:         HTTP_Response struct, lSize < 0 on failure
+ *
+ *                  NOTE: the memory is allocated for the data transfered,
+ *                        and it is the responsibility of the *CALLER* to free
+ *                        the memory.
+ *
+ */
+HTTP_Response http_recv( HTTP_Conn *conn )
+{
+    HTTP_Response   hResponse = { 0,0,0,0,0,"","" };
+    char *h_end_ptr, *pHCode, value[32];
+    long header_size, content = -1, bytes;
+    int closing = 0;
+
+    hResponse.lSize = -1;
+    if( conn == NULL || conn->iSocket == -1 )
+        return( hResponse );
+
+    /* read until the complete header is available */
+    while( (h_end_ptr = (conn->lBuf > 0) ?
+            find_header_end( conn->pBuf, conn->lBuf ) : NULL) == NULL )
+    {
+        if( (bytes = http_fill( conn )) <= 0 )
+        {
+            hResponse.iError = (bytes == 0) ? ECONNRESET : errno;
+            hResponse.pError = strerror( hResponse.iError );
+            fprintf( stderr, "http_recv: no response from %s (%s)\n",
+                     conn->szHost, hResponse.pError );
+            close( conn->iSocket );
+            conn->iSocket = -1;
+            return( hResponse );
+        }
+    }
+    header_size = (long)(h_end_ptr - conn->pBuf);
+
+    pHCode = strchr( conn->pBuf, ' ' );
+    if( pHCode != NULL )
+        strncpy( hResponse.szHCode, pHCode + 1, 3 );
+    if( find_header( conn->pBuf, header_size, "Content-Length:", value, sizeof value ) )
+        content = atol( value );
+    if( find_header( conn->pBuf, header_size, "Connection:", value, sizeof value ) )
+        closing = !strcasecmp( value, "close" );
+
+    /* read the body, to the end of the stream if no length was given */
+    while( content < 0 || conn->lBuf - header_size < content )
+    {
+        if( (bytes = http_fill( conn )) < 0 )
+        {
+            hResponse.iError = errno;
+            hResponse.pError = strerror( errno );
+            close( conn->iSocket );
+            conn->iSocket = -1;
+            return( hResponse );
+        }
+        if( bytes == 0 )
+        {
+            closing = 1;
+            if( content < 0 )
+                content = conn->lBuf - header_size;
+            else
+                break;
+        }
+    }
+    if( content > conn->lBuf - header_size )
+        content = conn->lBuf - header_size;
+
+    hResponse.pData = (char *)malloc( content + 1 );
+    if( hResponse.pData == NULL )
+        return( hResponse );
+    memcpy( hResponse.pData, conn->pBuf + header_size, content );
+    hResponse.pData[content] = '\0';
+    hResponse.lSize = content;
+
+    /* keep anything that belongs to the next pipelined response */
+    conn->lBuf -= header_size + content;
+    memmove( conn->pBuf, conn->pBuf + header_size + content, conn->lBuf );
+
+    if( closing )
+    {
+        close( conn->iSocket );
+        conn->iSocket = -1;
+    }
+    return( hResponse );
+}
+
+/*
+ * Function Name:   http_close
+ *
+ * Description:     close a connection opened with http_open() and free it
+ *
+ */
+void http_close( HTTP_Conn *conn )
+{
+    if( conn == NULL )
+        return;
+    if( conn->iSocket != -1 )
+        close( conn->iSocket );
+    if( conn->pBuf ) free( conn->pBuf );
+    free( conn );
+}
+
 #ifdef HF_DO_FILE
 /*
  * Function Name:   do_file
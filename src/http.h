@@ -82,6 +82,21 @@ typedef struct
   int   PostLen;        // Length of Post data
 } HTTP_Extra;
 
+/* A persistent (keep-alive) connection.  Requests may be pipelined:
+ * several may be sent with http_send() before the matching responses
+ * are collected, in order, with http_recv(). */
+typedef struct
+{
+    int  iSocket;                           //  connected socket, -1 if closed
+    char szHost[MAXPATHLEN];                //  host (or proxy) connected to
+    int  iPort;                             //  port connected to
+    int  iProxy;                            //  send absolute URLs to a proxy
+    int  iTimeout;                          //  seconds, 0 waits forever
+    char *pBuf;                             //  received bytes not yet returned
+    long lBuf;                              //  number of bytes in pBuf
+    long lAlloc;                            //  size allocated for pBuf
+} HTTP_Conn;
+
 typedef enum 
 {
     kHMethodOptions = 1,
@@ -96,6 +111,10 @@ typedef enum
 char *find_header_end( char *buf, int bytes );
 char *parse_url( char *url, char *scheme, char *host, int *port );
 HTTP_Response http_request( char *in_URL, HTTP_Extra *in_Extra, HTTP_Method in_Method, unsigned long in_Flags );
+HTTP_Conn *http_open( char *in_URL, int in_Timeout );
+int http_send( HTTP_Conn *conn, char *in_URL, HTTP_Extra *in_Extra, HTTP_Method in_Method );
+HTTP_Response http_recv( HTTP_Conn *conn );
+void http_close( HTTP_Conn *conn );
 #ifdef HF_DO_FILE
 HTTP_Response do_file(char *in_URL);
 #endif /* HF_DO_FILE */
@@ -16,12 +16,16 @@
 
 #include "leam.h"
 #include "bil.h"
+#include "GA.h"
+#include "perf.h"
 
 static char *TAG = "v3.1.2";
 
 int debug = 0;
 int timing = 0;
 int distribMethod = EQROWS;
+int deterministic = 0;
+long randseed = 0;
 int myrank, nproc;
 char *runName = NULL;
 
@@ -145,6 +149,7 @@ void GLUCusage(char *prog)
    printf(" --version      : print version information and exit\n");
    printf(" --histogram    : print histograms as part of debugging info\n");
    printf(" -r || --random : randomly seeds random number generator\n");
+   printf(" --deterministic: identical results for any processor count\n");
    printf(" -f || --final  : generates only final landuse and change map\n");
    printf(" -d || --debug  : turns on debugging information\n");
    printf(" -t || --timing : turns on performance timing results\n");
@@ -158,7 +163,7 @@ void parseOptions(int argc, char *argv[])
 {
     int i;
     char *name, *value;
-    struct timeval randseed;
+    struct timeval now;
 
     for (i=1; i<argc; i+=1)  {
         if (!strcmp(argv[i], "--newk"))
@@ -178,9 +183,12 @@ void parseOptions(int argc, char *argv[])
         else if (!strcmp(argv[i], "--histogram"))
             debug = 2;
         else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--random")) {
-            gettimeofday(&randseed, NULL);
-            srand48(randseed.tv_usec);
+            gettimeofday(&now, NULL);
+            randseed = now.tv_usec;
+            srand48(randseed);
         }
+        else if (!strcmp(argv[i], "--deterministic"))
+            deterministic = 1;
         else if (!strcmp(argv[i], "-g") || !strcmp(argv[i], "--graph"))
             GRAPHreadFile(argv[++i]);
         else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug"))
@@ -237,7 +245,8 @@ int main(int argc, char *argv[])
     gettimeofday(&start, NULL);
 
     // initial MPI
-    MPI_Init(&argc, &argv);
+    // the probmap prefetch thread never makes MPI calls
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &i);
     MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
     MPI_Comm_size(MPI_COMM_WORLD, &nproc);
 
@@ -258,6 +267,10 @@ int main(int argc, char *argv[])
 
     SMEparseOptions(argc, argv);
     parseOptions(argc, argv);
+    MEMsetBudget(SMEgetInt("MEMORY_BUDGET_MB", 0));
+    PERFinit(timing, SMEgetFileName("PERF_LOG"));
+    REPROinit(deterministic || SMEgetInt("DETERMINISTIC", 0),
+              SMEgetInt("RANDOM_SEED", randseed));
 
     if (debug && myrank == 0) { 
         fprintf(stderr, "LEAM model running. Args = '");
@@ -294,10 +307,14 @@ int main(int argc, char *argv[])
     ** if GA Engine is specified loop...indefinitely?
     */
     do {
-        LUCresetGrids();
+        if (!LUCresetGrids())
+            break;
         LUCrun();
     }  while (SMEgetFileName("GA_ENGINE") != NULL);
 
+    if (myrank == 0 && SMEgetFileName("GA_ENGINE") != NULL)
+        GAfinish();
+
         
     /* Clean up.  We'll make sure that everyone gets here before
     ** calling MPI_Finalize.  We have to report timing prior to 
@@ -309,23 +326,27 @@ int main(int argc, char *argv[])
     if (timing && myrank == 0)  {
         printf("\n===== Timing Information ======\n");
         if (end.tv_usec - start.tv_usec < 0)  {
-            printf("%d processor run complete, wallclock time = %ld.%ld\n", 
+            printf("%d processor run complete, wallclock time = %ld.%06ld\n", 
             nproc, (long)(end.tv_sec - start.tv_sec - 1), 
             end.tv_usec - start.tv_usec + 1000000);
         }
         else {
-            printf("%d processor run complete, wallclock time = %ld.%ld\n",
+            printf("%d processor run complete, wallclock time = %ld.%06ld\n",
             nproc, (long)(end.tv_sec-start.tv_sec), end.tv_usec-start.tv_usec);
         }
         if (end.tv_usec - ioend.tv_usec < 0)  {
-            printf("computional component, wallclock time = %ld.%ld\n", 
+            printf("computional component, wallclock time = %ld.%06ld\n", 
             (long)(end.tv_sec - ioend.tv_sec - 1), 
             end.tv_usec - ioend.tv_usec + 1000000);
         }
         else {
-            printf("computional components, wallclock time = %ld.%ld\n",
+            printf("computional components, wallclock time = %ld.%06ld\n",
             (long)(end.tv_sec-ioend.tv_sec), end.tv_usec-ioend.tv_usec);
         }
     }
+    if (timing)  {
+        PERFreport();
+        MEMreport();
+    }
     MPI_Finalize();
 }
@@ -18,6 +18,9 @@
 // getting into the demand calculation
 #define MIN_DENSITY    -100.0
 
+#include "quant.h"
+#include "repro.h"
+
 typedef int SUBMODELS;
 #define RES_MODEL      ((SUBMODELS)1)
 #define COM_MODEL      ((SUBMODELS)1 << 1)
@@ -52,6 +55,9 @@ typedef int LU_FLAG;
 #define AG_FLAG        ((LU_FLAG)1 << 5)         /* LU_VALUE xx xx xx */
 #define WETLAND_FLAG   ((LU_FLAG)1 << 6)         /* LU_VALUE 91 92 */
 #define DEVELOPED_FLAG  (RES_FLAG | COM_FLAG | ROAD_FLAG)
+#define DIFFUSE_SOURCES (DEVELOPED_FLAG | OS_FLAG)  /* see spatialDiffusion */
+
+#define NN_FRACTION     255     /* SPATIALneighborhood code of fraction 1 */
 #define NONDEVELOPABLE_FLAGS    \
         (WATER_FLAG | DEVELOPED_FLAG | WETLAND_FLAG )
 
@@ -69,16 +75,25 @@ extern float xdim, ydim;
 extern char estring[];
 extern char *getMem(int, char *);
 extern void freeMem(void *);
+extern void MEMsetBudget(int);
+extern int MEMtrack(char *, long);
+extern void MEMuntrack(int, long);
+extern void MEMreport();
 extern void errorExit(char *);
 
 /* luc.c */
 extern int gRows, gCols;
 extern void selector(unsigned char *, float *, float *, float*);
 extern void shareGrid(void *, int, MPI_Datatype);
-extern char *initGridMaps(char *, int, int);
-extern void readProbmap(float **, int, int, char *, int);
+extern void shareRows(void *, void *, void *, void *, int, MPI_Datatype);
+extern char *initGridMap(char *, int, int);
+extern void freeGridMap(char *, int);
+extern void LUCreadGridMap(char *, char *, int, int);
+extern int LUCapplyDelta(char *, char *, int);
+extern void checkHeader(char *);
 extern void LUCconfigGrids(int, int, int *);
 extern void LUCinitGrids();
+extern int LUCresetGrids();
 extern void LUCrun();
 
 /* SME.c */
@@ -88,12 +103,18 @@ extern char *SMEgetString(char*, char*);
 extern float SMEgetData(char*, float);
 extern double SMEgetFloat(char*, float);
 extern int SMEgetInt(char*, int);
+extern void SMEaddVar(char*, char*);
 extern void SMEparseConfig(char*, char*, char*);
 extern void SMEparseOptions(int, char**);
 
 /* spatial.c */
 extern float SPATIALfalseDev(float, float *, float *, float *, int);
-extern float SPATIALfalseDev2(float, float, float *, float *, float *, int);
+extern float SPATIALfalseDev2(float, float, float *, QGRID_T *, float *, int);
+extern void SPATIALflagDevelopable(unsigned char *, unsigned char *, int,
+                                   LU_FLAG);
+extern int SPATIALdevelop(unsigned char *, unsigned char *, unsigned char *,
+                          float *, float *, QGRID_T *, int, int, int,
+                          REPRO_SUM *);
 extern void SPATIALhistogramLog(float *, int);
 extern float SPATIALweightedSum(float *, unsigned char *, int, int);
 extern float spatialSumF(float *, int);
@@ -105,8 +126,13 @@ extern void spatialCorrelatedCount(int *, int , int *, unsigned char *,
                                    int, int);
 extern void spatialCorrelatedSumF(float *, int , int *, float *, int);
 extern void nearestNeighbors(unsigned char *, unsigned char *, int, unsigned char *, int, int);
+extern void SPATIALneighborhood(unsigned char *, int, unsigned char *, int,
+                                int, int);
 extern int spatialDiffusion(float *, float *, float, int, unsigned char *,
                             int, int);
+extern LU_FLAG SPATIALdiffusionClass(unsigned char);
+extern void SPATIALdiffusionSteps(int, float **, float *, int *,
+                                  unsigned char *, int, int, int, int);
 
 /* score.c */
 extern double scoreResults(int *, int , int *, unsigned char *, int );
@@ -115,6 +141,8 @@ extern double scoreResults(int *, int , int *, unsigned char *, int );
 /* graph.c */
 extern void GRAPHinit();
 extern void GRAPHreadFile(char *);
+extern int GRAPHpack(char *);
+extern char *GRAPHunpack(char *);
 extern void GRAPHaddGraph(char *, int, float *);
 extern void *GRAPHgetGraph(char *);
 extern float *GRAPHgetGraphData(char *);
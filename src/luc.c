@@ -22,6 +22,17 @@
 #include "leam.h"
 #include "bil.h"
 #include "GA.h"
+#include "probmap.h"
+#include "delta.h"
+#include "arena.h"
+#include "perf.h"
+#include "driver.h"
+#include "multigrid.h"
+#include "distance.h"
+#include "cost.h"
+#include "smooth.h"
+#include "patch.h"
+#include "score.h"
 
 static char *ID = "$Id: luc.c,v 1.49 2005/02/17 21:40:47 jefft Exp $";
 
@@ -35,10 +46,13 @@ unsigned char *slope, *floodzone;
 unsigned char *metrobuffer, *growth_trend_map;
 static int    nondevelopable_flags;
 
-static float *probmap_res, *probmap_com, *probmap_os;
+static QGRID_T *probmap_os;
+static PROBMAP_T *pm_res, *pm_com;     // PROBMAP_RES and PROBMAP_COM
 
 static void *demandres, *demandcom, *demandos;
 static void *nngraph, *nnosgraph;
+static void *nnfracgraph;               // NearestNeighborsFraction
+static int   nn_radius;                 // NN_RADIUS
 
 unsigned char *highway_att, *road_att, *ramp_att, *intersection_att;
 unsigned char *allroad_att, *park_att, *forest_att, *water_att;
@@ -49,7 +63,7 @@ unsigned char *zoning;
 
 int *cities_att, *employment_att, *subregions;
 float *growth_trend;
-float *density_res, *density_com, *density_os;
+QGRID_T *density_res, *density_com, *density_os;
 int cell_count_res = 0, cell_count_com = 0, cell_count_os = 0;
 
 static float buffer_rate_in, buffer_rate_out;
@@ -82,8 +96,145 @@ static float growthrate_res, growthrate_com, growthrate_os;
 static float k_factor_res, k_factor_com, k_factor_os;
 static float k_coeff_res, k_coeff_com, k_coeff_os;
 static int   refzones = 0, *refmap = NULL, *refcounts = NULL;
+static int   accuracy = 0;            // REFERENCE_LU_MAP given
+
+/* byte driver layers (see driver.c), loaded when the map is given.
+** Weights are W_<name>_RES, _COM and _OS, all 0 (the default) is off.
+*/
+static struct {
+    char *map;
+    unsigned char **grid;
+    float *w[3];                         // res, com, os weights
+} drivers[] = {
+    { "HIGHWAY_ATT_MAP", &highway_att,
+      { &w_highway_att_res, &w_highway_att_com, &w_highway_att_os } },
+    { "ROAD_ATT_MAP", &road_att,
+      { &w_road_att_res, &w_road_att_com, &w_road_att_os } },
+    { "RAMP_ATT_MAP", &ramp_att,
+      { &w_ramp_att_res, &w_ramp_att_com, &w_ramp_att_os } },
+    { "INTERSECTION_ATT_MAP", &intersection_att,
+      { &w_intersection_att_res, &w_intersection_att_com,
+        &w_intersection_att_os } },
+    { "ALLROAD_ATT_MAP", &allroad_att,
+      { &w_allroad_att_res, &w_allroad_att_com, &w_allroad_att_os } },
+    { "FOREST_ATT_MAP", &forest_att,
+      { &w_forest_att_res, &w_forest_att_com, &w_forest_att_os } },
+    { "WATER_ATT_MAP", &water_att,
+      { &w_water_att_res, &w_water_att_com, &w_water_att_os } },
+    { "SLOPE_MAP", &slope,
+      { &w_slope_res, &w_slope_com, &w_slope_os } },
+    { "VACANCY_RATE_MAP", &vacancy_rate,
+      { &w_vacancy_rate_res, &w_vacancy_rate_com, &w_vacancy_rate_os } },
+    { "AVG_INCOME_MAP", &avg_income,
+      { &w_avg_income_res, &w_avg_income_com, &w_avg_income_os } },
+    { "RENTAL_RATE_MAP", &rental_rate,
+      { &w_rental_rate_res, &w_rental_rate_com, &w_rental_rate_os } },
+    { "NO_CAR_MAP", &no_car,
+      { &w_no_car_res, &w_no_car_com, &w_no_car_os } },
+    { "SAME_HOME_MAP", &same_home,
+      { &w_same_home_res, &w_same_home_com, &w_same_home_os } },
+};
+#define DRIVERS (sizeof (drivers) / sizeof (drivers[0]))
+
+static DRIVER_T drv_res, drv_com, drv_os;
+static float driver_scale;
+
+/* proximity driver layers (see distance.c), the distance to the
+** nearest cell of the classes follows lu from year to year.  Weights
+** are W_<name>_RES, _COM and _OS, all 0 (the default) is off.
+*/
+static struct {
+    char *name;
+    LU_FLAG flags;
+    float w[3];                          // res, com, os weights
+    DIST_T *dist;                        // NULL until a weight is set
+} proximity[] = {
+    { "DEV_PROXIMITY", DEVELOPED_FLAG },
+    { "COM_PROXIMITY", COM_FLAG },
+    { "ROAD_PROXIMITY", ROAD_FLAG },
+};
+#define PROXIMITY (sizeof (proximity) / sizeof (proximity[0]))
+
+/* attractors computed in the model (see cost.c) with COST_ATTRACTORS
+** when their map isn't given, the travel cost to the nearest source
+** cell follows lu from year to year.  Weights are W_<map>_RES, _COM
+** and _OS without the _MAP, all 0 (the default) is off.
+*/
+static struct {
+    char *map;                           // the map they stand in for
+    LU_FLAG flags;                       // source classes
+    char *sources;                       // or a map of the sources
+    float *w[3];                         // res, com, os weights
+    COST_T *cost;                        // NULL if not computed
+} attractors[] = {
+    { "ROAD_ATT_MAP", ROAD_FLAG, NULL,
+      { &w_road_att_res, &w_road_att_com, &w_road_att_os } },
+    { "EMPLOYMENT_ATT_MAP", COM_FLAG, NULL,
+      { &w_employment_att_res, &w_employment_att_com,
+        &w_employment_att_os } },
+    { "CITIES_ATT_MAP", 0, "CITIES_MAP",
+      { &w_cities_att_res, &w_cities_att_com, &w_cities_att_os } },
+};
+#define ATTRACTORS (sizeof (attractors) / sizeof (attractors[0]))
+static int cost_incremental;            // COST_INCREMENTAL
+
+/* kernel density layers (see smooth.c), the smoothed share of cells of
+** the classes around a cell, smoothed again from lu every year.
+** Weights are W_<name>_RES, _COM and _OS, all 0 (the default) is off.
+*/
+static struct {
+    char *name;
+    LU_FLAG flags;
+    float w[3];                          // res, com, os weights
+    float *field;                        // NULL until a weight is set
+    unsigned char *grid;
+} kernels[] = {
+    { "RES_KERNEL", RES_FLAG },
+    { "COM_KERNEL", COM_FLAG },
+    { "DEV_KERNEL", DEVELOPED_FLAG },
+};
+#define KERNELS (sizeof (kernels) / sizeof (kernels[0]))
+static int kernel_shape;                // KERNEL_SHAPE gauss or exp
+static float kernel_scale;              // KERNEL_SCALE, cells
+
+/* patches of the residential and commercial cells (see patch.c) every
+** year with PATCH_METRICS, their metrics go in the Run Report.  Roads
+** stay out, they would join the whole town into one patch.
+*/
+static PATCH_T *patches;                // NULL unless PATCH_METRICS
+
+static char *submodels[3] = { "RES", "COM", "OS" };
+static DRIVER_T dyn_res, dyn_com, dyn_os;   // proximity, kernel and
+                                            // cost attractor layers
+static int proximity_reach;             // PROXIMITY_REACH
+static int proximity_incremental;       // PROXIMITY_INCREMENTAL
+
+/* The static part of a sub-model's probability, pm^wp * drivers, for
+** every cell.  It only changes with the probmap keyframe (or blend) of
+** the year, wp and the driver tables, so it is kept across years and
+** GA candidates and recomputed when one of those changes.
+*/
+typedef struct {
+    float *grid;                      // NULL until first needed
+    int   lokey, hikey, drvversion;
+    float frac, wp;
+} STATIC_T;
+static STATIC_T st_res, st_com, st_os;
+static int static_cache;              // STATIC_CACHE
+static unsigned char *growable;       // boundary and not nogrowth
+
+/* exponent classes of the probability terms (see powClass) */
+#define POW_ZERO  0
+#define POW_ONE   1
+#define POW_TWO   2
+#define POW_HALF  3
+#define POW_ANY   4
+
+#define NN_VALUES 9                   // 0..8 neighbors
+#define NN_CODES  (NN_FRACTION + 1)   // neighborhood fraction codes
 
 static float *ranvals;
+static int   curitr = 0;              // iteration keying the draws
 static float *resprob, *comprob, *osprob;
 static float desired_res = 0.0, desired_com = 0.0, desired_os = 0.0;
 static float current_res = 0.0, current_com = 0.0, current_os = 0.0;
@@ -95,12 +246,11 @@ static float *utilities_res, *utilities_com, *utilities_os, *utilities_tmp;
 static float diffusion_rate, diffusion_rate_os;
 static int   diffusion_res_flags, diffusion_com_flags, diffusion_os_flags;
 static int   diffusion_init_step, diffusion_steps_os;
+static int   diffusion_depth;         // steps per halo exchange
+static int   diffusion_mg;            // DIFFUSION_ENGINE multigrid
 
 static float openspace_los;
 
-static char *outbuf;
-
-
 /* MPI information */
 static int upproc, downproc;
 static int *recvcounts, *displacements;
@@ -168,7 +318,7 @@ void setModel(SUBMODELS model, int val)
        break;
 
    case OS_MODEL:
-       ComModel = val;
+       OSModel = val;
        break;
    }
 
@@ -208,66 +358,15 @@ void LUCconfigGrids(int rows, int cols, int *gridrows)
     for (i=1; i<nproc; i+=1)
         displacements[i] = displacements[i-1] + recvcounts[i-1];
 
-    if (debug) reportGridInfo();
-}
-
-/* Determine which cells are currently developable.
-** 
-** POSSIBLE_LU_FOR_COM_IND = if LAND_USE = 11 OR LAND_USE = 21 OR 
-**    LAND_USE = 22 OR LAND_USE = 23 OR LAND_USE = 24 OR 
-**    LAND_USE = 91 OR LAND_USE = 92 OR LAND_USE = 85 then 0 else 1
-** POSSIBLE_LU_FOR_OPENSPACE = if LAND_USE = 11 OR LAND_USE = 21 OR 
-**    LAND_USE = 22 OR LAND_USE = 23 OR LAND_USE = 24 OR LAND_USE = 91 OR
-**    LAND_USE = 92 OR LAND_USE = 85 then 0 else 1
-** POSSIBLE_LU_FOR_RES = if LAND_USE = 11 OR LAND_USE = 21 OR 
-**    LAND_USE = 22 OR LAND_USE = 23 OR LAND_USE = 24 OR LAND_USE = 91 OR
-**    LAND_USE = 92  OR LAND_USE = 85 then 0 else 1
-**
-** This routine should be probably combine additional
-** information from boundary and nogrowth map (others?) to
-** simplify the checking for active cells in the calcProb routines
-** but we'll leave it this way for now.
-**
-** We should probably be able flag different landuse types as developable
-** i.e. wetlands, ect.  Or even better have probabiliy based on landuse type.
-** Recommend we get rid of this routine.
-** The switch statement could get replaced with an equation that
-** would eliminates all the comparisons for performance.
-*/
-static void flagDevelopable(unsigned char *dev, unsigned char *luptr, 
-                            int count, LU_FLAG flag)
-{
-    int i;
-
-    for (i=0; i<count; i+=1)  {
-        switch (*(luptr+i))  {
-        case LU_WATER:
-            *(dev+i) = !(WATER_FLAG & flag);
-            break;
-        case LU_LRES: case LU_HRES:
-            *(dev+i) = !(RES_FLAG & flag);
-            break;
-        case LU_COM:
-            *(dev+i) = !(COM_FLAG & flag);
-            break;
-        case LU_ROAD:
-            *(dev+i) = !(ROAD_FLAG & flag);
-            break;
-        case LU_HWET: case LU_WET:
-            *(dev+i) = !(WETLAND_FLAG & flag);
-            break;
-        case LU_OS:
-            *(dev+i) = !(OS_FLAG & flag);
-            break;
-
-        default:
-            *(dev+i) = 1;
+    /* reserve the grid arena, only touched pages are committed */
+    if ((i = SMEgetInt("GRID_ARENA_MB", 0)) > 0)
+        ARENAinit((long)i << 20);
+    else
+        ARENAinit((long)ARENA_GRIDS * (elements + 2*cols) * sizeof (float));
 
-        }
-    }
+    if (debug) reportGridInfo();
 }
 
-
 #ifdef ORIGINAL_GROWTH_TREND
 
 /* Growth Trends driver -- literal translation
@@ -390,6 +489,8 @@ void shareGrid(void *dst, int count, MPI_Datatype type)
     if (nproc == 1) return;
 
     MPI_Type_size(type, &size);
+    PERFstart(PERF_HALO);
+    PERFcount(PERF_BYTES_MPI, 2 * gCols * size);
 
     /* recieve into upside row and send downside row */
     MPI_Irecv(dst-gCols*size, gCols, type, upproc, 19,
@@ -403,6 +504,36 @@ void shareGrid(void *dst, int count, MPI_Datatype type)
               MPI_COMM_WORLD, &request);
     MPI_Send(dst, gCols, type, upproc, 19, MPI_COMM_WORLD);
     MPI_Wait(&request, &status);
+    PERFstop(PERF_HALO);
+}
+
+/* Deep halo exchange for kernels that advance several steps between
+** exchanges.  The n elements at first go to the rank above and those
+** at last to the rank below, what they send back is received into
+** top and bottom.  The buffers may hold several grids' rows packed
+** into one message.
+*/
+void shareRows(void *top, void *bottom, void *first, void *last, int n,
+               MPI_Datatype type)
+{
+    int size;
+    MPI_Request request;
+    MPI_Status status;
+
+    if (nproc == 1) return;
+
+    MPI_Type_size(type, &size);
+    PERFstart(PERF_HALO);
+    PERFcount(PERF_BYTES_MPI, 2 * n * size);
+
+    MPI_Irecv(top, n, type, upproc, 20, MPI_COMM_WORLD, &request);
+    MPI_Send(last, n, type, downproc, 20, MPI_COMM_WORLD);
+    MPI_Wait(&request, &status);
+
+    MPI_Irecv(bottom, n, type, downproc, 20, MPI_COMM_WORLD, &request);
+    MPI_Send(first, n, type, upproc, 20, MPI_COMM_WORLD);
+    MPI_Wait(&request, &status);
+    PERFstop(PERF_HALO);
 }
 
 /* Set grids to the a known value.  There should be a better way
@@ -463,7 +594,7 @@ static void copyGridMap(void *dst, void *src, int count, int size)
     return;
 }
 
-static void checkHeader(char *fname)
+void checkHeader(char *fname)
 {
     int rows, cols, size;
 
@@ -477,26 +608,82 @@ static void checkHeader(char *fname)
 }
 
 
+/* Read a grid from file into buffer.  The buffer must come from
+** initGridMap and bufptr is its active area, the passive rows
+** shared with neighboring processors are also read.
+**
+** Note: hardcoded for bil files...yuck.
+*/
+void LUCreadGridMap(char *fname, char *bufptr, int count, int typesize)
+{
+    int seekbyte, passive;
+    char *readptr;
+
+    /* calculate where to begin reading data into buffer,
+    ** basically the beginning of the buffer unless rank = 0
+    ** in which case will skip the first row of the buffer.
+    */
+    readptr = bufptr - ((myrank == 0) ? 0 : gCols * typesize);
+
+    /* extra number of elements read for passive rows, 
+    ** zero if running in single processor mode,
+    ** one row if rank is first or last processor
+    ** two rows otherwise.
+    */
+    if (nproc == 1)
+        passive = 0;
+    else if (myrank == 0 || myrank == nproc-1)
+        passive = gCols;
+    else
+        passive = 2 * gCols;
+
+    /* calculate seek position into file (first passive row)
+    */
+    seekbyte = (myrank == 0) ? 0 : (srow-1) * gCols * typesize;
+
+    PERFstart(PERF_READ);
+    BILreadBuffer(fname, seekbyte, readptr, count+passive, typesize);
+    PERFcount(PERF_BYTES_READ, (long)(count+passive) * typesize);
+    PERFstop(PERF_READ);
+}
+
+/* Apply a delta file (see delta.c) in place to a grid from
+** initGridMap, passive rows included.  Returns cells updated.
+*/
+int LUCapplyDelta(char *fname, char *bufptr, int typesize)
+{
+    int r0, r1, n;
+
+    r0 = (srow > 0) ? srow - 1 : 0;
+    r1 = (erow < gRows - 1) ? erow + 1 : gRows - 1;
+
+    PERFstart(PERF_READ);
+    n = DELTAapply(fname, bufptr + (r0 - srow) * gCols * typesize,
+                   r0, r1 - r0 + 1, gRows, gCols, typesize);
+    PERFstop(PERF_READ);
+    return n;
+}
+
 /* Initialize grids.  Sufficient space is allocated for all
 ** elements plus two additional rows (overlaps with neighboring
 ** processors).  If a file name is given the grid is initialized
 ** with data from the file otherwise it defaults to 0.
 **
 ** Note: still dependent on global variable 'gCols'.
-** Note: hardcoded for bil files...yuck.
 */
-static char *initGridMap(char *fname, int count, int typesize)
+char *initGridMap(char *fname, int count, int typesize)
 {
-    int seekbyte, passive;
-    char *bufptr, *readptr;
-    FILE *f;
+    char *bufptr;
 
     if (debug && myrank == 0 && fname != NULL) 
         fprintf(stderr, "initGridMap(fname=%s, count=%d, size=%d\n",
         fname, count, typesize); 
 
-    /* allocate for all the active elements + 2 passive rows */
-    bufptr = getMem((count + gCols + gCols) * typesize, fname);
+    /* allocate for all the active elements + 2 passive rows, the
+    ** active area is aligned (see arena.c)
+    */
+    bufptr = ARENAalloc(gCols * typesize, (count + gCols) * typesize,
+                        (fname != NULL) ? fname : "grid map");
 
     /* fill the buffer if filename is provided */
     if (fname != NULL)  {
@@ -507,36 +694,13 @@ static char *initGridMap(char *fname, int count, int typesize)
         ** on-the-fly interpolation.
         */
         checkHeader(fname);
-
-        /* calculate where to begin reading data into buffer,
-        ** basically the beginning of the buffer unless rank = 0
-        ** in which case will skip the first row of the buffer.
-        */
-        readptr = bufptr + ((myrank == 0) ? gCols * typesize : 0);
-
-        /* extra number of elements read for passive rows, 
-        ** zero if running in single processor mode,
-        ** one row if rank is first or last processor
-        ** two rows otherwise.
-        */
-        if (nproc == 1)
-            passive = 0;
-        else if (myrank == 0 || myrank == nproc-1)
-            passive = gCols;
-        else
-            passive = 2 * gCols;
-
-        /* calculate seek position into file (first passive row)
-        */
-        seekbyte = (myrank == 0) ? 0 : (srow-1) * gCols * typesize;
-
-        BILreadBuffer(fname, seekbyte, readptr, count+passive, typesize);
+        LUCreadGridMap(fname, bufptr, count, typesize);
     }
 
     /* always return pointer to active area of buffer (first
     ** non-passive row of the buffer.
     */
-    return bufptr + gCols * typesize;
+    return bufptr;
 }
 
 static char *initGridMapNull(char *fname, int count, int typesize)
@@ -547,13 +711,42 @@ static char *initGridMapNull(char *fname, int count, int typesize)
         return initGridMap(fname, count, typesize);
 }
 
+/* Load a static float grid stored with precision mode (see quant.c).
+** If fname is NULL every cell is set to def.
+*/
+static QGRID_T *initQGridMap(char *fname, float def, int mode)
+{
+    QGRID_T *q;
+    float *g;
+
+    q = QGRIDinit(elements, mode);
+    if (mode == QUANT_F32)
+        g = (float *)q->data;
+    else
+        g = (float *)initGridMap(NULL, elements, sizeof (float));
+
+    if (fname != NULL)  {
+        checkHeader(fname);
+        LUCreadGridMap(fname, (char *)g, elements, sizeof (float));
+    }
+    else
+        setGridMapFloat(g, elements, def);
+
+    if (mode != QUANT_F32)  {
+        QGRIDset(q, g);
+        freeGridMap((char *)g, sizeof (float));
+    }
+
+    return q;
+}
+
 /* freeGridMap corrects for additional memory originally
 ** allocated on each buffer to allow the grid to be freed.
 ** See the return value of initGridMap for a better understanding.
 */
-static void freeGridMap(char *bufptr, int typesize)
+void freeGridMap(char *bufptr, int typesize)
 {
-    freeMem(bufptr - gCols * typesize);
+    ARENAfree(bufptr, gCols * typesize);
 }
 
 /*
@@ -612,9 +805,124 @@ static void orGridMap(unsigned char *dst, unsigned char *m1,
     return;
 }
 
-/* Write the grid to the Map2 file.  The filename has a timestamp
-** and .m2 extension appended to it.  The generic output buffer
-** is used to gather all the results before writing.
+/* Output grids are gathered to the root processor a block of rows
+** (about WRITE_BLOCK bytes) at a time with up to WRITE_RING blocks
+** in flight, so no processor holds a buffer the size of the global
+** grid.  Blocks arrive and are written in global row order.
+*/
+#define WRITE_BLOCK  (1 << 20)
+#define WRITE_RING   4
+
+/* advance the (rank, offset) cursor to the start of the next block */
+static void nextBlock(int *rank, int *off, int block)
+{
+    *off += block;
+    while (*rank < nproc && *off >= recvcounts[*rank])  {
+        *rank += 1;
+        *off = 0;
+    }
+}
+
+/* Write n elements (whole rows) to f as BIL or ASC text.  If scale
+** isn't 1.0 the (float) values are divided by scale on the way out
+** using tmp (n elements) when src is not writable.
+*/
+static void writeRows(FILE *f, int asc, char *src, int n, int typesize,
+                      float scale, char *tmp)
+{
+    int i, j;
+    float *fptr;
+
+    if (scale != 1.0)  {
+        fptr = (float *)((tmp != NULL) ? tmp : src);
+        for (i=0; i<n; i+=1)
+            fptr[i] = ((float *)src)[i] / scale;
+        src = (char *)fptr;
+    }
+
+    if (!asc)  {
+        BILwriteBlock(f, src, n, typesize);
+        PERFcount(PERF_BYTES_WRITE, (long)n * typesize);
+        return;
+    }
+
+    fptr = (float *)src;
+    for (j=0; j<n; j+=gCols)  {
+        for (i=j; i<j+gCols; i+=1)
+            PERFcount(PERF_BYTES_WRITE, fprintf(f, "%e ", (double)fptr[i]));
+        fprintf(f, "\n");
+    }
+}
+
+/* Stream a distributed grid to the open file f on the root processor,
+** every processor must call this.  The root writes its own rows while
+** the first blocks from the other processors are being received.
+*/
+static void streamGridMap(FILE *f, int asc, char *src, int count,
+                          MPI_Datatype type, float scale)
+{
+    int i, k, n, typesize, block;
+    int prank = 1, poff = 0, crank = 1, coff = 0;
+    char *ring, *tmp = NULL;
+    MPI_Request req[WRITE_RING];
+
+    MPI_Type_size(type, &typesize);
+    block = (WRITE_BLOCK / (gCols * typesize)) * gCols;
+    if (block < gCols) block = gCols;
+
+    PERFstart(PERF_WRITE);
+    if (myrank != 0)  {
+        for (i=0; i<count; i+=block)
+            MPI_Send(src + i * typesize, (count-i < block) ? count-i : block,
+                     type, 0, 22, MPI_COMM_WORLD);
+        PERFcount(PERF_BYTES_MPI, (long)count * typesize);
+        PERFstop(PERF_WRITE);
+        return;
+    }
+
+    /* post receives for the first blocks of the other processors */
+    ring = getMem(WRITE_RING * block * typesize, "output ring");
+    nextBlock(&prank, &poff, 0);
+    nextBlock(&crank, &coff, 0);
+    for (k=0; k<WRITE_RING && prank<nproc; k+=1)  {
+        n = recvcounts[prank] - poff;
+        MPI_Irecv(ring + k * block * typesize, (n < block) ? n : block, type,
+                  prank, 22, MPI_COMM_WORLD, req+k);
+        nextBlock(&prank, &poff, block);
+    }
+
+    /* write the local rows */
+    if (scale != 1.0)
+        tmp = getMem(block * typesize, "output scaling");
+    for (i=0; i<count; i+=block)
+        writeRows(f, asc, src + i * typesize, 
+                  (count-i < block) ? count-i : block, typesize, scale, tmp);
+    if (tmp != NULL)
+        freeMem(tmp);
+
+    /* write each block as it arrives and reuse its slot */
+    for (k=0; crank<nproc; k=(k+1)%WRITE_RING)  {
+        n = recvcounts[crank] - coff;
+        if (n > block) n = block;
+        MPI_Wait(req+k, MPI_STATUS_IGNORE);
+        writeRows(f, asc, ring + k * block * typesize, n, typesize, 
+                  scale, NULL);
+        nextBlock(&crank, &coff, block);
+
+        if (prank < nproc)  {
+            n = recvcounts[prank] - poff;
+            MPI_Irecv(ring + k * block * typesize, (n < block) ? n : block,
+                      type, prank, 22, MPI_COMM_WORLD, req+k);
+            nextBlock(&prank, &poff, block);
+        }
+    }
+
+    freeMem(ring);
+    PERFstop(PERF_WRITE);
+}
+
+/* Write the grid to a BIL file.  The filename has the .bil
+** extension appended to it.
 **
 ** fname can be NULL.  This means that no output file is request
 ** in the SME configuration file.  Specify it using  the M(M,<d>,<fname>) 
@@ -626,10 +934,9 @@ static void orGridMap(unsigned char *dst, unsigned char *m1,
 static int writeGridMap(char *fname, int time, char *src, int count, 
         MPI_Datatype type)
 {
-    int i, typesize, namelen;
+    int typesize, namelen;
     char fstring[1024], typename[MPI_MAX_OBJECT_NAME];
-    MPI_Status status;
-    char *ptr = outbuf;
+    FILE *f = NULL;
 
     if (fname == NULL) return 1;
 
@@ -640,46 +947,26 @@ static int writeGridMap(char *fname, int time, char *src, int count,
         fprintf(stderr, "writeGridMap(%s, %d, %d, %s, %d)\n", 
                 fname, time, count, typename, typesize);
 
-    /* append timestamp and write header file */
+    /* append extension and write header file */
     sprintf(fstring, "%s.bil", fname);
-    if (myrank == 0)
+    if (myrank == 0)  {
         BILwriteHeader(fstring, gRows, gCols, typesize, typename,
                        ulx, uly, xdim, ydim );
-
-    /* if running single processor then write buffer and return */
-    if (nproc == 1)  {
-        BILwriteBuffer(fstring, 0, src, count, typesize);
-        return 1;
+        f = BILopenBinary(fstring, "wb");
     }
 
-#ifdef MYGATHER
-    if (myrank == 0)  {
-        memmove(ptr, src, count * typesize);
-        for (i=1; i<nproc; i+=1)  {
-            MPI_Recv(ptr+typesize*displacements[i], recvcounts[i], type,
-                     i, 22, MPI_COMM_WORLD, &status);
-        }
-    }
-    else  {
-        MPI_Send(src, count, type, 0, 22, MPI_COMM_WORLD);
-    }
-#else
-    /* this doesn't seem to work... */
-    MPI_Gatherv(src, count, type, ptr, recvcounts+1,
-                displacements+1, type, 0, MPI_COMM_WORLD);
-#endif
+    streamGridMap(f, 0, src, count, type, 1.0);
 
     if (myrank == 0)
-        BILwriteBuffer(fstring, 0, outbuf, gElements, typesize);
+        BILclose(f);
 
     return 1;
 }
 
-static void ASCwrite(char *fname, int rows, int cols, float xll, float yll,
-                     float cellsize, MPI_Datatype type, void *src)
+/* open an ASC file and write its header */
+static FILE *ASCcreate(char *fname, int rows, int cols, float xll, float yll,
+                       float cellsize)
 {
-    int i,j;
-    double x;
     FILE *f;
 
     if (debug && myrank == 0)  {
@@ -697,27 +984,17 @@ static void ASCwrite(char *fname, int rows, int cols, float xll, float yll,
     fprintf(f, "cellsize\t%f\n", cellsize);
     fprintf(f, "NODATA_value\t-1\n");
 
-    for (j=0; j<rows; j+=1)  {
-        for (i=0; i<cols; i+=1)  {
-            x = *((float *)src+j*cols+i);  
-            fprintf(f, "%e ", x);
-        }
-        fprintf(f, "\n");
-    }
-
-    return;
+    return f;
 }
 
-/* Write Grid Map in the ASC format.
-** 
+/* Write Grid Map in the ASC format.  Values are divided by scale
+** as they are written.  Only float grids are supported.
 */
 static int writeAscGridMap(char *fname, int time, char *src, int count, 
-        MPI_Datatype type)
+        MPI_Datatype type, float scale)
 {
-    int i, typesize;
     char fstring[1024];
-    MPI_Status status;
-    char *ptr = outbuf;
+    FILE *f = NULL;
 
     if (fname == NULL) return 1;
 
@@ -725,45 +1002,40 @@ static int writeAscGridMap(char *fname, int time, char *src, int count,
         fprintf(stderr, "writeAscGridMap(%s, %d, %d)\n", 
                 fname, time, count);
 
-    MPI_Type_size(type, &typesize);
-
     sprintf(fstring, "%s.asc", fname);
+    if (myrank == 0)
+        f = ASCcreate(fstring, gRows, gCols, xllcorner, yllcorner, cellsize);
 
-    /* if running single processor then write write and return */
-    if (nproc == 1)  {
-        ASCwrite(fstring, gRows, gCols, xllcorner, yllcorner, cellsize, type, src);
-        return;
-    }
-
-#ifdef MYGATHER
-    if (myrank == 0)  {
-        memmove(ptr, src, count * typesize);
-        for (i=1; i<nproc; i+=1)  {
-            MPI_Recv(ptr+typesize*displacements[i], recvcounts[i], type,
-                     i, 22, MPI_COMM_WORLD, &status);
-        }
-    }
-    else  {
-        MPI_Send(src, count, type, 0, 22, MPI_COMM_WORLD);
-    }
-#else
-    /* this doesn't seem to work... */
-    MPI_Gatherv(src, count, type, ptr, recvcounts+1,
-                displacements+1, type, 0, MPI_COMM_WORLD);
-#endif
+    streamGridMap(f, 1, src, count, type, scale);
 
     if (myrank == 0)
-        ASCwrite(fstring, gRows, gCols, xllcorner, yllcorner, cellsize, type, src);
+        fclose(f);
 
     return 1;
 }
 
+/* Write the grid normalized by its maximum value in the ASC format.
+*/
+static int writeNormAscGridMap(char *fname, int time, float *src, int count)
+{
+    float max;
+
+    max = spatialMaxF(src, count);
+    return writeAscGridMap(fname, time, (char *)src, count, MPI_FLOAT,
+                           (max != 0.0) ? max : 1.0);
+}
+
 
 /* Initialize the data grids, handle memory allocation 
 ** and initialization based on SME variables.
 */
 void LUCinitGrids()
 {
+    int i, j, pmflags, pmode, dmode, minrows;
+    float reach;
+    char *cptr, name[64];
+    unsigned char *mask;
+    float err, gerr;
 
     xllcorner = SMEgetFloat("XLLCORNER", 0.0);
     yllcorner = SMEgetFloat("YLLCORNER", 0.0);
@@ -779,6 +1051,9 @@ void LUCinitGrids()
                 SMEgetFileName("FLOODZONE_MAP"), elements, 1);
     orGridMap(nogrowth, nogrowth, floodzone, elements);
     freeGridMap(floodzone, 1);
+    growable = (unsigned char *)initGridMap(NULL, elements, 1);
+    for (i=0; i<elements; i+=1)
+        growable[i] = boundary[i] && !nogrowth[i];
 
     demandres = GRAPHgetGraph(SMEgetString("DEMAND_GRAPH_RES",
                                            "Population"));
@@ -804,40 +1079,83 @@ void LUCinitGrids()
     demandos = GRAPHgetGraph("CellDemandOS");
     nnosgraph = GRAPHgetGraph("NearestNeighborsOS");
     if (nnosgraph == NULL) nnosgraph = nngraph;
+
+    // Wider neighborhoods are the fraction of the cells developed,
+    // without a NearestNeighborsFraction graph the 3x3 graph is used
+    // with the fraction scaled to 0..8 neighbors.
+    nn_radius = SMEgetInt("NN_RADIUS", 1);
+    nnfracgraph = GRAPHgetGraph("NearestNeighborsFraction");
+    if (nn_radius > 1)  {
+        i = erow - srow + 1;
+        MPI_Reduce(&i, &minrows, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&minrows, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (nn_radius > minrows)
+            errorExit("NN_RADIUS is larger than the rows of a processor");
+        if (debug && myrank == 0)
+            fprintf(stderr, "neighborhood radius %d, %s graph\n", nn_radius,
+                    (nnfracgraph) ? "NearestNeighborsFraction"
+                                  : "NearestNeighbors");
+    }
     
     
+    // storage precision of the static probability and density maps
+    pmode = QGRIDmode(cptr = SMEgetString("PROBMAP_PRECISION", "f32"));
+    free(cptr);
+    dmode = QGRIDmode(cptr = SMEgetString("DENSITY_PRECISION", "f32"));
+    free(cptr);
+
+    // the affine modes take their range from the local cells, which
+    // ties the stored values to the decomposition
+    if (repro && (pmode == QUANT_U16 || pmode == QUANT_U8 ||
+                  dmode == QUANT_U16 || dmode == QUANT_U8))  {
+        if (myrank == 0)
+            fprintf(stderr, "WARNING: u16/u8 precision is rank dependent, "
+                    "using f16 in deterministic mode\n");
+        if (pmode == QUANT_U16 || pmode == QUANT_U8) pmode = QUANT_F16;
+        if (dmode == QUANT_U16 || dmode == QUANT_U8) dmode = QUANT_F16;
+    }
+
     // reads the probabilty map if one is specified
     // otherwise probability map will be set to 1.0
-    probmap_res = (float *)initGridMap(NULL, elements, sizeof (float));
-    setGridMapFloat(probmap_res, elements, 1.0);
-    readProbmap(&probmap_res, elements, sizeof (float),
-                SMEgetFileName("PROBMAP_RES"), -1);
+    // year specific probmaps (name_YYYY) are loaded by LUCrun and
+    // are optionally interpolated between keyframe years
+    pmflags = (SMEgetFileName("GA_ENGINE") != NULL) ? PROBMAP_CYCLE : 0;
+    if (SMEgetInt("PROBMAP_INTERP", 0))
+        pmflags |= PROBMAP_INTERP;
+    pm_res = PROBMAPinit(SMEgetFileName("PROBMAP_RES"), elements, 1.0,
+                         SMEgetInt("START_DATE", 0), pmflags, pmode);
+    PROBMAPyear(pm_res, PROBMAP_BASE);
 
-    probmap_com = (float *)initGridMap(NULL, elements, sizeof (float));
-    setGridMapFloat(probmap_com, elements, 1.0);
-    readProbmap(&probmap_com, elements, sizeof (float),
-                SMEgetFileName("PROBMAP_COM"), -1);
+    pm_com = PROBMAPinit(SMEgetFileName("PROBMAP_COM"), elements, 1.0,
+                         SMEgetInt("START_DATE", 0), pmflags, pmode);
+    PROBMAPyear(pm_com, PROBMAP_BASE);
 
 
-    probmap_os = (float *)initGridMapNull(SMEgetFileName("PROBMAP_OS"),
-                           elements, sizeof (float));
-    if (probmap_os == NULL)  {
-        probmap_os = (float *)initGridMap(NULL, elements, sizeof (float));
-        setGridMapFloat(probmap_os, elements, 1.0);
-    }
+    probmap_os = initQGridMap(SMEgetFileName("PROBMAP_OS"), 1.0, pmode);
 
     // load the population density map if one is provided
     // otherwise assume we're working with cells and create a fake
     // density map where every cell is 1
-    density_res = (float *)initGridMap(SMEgetFileName("DENSITY_MAP_RES"),
-                                       elements, sizeof (float));
-    if (SMEgetFileName("DENSITY_MAP_RES") == NULL)
-        setGridMapFloat(density_res, elements, 1.0);
-
-    density_com = (float *)initGridMap(SMEgetFileName("DENSITY_MAP_COM"),
-                                       elements, sizeof (float));
-    if (SMEgetFileName("DENSITY_MAP_COM") == NULL)
-        setGridMapFloat(density_com, elements, 1.0);
+    density_res = initQGridMap(SMEgetFileName("DENSITY_MAP_RES"), 1.0, dmode);
+    density_com = initQGridMap(SMEgetFileName("DENSITY_MAP_COM"), 1.0, dmode);
+
+    // report the worst case error of reduced precision maps
+    if (pmode != QUANT_F32 || dmode != QUANT_F32)  {
+        err = probmap_os->maxerr;
+        if (pm_res->maxerr > err) err = pm_res->maxerr;
+        if (pm_com->maxerr > err) err = pm_com->maxerr;
+        MPI_Reduce(&err, &gerr, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (myrank == 0)
+            fprintf(stderr, "Probmap precision %s, max error = %g\n",
+                    QGRIDname(pmode), gerr);
+
+        err = (density_res->maxerr > density_com->maxerr) ? 
+              density_res->maxerr : density_com->maxerr;
+        MPI_Reduce(&err, &gerr, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (myrank == 0)
+            fprintf(stderr, "Density precision %s, max error = %g\n",
+                    QGRIDname(dmode), gerr);
+    }
 
 
     utilities_res = (float *)initGridMap(
@@ -854,6 +1172,22 @@ void LUCinitGrids()
     diffusion_init_step = SMEgetInt("U_DIFFUSE_INITSTEPS", 10);
     diffusion_rate_os = SMEgetFloat("DIFFUSION_RATE_OS", 0.2);
     diffusion_steps_os = SMEgetInt("DIFFUSION_STEPS_OS", 3);
+    diffusion_depth = SMEgetInt("DIFFUSION_DEPTH", 8);
+    cptr = SMEgetString("DIFFUSION_ENGINE", "explicit");
+    if (!strcmp(cptr, "multigrid"))
+        diffusion_mg = 1;
+    else if (strcmp(cptr, "explicit"))
+        errorExit("DIFFUSION_ENGINE must be explicit or multigrid");
+    MGconfig(SMEgetInt("MG_LEVELS", 3), SMEgetInt("MG_SMOOTH", 4),
+             SMEgetFloat("MG_CHECK", 0.0),
+             SMEgetFloat("MG_CHECK_MAX", 0.0));
+
+    /* driver layers */
+    driver_scale = SMEgetFloat("DRIVER_SCALE", 255.0);
+    static_cache = SMEgetInt("STATIC_CACHE", 1);
+    for (i=0; i<DRIVERS; i+=1)
+        *drivers[i].grid = (unsigned char *)initGridMapNull(
+                    SMEgetFileName(drivers[i].map), elements, 1);
 
     /* set landuse data */
     lu_map = (unsigned char *)initGridMap(SMEgetFileName("LU_MAP"), 
@@ -895,6 +1229,17 @@ void LUCinitGrids()
             refcounts = NULL;
     }
 
+    /* reference land use for the accuracy engine (see score.c) */
+    if ((cptr = SMEgetFileName("REFERENCE_LU_MAP")) != NULL)  {
+        mask = (unsigned char *)initGridMap(cptr, elements, 1);
+        scoreAccuracyInit(lu_map, mask,
+                          (SMEgetFileName("BOUNDARY_MAP")) ? boundary : NULL,
+                          refmap, refzones, SMEgetInt("ACCURACY_LEVELS", 5),
+                          SMEgetString("ACCURACY_FIT", "fom"));
+        freeGridMap((char *)mask, 1);
+        accuracy = 1;
+    }
+
     /* pre-computed random values */
     ranvals = (float *)initGridMap(NULL, elements, sizeof (float));
 
@@ -936,65 +1281,120 @@ void LUCinitGrids()
     w_growth_trend_res = SMEgetFloat("W_GROWTH_TRENDS_RES", 1.0);
     w_growth_trend_com = SMEgetFloat("W_GROWTH_TRENDS_COM_IND", 1.0);
     w_growth_trend_os = SMEgetFloat("W_GROWTH_TRENDS_OPENSPACE", 1.0);
-    w_cities_att_res = SMEgetFloat("W_CITIES_ATT_RES", 1.0);
-    w_cities_att_com = SMEgetFloat("W_CITIES_ATT_COM", 1.0);
-    w_cities_att_os = SMEgetFloat("W_CITIES_ATT_OS", 1.0);
-    w_employment_att_res = SMEgetFloat("W_EMPLOYMENT_ATT_RES", 1.0);
-    w_employment_att_com = SMEgetFloat("W_EMPLOYMENT_ATT_COM", 1.0);
-    w_employment_att_os = SMEgetFloat("W_EMPLOYMENT_ATT_OS", 1.0);
-    w_highway_att_res = SMEgetFloat("W_HIGHWAY_ATT_RES", 1.0);
-    w_highway_att_com = SMEgetFloat("W_HIGHWAY_ATT_COM", 1.0);
-    w_highway_att_os = SMEgetFloat("W_HIGHWAY_ATT_OS", 1.0);
-    w_ramp_att_res = SMEgetFloat("W_RAMP_ATT_RES", 1.0);
-    w_ramp_att_com = SMEgetFloat("W_RAMP_ATT_COM", 1.0);
-    w_ramp_att_os = SMEgetFloat("W_RAMP_ATT_OS", 1.0);
-    w_road_att_res = SMEgetFloat("W_ROAD_ATT_RES", 1.0);
-    w_road_att_com = SMEgetFloat("W_ROAD_ATT_COM", 1.0);
-    w_road_att_os = SMEgetFloat("W_ROAD_ATT_OS", 1.0);
-    w_allroad_att_res = SMEgetFloat("W_ALLROAD_ATT_RES", 1.0);
-    w_allroad_att_com = SMEgetFloat("W_ALLROAD_ATT_COM", 1.0);
-    w_allroad_att_os = SMEgetFloat("W_ALLROAD_ATT_OS", 1.0);
-    w_intersection_att_res = SMEgetFloat("W_INTERSECTION_ATT_RES", 1.0);
-    w_intersection_att_com = SMEgetFloat("W_INTERSECTION_ATT_COM", 1.0);
-    w_intersection_att_os = SMEgetFloat("W_INTERSECTION_ATT_OS", 1.0);
-    w_forest_att_res = SMEgetFloat("W_FOREST_ATT_RES", 1.0);
-    w_forest_att_com = SMEgetFloat("W_FOREST_ATT_COM", 1.0);
-    w_forest_att_os = SMEgetFloat("W_FOREST_ATT_OS", 1.0);
-    w_water_att_res = SMEgetFloat("W_WATER_ATT_RES", 1.0);
-    w_water_att_com = SMEgetFloat("W_WATER_ATT_COM", 1.0);
-    w_water_att_os = SMEgetFloat("W_WATER_ATT_OS", 1.0);
-    w_slope_res = SMEgetFloat("W_SLOPE_RES", 1.0);
-    w_slope_com = SMEgetFloat("W_SLOPE_COM", 1.0);
-    w_slope_os = SMEgetFloat("W_SLOPE_OS", 1.0);
-    w_vacancy_rate_res = SMEgetFloat("W_VACANCY_RATE_RES", 1.0);
-    w_vacancy_rate_com = SMEgetFloat("W_VACANCY_RATE_COM", 1.0);
-    w_vacancy_rate_os = SMEgetFloat("W_VACANCY_RATE_OS", 1.0);
-    w_avg_income_res = SMEgetFloat("W_AVG_INCOME_RES", 1.0);
-    w_avg_income_com = SMEgetFloat("W_AVG_INCOME_COM", 1.0);
-    w_avg_income_os = SMEgetFloat("W_AVG_INCOME_OS", 1.0);
-    w_rental_rate_res = SMEgetFloat("W_RENTAL_RATE_RES", 1.0);
-    w_rental_rate_com = SMEgetFloat("W_RENTAL_RATE_COM", 1.0);
-    w_rental_rate_os = SMEgetFloat("W_RENTAL_RATE_OS", 1.0);
-    w_no_car_res = SMEgetFloat("W_NO_CAR_RES", 1.0);
-    w_no_car_com = SMEgetFloat("W_NO_CAR_COM", 1.0);
-    w_no_car_os = SMEgetFloat("W_NO_CAR_OS", 1.0);
-    w_same_home_res = SMEgetFloat("W_SAME_HOME_RES", 1.0);
-    w_same_home_com = SMEgetFloat("W_SAME_HOME_COM", 1.0);
-    w_same_home_os = SMEgetFloat("W_SAME_HOME_OS", 1.0);
-
-    /* default output buffer (big enough for ints/floats) on root only */
-    outbuf = initGridMap(NULL, gElements, 4);
+    w_cities_att_res = SMEgetFloat("W_CITIES_ATT_RES", 0.0);
+    w_cities_att_com = SMEgetFloat("W_CITIES_ATT_COM", 0.0);
+    w_cities_att_os = SMEgetFloat("W_CITIES_ATT_OS", 0.0);
+    w_employment_att_res = SMEgetFloat("W_EMPLOYMENT_ATT_RES", 0.0);
+    w_employment_att_com = SMEgetFloat("W_EMPLOYMENT_ATT_COM", 0.0);
+    w_employment_att_os = SMEgetFloat("W_EMPLOYMENT_ATT_OS", 0.0);
+    w_highway_att_res = SMEgetFloat("W_HIGHWAY_ATT_RES", 0.0);
+    w_highway_att_com = SMEgetFloat("W_HIGHWAY_ATT_COM", 0.0);
+    w_highway_att_os = SMEgetFloat("W_HIGHWAY_ATT_OS", 0.0);
+    w_ramp_att_res = SMEgetFloat("W_RAMP_ATT_RES", 0.0);
+    w_ramp_att_com = SMEgetFloat("W_RAMP_ATT_COM", 0.0);
+    w_ramp_att_os = SMEgetFloat("W_RAMP_ATT_OS", 0.0);
+    w_road_att_res = SMEgetFloat("W_ROAD_ATT_RES", 0.0);
+    w_road_att_com = SMEgetFloat("W_ROAD_ATT_COM", 0.0);
+    w_road_att_os = SMEgetFloat("W_ROAD_ATT_OS", 0.0);
+    w_allroad_att_res = SMEgetFloat("W_ALLROAD_ATT_RES", 0.0);
+    w_allroad_att_com = SMEgetFloat("W_ALLROAD_ATT_COM", 0.0);
+    w_allroad_att_os = SMEgetFloat("W_ALLROAD_ATT_OS", 0.0);
+    w_intersection_att_res = SMEgetFloat("W_INTERSECTION_ATT_RES", 0.0);
+    w_intersection_att_com = SMEgetFloat("W_INTERSECTION_ATT_COM", 0.0);
+    w_intersection_att_os = SMEgetFloat("W_INTERSECTION_ATT_OS", 0.0);
+    w_forest_att_res = SMEgetFloat("W_FOREST_ATT_RES", 0.0);
+    w_forest_att_com = SMEgetFloat("W_FOREST_ATT_COM", 0.0);
+    w_forest_att_os = SMEgetFloat("W_FOREST_ATT_OS", 0.0);
+    w_water_att_res = SMEgetFloat("W_WATER_ATT_RES", 0.0);
+    w_water_att_com = SMEgetFloat("W_WATER_ATT_COM", 0.0);
+    w_water_att_os = SMEgetFloat("W_WATER_ATT_OS", 0.0);
+    w_slope_res = SMEgetFloat("W_SLOPE_RES", 0.0);
+    w_slope_com = SMEgetFloat("W_SLOPE_COM", 0.0);
+    w_slope_os = SMEgetFloat("W_SLOPE_OS", 0.0);
+    w_vacancy_rate_res = SMEgetFloat("W_VACANCY_RATE_RES", 0.0);
+    w_vacancy_rate_com = SMEgetFloat("W_VACANCY_RATE_COM", 0.0);
+    w_vacancy_rate_os = SMEgetFloat("W_VACANCY_RATE_OS", 0.0);
+    w_avg_income_res = SMEgetFloat("W_AVG_INCOME_RES", 0.0);
+    w_avg_income_com = SMEgetFloat("W_AVG_INCOME_COM", 0.0);
+    w_avg_income_os = SMEgetFloat("W_AVG_INCOME_OS", 0.0);
+    w_rental_rate_res = SMEgetFloat("W_RENTAL_RATE_RES", 0.0);
+    w_rental_rate_com = SMEgetFloat("W_RENTAL_RATE_COM", 0.0);
+    w_rental_rate_os = SMEgetFloat("W_RENTAL_RATE_OS", 0.0);
+    w_no_car_res = SMEgetFloat("W_NO_CAR_RES", 0.0);
+    w_no_car_com = SMEgetFloat("W_NO_CAR_COM", 0.0);
+    w_no_car_os = SMEgetFloat("W_NO_CAR_OS", 0.0);
+    w_same_home_res = SMEgetFloat("W_SAME_HOME_RES", 0.0);
+    w_same_home_com = SMEgetFloat("W_SAME_HOME_COM", 0.0);
+    w_same_home_os = SMEgetFloat("W_SAME_HOME_OS", 0.0);
+
+    /* proximity layers */
+    proximity_reach = SMEgetInt("PROXIMITY_REACH", 30);
+    proximity_incremental = SMEgetInt("PROXIMITY_INCREMENTAL", 1);
+    for (i=0; i<PROXIMITY; i+=1)
+        for (j=0; j<3; j+=1)  {
+            sprintf(name, "W_%s_%s", proximity[i].name, submodels[j]);
+            proximity[i].w[j] = SMEgetFloat(name, 0.0);
+        }
+
+    /* kernel density layers */
+    kernel_shape = SMOOTHkind(SMEgetString("KERNEL_SHAPE", "gauss"));
+    kernel_scale = SMEgetFloat("KERNEL_SCALE", 10.0);
+    for (i=0; i<KERNELS; i+=1)
+        for (j=0; j<3; j+=1)  {
+            sprintf(name, "W_%s_%s", kernels[i].name, submodels[j]);
+            kernels[i].w[j] = SMEgetFloat(name, 0.0);
+        }
+
+    /* patch metrics */
+    if (SMEgetInt("PATCH_METRICS", 0))
+        patches = PATCHinit(RES_FLAG | COM_FLAG);
+
+    /* in-model attractors */
+    if (SMEgetInt("COST_ATTRACTORS", 0))  {
+        COSTconfig(SMEgetFloat("FRICTION_ROAD", 1.0),
+                   SMEgetFloat("FRICTION_DEVELOPED", 2.0),
+                   SMEgetFloat("FRICTION_UNDEVELOPED", 4.0),
+                   SMEgetFloat("FRICTION_WATER", -1.0),
+                   SMEgetFloat("FRICTION_WETLAND", 8.0));
+        cost_incremental = SMEgetInt("COST_INCREMENTAL", 1);
+        reach = SMEgetFloat("COST_REACH", 60.0);
+        for (i=0; i<ATTRACTORS; i+=1)  {
+            if (SMEgetFileName(attractors[i].map) != NULL)
+                continue;
+            mask = NULL;
+            if (attractors[i].sources != NULL)  {
+                cptr = SMEgetFileName(attractors[i].sources);
+                if (cptr == NULL)
+                    continue;
+                mask = (unsigned char *)initGridMap(cptr, elements, 1);
+            }
+            attractors[i].cost = COSTinit(attractors[i].flags, mask, reach);
+            if (debug && myrank == 0)
+                fprintf(stderr, "%s computed in the model\n",
+                        attractors[i].map);
+        }
+    }
 }
 
-void resetWeights()
+/* Fetch the next set of weights from the GA engine, if one is
+** configured.  Returns 0 when the engine has no more candidates.
+*/
+int resetWeights()
 {
-    if (SMEgetFileName("GA_ENGINE") == NULL) return;
+    int i, j, more = 1;
+    char name[64];
+
+    if (SMEgetFileName("GA_ENGINE") == NULL) return 1;
 
     if (debug && myrank == 0)
         fprintf(stderr, "GA_ENGINE = %s\n", SMEgetFileName("GA_ENGINE"));
 
-    if (myrank == 0)
-        GAinit(SMEgetFileName("GA_ENGINE"));
+    if (myrank == 0)  {
+        GAsetBatch(SMEgetInt("GA_BATCH", 1), SMEgetInt("GA_TIMEOUT", 60));
+        more = GAinit(SMEgetFileName("GA_ENGINE"));
+    }
+    MPI_Bcast(&more, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!more) return 0;
 
     /*
     ** Truely ugly.  Allows weights to be reset before each
@@ -1031,69 +1431,193 @@ void resetWeights()
     MPI_Bcast(&w_cities_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
     w_cities_att_os = GAgetData("W_CITIES_ATT_OS", w_cities_att_os );
     MPI_Bcast(&w_cities_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_highway_att_res = GAgetData("W_HIGHWAY_ATT_RES", w_highway_att_res );
-    MPI_Bcast(&w_highway_att_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_highway_att_com = GAgetData("W_HIGHWAY_ATT_COM", w_highway_att_com );
-    MPI_Bcast(&w_highway_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_highway_att_os = GAgetData("W_HIGHWAY_ATT_OS", w_highway_att_os );
-    MPI_Bcast(&w_highway_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_ramp_att_res = GAgetData("W_RAMP_ATT_RES", w_ramp_att_res );
-    MPI_Bcast(&w_ramp_att_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_ramp_att_com = GAgetData("W_RAMP_ATT_COM", w_ramp_att_com );
-    MPI_Bcast(&w_ramp_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_ramp_att_os = GAgetData("W_RAMP_ATT_OS", w_ramp_att_os );
-    MPI_Bcast(&w_ramp_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_road_att_res = GAgetData("W_ROAD_ATT_RES", w_road_att_res );
-    MPI_Bcast(&w_road_att_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_road_att_com = GAgetData("W_ROAD_ATT_COM", w_road_att_com );
-    MPI_Bcast(&w_road_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_road_att_os = GAgetData("W_ROAD_ATT_OS", w_road_att_os );
-    MPI_Bcast(&w_road_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_intersection_att_res = GAgetData("W_INTERSECTION_ATT_RES", w_intersection_att_res );
-    MPI_Bcast(&w_intersection_att_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_intersection_att_com = GAgetData("W_INTERSECTION_ATT_COM", w_intersection_att_com );
-    MPI_Bcast(&w_intersection_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_intersection_att_os = GAgetData("W_INTERSECTION_ATT_OS", w_intersection_att_os );
-    MPI_Bcast(&w_intersection_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_forest_att_res = GAgetData("W_FOREST_ATT_RES", w_forest_att_res );
-    MPI_Bcast(&w_forest_att_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_forest_att_com = GAgetData("W_FOREST_ATT_COM", w_forest_att_com );
-    MPI_Bcast(&w_forest_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_forest_att_os = GAgetData("W_FOREST_ATT_OS", w_forest_att_os );
-    MPI_Bcast(&w_forest_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_water_att_res = GAgetData("W_WATER_ATT_RES", w_water_att_res );
-    MPI_Bcast(&w_water_att_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_water_att_com = GAgetData("W_WATER_ATT_COM", w_water_att_com );
-    MPI_Bcast(&w_water_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_water_att_os = GAgetData("W_WATER_ATT_OS", w_water_att_os );
-    MPI_Bcast(&w_water_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_slope_res = GAgetData("W_SLOPE_RES", w_slope_res );
-    MPI_Bcast(&w_slope_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_slope_com = GAgetData("W_SLOPE_COM", w_slope_com );
-    MPI_Bcast(&w_slope_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
-    w_slope_os = GAgetData("W_SLOPE_OS", w_slope_os );
-    MPI_Bcast(&w_slope_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    w_employment_att_res = GAgetData("W_EMPLOYMENT_ATT_RES", w_employment_att_res );
+    MPI_Bcast(&w_employment_att_res, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    w_employment_att_com = GAgetData("W_EMPLOYMENT_ATT_COM", w_employment_att_com );
+    MPI_Bcast(&w_employment_att_com, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    w_employment_att_os = GAgetData("W_EMPLOYMENT_ATT_OS", w_employment_att_os );
+    MPI_Bcast(&w_employment_att_os, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    for (i=0; i<DRIVERS; i+=1)  {
+        for (j=0; j<3; j+=1)  {
+            // the weights drop the map's _MAP suffix
+            sprintf(name, "W_%.*s_%s", (int)strlen(drivers[i].map) - 4,
+                    drivers[i].map, submodels[j]);
+            *drivers[i].w[j] = GAgetData(name, *drivers[i].w[j]);
+            MPI_Bcast(drivers[i].w[j], 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+        }
+    }
+
+    for (i=0; i<PROXIMITY; i+=1)  {
+        for (j=0; j<3; j+=1)  {
+            sprintf(name, "W_%s_%s", proximity[i].name, submodels[j]);
+            proximity[i].w[j] = GAgetData(name, proximity[i].w[j]);
+        }
+        MPI_Bcast(proximity[i].w, 3, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    }
+    for (i=0; i<KERNELS; i+=1)  {
+        for (j=0; j<3; j+=1)  {
+            sprintf(name, "W_%s_%s", kernels[i].name, submodels[j]);
+            kernels[i].w[j] = GAgetData(name, kernels[i].w[j]);
+        }
+        MPI_Bcast(kernels[i].w, 3, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    }
+
+    return 1;
+}
+
+
+/* Tabulate the driver layers for the current weights.
+*/
+static void setupDrivers()
+{
+    int i;
+    float *w;
+    static DRIVER_T next[3];
+
+    for (i=0; i<3; i+=1)
+        DRIVERreset(&next[i]);
+    for (i=0; i<DRIVERS; i+=1)  {
+        DRIVERadd(&next[0], *drivers[i].grid, *drivers[i].w[0],
+                  driver_scale);
+        DRIVERadd(&next[1], *drivers[i].grid, *drivers[i].w[1],
+                  driver_scale);
+        DRIVERadd(&next[2], *drivers[i].grid, *drivers[i].w[2],
+                  driver_scale);
+    }
+
+    // unchanged tables keep their version and the cached static terms
+    DRIVERupdate(&drv_res, &next[0]);
+    DRIVERupdate(&drv_com, &next[1]);
+    DRIVERupdate(&drv_os, &next[2]);
+
+    // layers that change with lu stay out of the cache
+    DRIVERreset(&dyn_res);
+    DRIVERreset(&dyn_com);
+    DRIVERreset(&dyn_os);
+    for (i=0; i<PROXIMITY; i+=1)  {
+        w = proximity[i].w;
+        if (w[0] == 0.0 && w[1] == 0.0 && w[2] == 0.0)
+            continue;
+        if (proximity[i].dist == NULL)
+            proximity[i].dist = DISTinit(proximity[i].flags,
+                                         proximity_reach);
+        DRIVERadd(&dyn_res, proximity[i].dist->grid, w[0], DIST_CODE);
+        DRIVERadd(&dyn_com, proximity[i].dist->grid, w[1], DIST_CODE);
+        DRIVERadd(&dyn_os, proximity[i].dist->grid, w[2], DIST_CODE);
+    }
+    for (i=0; i<KERNELS; i+=1)  {
+        w = kernels[i].w;
+        if (w[0] == 0.0 && w[1] == 0.0 && w[2] == 0.0)
+            continue;
+        if (kernels[i].field == NULL)  {
+            kernels[i].field = (float *)initGridMap(NULL, elements,
+                                                    sizeof (float));
+            kernels[i].grid = (unsigned char *)initGridMap(NULL, elements, 1);
+        }
+        DRIVERadd(&dyn_res, kernels[i].grid, w[0], SMOOTH_CODE);
+        DRIVERadd(&dyn_com, kernels[i].grid, w[1], SMOOTH_CODE);
+        DRIVERadd(&dyn_os, kernels[i].grid, w[2], SMOOTH_CODE);
+    }
+    for (i=0; i<ATTRACTORS; i+=1)  {
+        if (attractors[i].cost == NULL)
+            continue;
+        DRIVERadd(&dyn_res, attractors[i].cost->grid, *attractors[i].w[0],
+                  COST_CODE);
+        DRIVERadd(&dyn_com, attractors[i].cost->grid, *attractors[i].w[1],
+                  COST_CODE);
+        DRIVERadd(&dyn_os, attractors[i].cost->grid, *attractors[i].w[2],
+                  COST_CODE);
+    }
+
+    if (debug && myrank == 0)
+        fprintf(stderr, "driver layers: res %d+%d, com %d+%d, os %d+%d\n",
+                drv_res.nlayers, dyn_res.nlayers, drv_com.nlayers,
+                dyn_com.nlayers, drv_os.nlayers, dyn_os.nlayers);
+}
+
+/* Bring the proximity layers in use up to date with lu.
+*/
+static void updateProximity()
+{
+    int i, full;
+    float *w;
+
+    for (i=0; i<PROXIMITY; i+=1)  {
+        w = proximity[i].w;
+        if (proximity[i].dist == NULL ||
+            (w[0] == 0.0 && w[1] == 0.0 && w[2] == 0.0))
+            continue;
+        full = DISTupdate(proximity[i].dist, lu, !proximity_incremental);
+        if (debug && myrank == 0)
+            fprintf(stderr, "%s: %s update\n", proximity[i].name,
+                    (full) ? "full" : "incremental");
+    }
+}
+
+/* Smooth the kernel density layers in use again from lu.
+*/
+static void updateKernels()
+{
+    int i;
+    float *w;
+
+    for (i=0; i<KERNELS; i+=1)  {
+        w = kernels[i].w;
+        if (kernels[i].field == NULL ||
+            (w[0] == 0.0 && w[1] == 0.0 && w[2] == 0.0))
+            continue;
+        SMOOTHclass(kernels[i].field, lu, kernels[i].flags, kernel_shape,
+                    kernel_scale);
+        SMOOTHcodes(kernels[i].grid, kernels[i].field);
+    }
 }
 
+/* Bring the in-model attractors in use up to date with lu.
+*/
+static void updateAttractors()
+{
+    int i;
+    float **w;
 
-void LUCresetGrids()
+    for (i=0; i<ATTRACTORS; i+=1)  {
+        w = attractors[i].w;
+        if (attractors[i].cost == NULL ||
+            (*w[0] == 0.0 && *w[1] == 0.0 && *w[2] == 0.0))
+            continue;
+        if (debug && myrank == 0)
+            fprintf(stderr, "%s: ", attractors[i].map);
+        COSTupdate(attractors[i].cost, lu, !cost_incremental);
+    }
+}
+
+
+/* Reset the grids for a new run, returns 0 if there is nothing
+** left to run (the GA engine is out of candidates).
+*/
+int LUCresetGrids()
 {
-    resetWeights();
+    if (!resetWeights())
+        return 0;
+    setupDrivers();
     copyGridMap(lu, lu_map, elements, 1);
+    shareGrid(lu, elements, MPI_UNSIGNED_CHAR);
     setGridMapByte(change, elements, 0.0);
     setGridMapByte(summary, elements, 0.0);
     setGridMapFloat(utilities_res, elements, 0.0);
     setGridMapFloat(utilities_com, elements, 0.0);
     setGridMapFloat(utilities_os, elements, 0.0);
+    current_res = current_com = current_os = 0.0;
+    cell_count_res = cell_count_com = cell_count_os = 0;
 
     /* is this everything? */
+    return 1;
 }
 
 // seekMinWeight -- produces MORE development by decreasing the
 // weight until development is less than demand
 // 
 // global variables -- ranvals, elemeents
-float seekMinWeight(float demand, float best, float *probmap, float *density)
+float seekMinWeight(float demand, float best, float *probmap, QGRID_T *density)
 {
     float dev, olddev = -1.0, w = 1.0;
     int count = 0;
@@ -1125,18 +1649,22 @@ float seekMinWeight(float demand, float best, float *probmap, float *density)
 // weight until development exceeds demand
 // 
 // global variables -- ranvals, elemeents
-float seekMaxWeight(float demand, float best, float *probmap, float *density)
+float seekMaxWeight(float demand, float best, float *probmap, QGRID_T *density)
 {
-    float dev, olddev = -1.0, w = 1.0;
+    float dev, olddev = -1.0, w = 1.0, w2;
     int count = 0;
 
     do {
         w *= 10.0;
         dev = SPATIALfalseDev2(w, best, probmap, density, ranvals, elements);
-        if (debug && myrank == 0)
-            fprintf(stderr, "seekMaxWeight: probmap sum = %f\n", 
-                    spatialSumF(probmap, elements));
-            fprintf(stderr, "seekMaxWeight: w = %f, dev = %f\n", w, dev);
+        if (debug)  {
+            w2 = spatialSumF(probmap, elements);
+            if (myrank == 0)  {
+                fprintf(stderr, "seekMaxWeight: probmap sum = %f\n", w2);
+                fprintf(stderr, "seekMaxWeight: w = %f, dev = %f\n",
+                        w, dev);
+            }
+        }
 
         if (dev == olddev)  {
             if (myrank == 0)
@@ -1161,7 +1689,7 @@ float seekMaxWeight(float demand, float best, float *probmap, float *density)
 //
 // global variables -- ranvals, elements
 float estimateWeight(float demand, float best, float delta, 
-                     float *probmap, float *density)
+                     float *probmap, QGRID_T *density)
 {
     int i, count;
     float dev, w, maxw, minw;
@@ -1228,38 +1756,220 @@ float estimateWeight(float demand, float best, float delta,
     return w;
 }
 
+// spontaneous -- the random term of the probability for local cell i,
+// keyed on the global cell and year in deterministic mode
+static double spontaneous(int i, int stream)
+{
+    if (repro)
+        return REPROdraw((long)srow * gCols + i, stream, curitr);
+    return drand48();
+}
+
+// powClass -- classify a driver exponent.  The weights are fixed for
+// a run (or GA candidate) and nearly always 0 or 1, so the kernels
+// pick the cheapest exact form once per block rather than calling
+// powf per cell.  A POW_ZERO term is the constant 1 and is left out.
+static int powClass(float w)
+{
+    if (w == 0.0f) return POW_ZERO;
+    if (w == 1.0f) return POW_ONE;
+    if (w == 2.0f) return POW_TWO;
+    if (w == 0.5f) return POW_HALF;
+    return POW_ANY;
+}
+
+// powBlock -- raise n values to the power w in place
+static void powBlock(float *restrict x, int n, int cls, float w)
+{
+    int j;
+
+    switch (cls)  {
+    case POW_ZERO:
+        for (j=0; j<n; j+=1) x[j] = 1.0f;
+        break;
+    case POW_ONE:
+        break;
+    case POW_TWO:
+        for (j=0; j<n; j+=1) x[j] = x[j] * x[j];
+        break;
+    case POW_HALF:
+        for (j=0; j<n; j+=1) x[j] = sqrtf(x[j]);
+        break;
+    default:
+        for (j=0; j<n; j+=1) x[j] = powf(x[j], w);
+    }
+}
+
+// staticBlock -- pm^wp * drivers for the k cells idx of block b
+// (n cells from b) into a.
+static void staticBlock(float *a, int b, int n, const int *idx, int k,
+                        PROBMAP_T *pm, QGRID_T *q, DRIVER_T *drv,
+                        int cp, float wp)
+{
+    int j;
+    float blk[PROBMAP_SCRATCH];
+    const float *v;
+
+    if (cp != POW_ZERO)  {
+        v = (pm != NULL) ? PROBMAPblock(pm, b, n, blk) - b
+                         : QGRIDblock(q, b, n, blk) - b;
+        for (j=0; j<k; j+=1)
+            a[j] = v[idx[j]];
+    }
+    powBlock(a, k, cp, wp);
+    if (drv->nlayers > 0)
+        DRIVERblock(drv, idx, k, a);
+}
+
+// staticTerms -- bring the cached static terms st up to date with the
+// probmap keyframes, wp and drivers, returns the cached grid.
+static const float *staticTerms(STATIC_T *st, int count, PROBMAP_T *pm,
+                                QGRID_T *q, DRIVER_T *drv, int cp, float wp)
+{
+    int i, b, n, lokey, hikey;
+    int idx[QUANT_BLOCK];
+    float frac;
+
+    lokey = (pm != NULL) ? pm->lokey : 0;
+    hikey = (pm != NULL) ? pm->hikey : 0;
+    frac = (pm != NULL && hikey >= 0) ? pm->frac : 0.0f;
+    if (st->grid != NULL && st->lokey == lokey && st->hikey == hikey &&
+        st->frac == frac && st->wp == wp && st->drvversion == drv->version)
+        return st->grid;
+
+    if (st->grid == NULL)
+        st->grid = (float *)initGridMap(NULL, elements, sizeof (float));
+    PERFcount(PERF_STATIC_FILLS, 1);
+
+    for (b=0; b<count; b+=QUANT_BLOCK)  {
+        n = (count - b < QUANT_BLOCK) ? count - b : QUANT_BLOCK;
+        for (i=0; i<n; i+=1)
+            idx[i] = b + i;
+        staticBlock(st->grid + b, b, n, idx, n, pm, q, drv, cp, wp);
+    }
+
+    st->lokey = lokey;
+    st->hikey = hikey;
+    st->frac = frac;
+    st->wp = wp;
+    st->drvversion = drv->version;
+    return st->grid;
+}
+
+// probTerms -- the probability kernel shared by the res, com and os
+// sub-models,
+//
+//   p = pm^wp * drivers * NearestNeighbors(nn)^wn
+//       * (ws * random + wu * util)^wd
+//
+// for the active cells and 0 elsewhere.  Active cells are inside the
+// boundary and, if masked, developable and outside the nogrowth zone.
+// The static map comes from pm or (if pm is NULL) q.  The active cells
+// of each block are compacted and every term is evaluated for the
+// block with its exponent class, terms with a zero weight are never
+// evaluated and their grids (and random draws) are not touched.
+//
+// When pm^wp * drivers costs more than a read (a power other than 0
+// or 1, or driver layers) it is taken from the cache st, so a year
+// only evaluates the dynamic terms.  The proximity layers dyn follow
+// the land use and multiply the static terms each year.
+static void probTerms(float *p, int count, PROBMAP_T *pm, QGRID_T *q,
+                      DRIVER_T *drv, STATIC_T *st, DRIVER_T *dyn,
+                      int masked,
+                      unsigned char *nn, float *util,
+                      float wp, float wn, float ws, float wu, float wd,
+                      int stream)
+{
+    int i, j, k, b, n, cp, cd;
+    int idx[QUANT_BLOCK];
+    float a[QUANT_BLOCK], d[QUANT_BLOCK], nnpow[NN_CODES];
+    const float *cache = NULL;
+
+    cp = powClass(wp);
+    cd = powClass(wd);
+    if (nn_radius <= 1)
+        for (j=0; j<NN_VALUES; j+=1)
+            nnpow[j] = powf(GRAPHinterp(nngraph, j), wn);
+    else if (nnfracgraph != NULL)
+        for (j=0; j<NN_CODES; j+=1)
+            nnpow[j] = powf(GRAPHinterp(nnfracgraph,
+                                        (float)j / NN_FRACTION), wn);
+    else
+        for (j=0; j<NN_CODES; j+=1)
+            nnpow[j] = powf(GRAPHinterp(nngraph,
+                                        8.0f * j / NN_FRACTION), wn);
+
+    if (static_cache && (cp > POW_ONE || drv->nlayers > 0))
+        cache = staticTerms(st, count, pm, q, drv, cp, wp);
+
+    for (b=0; b<count; b+=QUANT_BLOCK)  {
+        n = (count - b < QUANT_BLOCK) ? count - b : QUANT_BLOCK;
+
+        k = 0;
+        for (i=b; i<b+n; i+=1)  {
+            p[i] = 0.0;
+            if (masked ? growable[i] && developable[i] : boundary[i])
+                idx[k++] = i;
+        }
+        if (k == 0)
+            continue;
+
+        // static probability
+        if (cache != NULL)
+            for (j=0; j<k; j+=1)
+                a[j] = cache[idx[j]];
+        else
+            staticBlock(a, b, n, idx, k, pm, q, drv, cp, wp);
+        if (dyn->nlayers > 0)
+            DRIVERblock(dyn, idx, k, a);
+
+        // dynamic term, the sum is rounded to float as powf did
+        if (cd != POW_ZERO)  {
+            if (ws != 0.0f && wu != 0.0f)
+                for (j=0; j<k; j+=1)
+                    d[j] = ws * spontaneous(idx[j], stream)
+                           + wu * util[idx[j]];
+            else if (ws != 0.0f)
+                for (j=0; j<k; j+=1)
+                    d[j] = ws * spontaneous(idx[j], stream);
+            else
+                for (j=0; j<k; j+=1)
+                    d[j] = wu * util[idx[j]];
+        }
+        powBlock(d, k, cd, wd);
+
+        if (wn != 0.0f)
+            for (j=0; j<k; j+=1)
+                p[idx[j]] = a[j] * nnpow[nn[idx[j]]] * d[j];
+        else
+            for (j=0; j<k; j+=1)
+                p[idx[j]] = a[j] * d[j];
+    }
+}
+
 // updateProbRes -- update the current probability WITHOUT the mask
 // for developable and nogrowth cells.  
 //
-// global vars: boundary, probmap_res, nndev, utilities_res, w_probmap_res,
+// global vars: boundary, pm_res, nndev, utilities_res, w_probmap_res,
 //              w_dynamic_res, w_spontaneous_res, w_utilities_res
 //
 // Note: this should be called by calcProbRes
 void updateProbRes(float *p, int count)
 {
-    int i;
-
-    // set the probability map
-    for (i=0; i<count; i+=1)  {
-      if (boundary[i]) {
-        p[i] = powf(probmap_res[i], w_probmap_res)
-               * powf(GRAPHinterp(nngraph, nndev[i]), w_neighbors_res)
-               * powf(w_spontaneous_res * drand48() +
-                      w_utilities_res * utilities_res[i], w_dynamic_res);
-        }
-        else
-            p[i] = 0.0;
-    }
+    probTerms(p, count, pm_res, NULL, &drv_res, &st_res, &dyn_res, 0,
+              nndev, utilities_res,
+              w_probmap_res, w_neighbors_res, w_spontaneous_res,
+              w_utilities_res, w_dynamic_res, REPRO_SPONT_RES);
 }
 
 // calcProbRes -- updates the current probabilty 
 //
-// global vars: probmap_res, nndev, utilities_res, w_probmap_res, 
+// global vars: pm_res, nndev, utilities_res, w_probmap_res, 
 //              w_dynamic_res, w_spontaneous_res, w_utilities_res,
 //              best_prob_res
 void calcProbRes(float *p, int count)
 {
-    int i, avail=0;
+    int i;
     float w, maxp, demand;
 
     // calculate the demand
@@ -1274,17 +1984,10 @@ void calcProbRes(float *p, int count)
     }
 
     // set the probability map
-    for (i=0; i<count; i+=1)  {
-      if (boundary[i] && !nogrowth[i] && developable[i]) {
-        avail += 1;
-        p[i] = powf(probmap_res[i], w_probmap_res)
-               * powf(GRAPHinterp(nngraph, nndev[i]), w_neighbors_res)
-               * powf(w_spontaneous_res * drand48() +
-                      w_utilities_res * utilities_res[i], w_dynamic_res);
-        }
-        else
-            p[i] = 0.0;
-    }
+    probTerms(p, count, pm_res, NULL, &drv_res, &st_res, &dyn_res, 1,
+              nndev, utilities_res,
+              w_probmap_res, w_neighbors_res, w_spontaneous_res,
+              w_utilities_res, w_dynamic_res, REPRO_SPONT_RES);
 
     // scale the probability probmap so that max = .25
     // i.e. highest priority cells have a 25% likelyhood of development
@@ -1294,7 +1997,9 @@ void calcProbRes(float *p, int count)
     }
 
     // estimate that will deliver demand
+    PERFstart(PERF_WEIGHT);
     w = estimateWeight(demand, best_prob_res, delta_res, p, density_res);
+    PERFstop(PERF_WEIGHT);
     if (w == 0.0 && myrank == 0)
         fprintf(stderr, "WARNING: failed to establish bracket, w=%f\n", w); 
 
@@ -1308,30 +2013,21 @@ void calcProbRes(float *p, int count)
 // updateProbCom -- update the current probability WITHOUT the mask
 // for developable and nogrowth cells.  
 //
-// global vars: boundary, probmap_com, nndev, utilities_com, w_probmap_com,
+// global vars: boundary, pm_com, nndev, utilities_com, w_probmap_com,
 //              w_dynamic_com, w_spontaneous_com, w_utilities_com
 //
 // Note: this should be called by calcProbCom
 void updateProbCom(float *p, int count)
 {
-    int i;
-
-    // set the probability map
-    for (i=0; i<count; i+=1)  {
-      if (boundary[i]) {
-        p[i] = powf(probmap_com[i], w_probmap_com)
-               * powf(GRAPHinterp(nngraph, nndev[i]), w_neighbors_com)
-               * powf(w_spontaneous_com * drand48() +
-                      w_utilities_com * utilities_com[i], w_dynamic_com);
-        }
-        else
-            p[i] = 0.0;
-    }
+    probTerms(p, count, pm_com, NULL, &drv_com, &st_com, &dyn_com, 0,
+              nndev, utilities_com,
+              w_probmap_com, w_neighbors_com, w_spontaneous_com,
+              w_utilities_com, w_dynamic_com, REPRO_SPONT_COM);
 }
 
 // calcProbCom -- updates the current probabilty 
 //
-// global vars: probmap_com, nndev, utilities_com, w_probmap_com, 
+// global vars: pm_com, nndev, utilities_com, w_probmap_com, 
 //              w_dynamic_com, w_spontaneous_com, w_utilities_com
 //              best_prob_com
 void calcProbCom(float *p, int count)
@@ -1352,17 +2048,10 @@ void calcProbCom(float *p, int count)
 
 
     // set the probability map
-    for (i=0; i<count; i+=1)  {
-      if (boundary[i] && !nogrowth[i] && developable[i])
-        p[i] = powf(probmap_com[i], w_probmap_com)
-               * powf(GRAPHinterp(nngraph, nndev[i]), w_neighbors_com)
-               * powf( w_spontaneous_com * drand48()
-                           + w_utilities_com * utilities_com[i], 
-                         w_dynamic_com);
-
-      else
-           p[i] = 0.0;
-    }
+    probTerms(p, count, pm_com, NULL, &drv_com, &st_com, &dyn_com, 1,
+              nndev, utilities_com,
+              w_probmap_com, w_neighbors_com, w_spontaneous_com,
+              w_utilities_com, w_dynamic_com, REPRO_SPONT_COM);
 
     // scale the probability probmap so that max = .25
     // i.e. highest priority cells have a 25% likelyhood of development
@@ -1372,7 +2061,9 @@ void calcProbCom(float *p, int count)
     }
 
     // estimate that will deliver demand and set the probmap
+    PERFstart(PERF_WEIGHT);
     w = estimateWeight(demand, best_prob_com, delta_com, p, density_com);
+    PERFstop(PERF_WEIGHT);
     if (w == 0.0 && myrank == 0)
         fprintf(stderr, "WARNING: failed to establish bracket, w=%f.\n", w); 
     for (i=0; i<count; i+=1)  {
@@ -1384,24 +2075,15 @@ void calcProbCom(float *p, int count)
 
 // calcProbOS -- updates the current probabilty 
 //
-// global vars: probmap_os, nndev, utilities_os, w_probmap_os, 
+// global vars: probmap_os, nnos, utilities_os, w_probmap_os, 
 //              w_dynamic_os, w_spontaneous_os, w_utilities_os
 void calcProbOS(float *p, int count)
 {
-    int i;
-
     // set the probability map
-    for (i=0; i<count; i+=1)  {
-      if (boundary[i] && !nogrowth[i] && developable[i])
-        p[i] = powf(probmap_os[i], w_probmap_os)
-               *   powf(GRAPHinterp(nngraph, nnos[i]), w_neighbors_os)
-               *   powf( w_spontaneous_os * drand48()
-                           + w_utilities_os * utilities_os[i], 
-                         w_dynamic_os);
-
-      else
-           p[i] = 0.0;
-    }
+    probTerms(p, count, NULL, probmap_os, &drv_os, &st_os, &dyn_os, 1,
+              nnos, utilities_os,
+              w_probmap_os, w_neighbors_os, w_spontaneous_os,
+              w_utilities_os, w_dynamic_os, REPRO_SPONT_OS);
 
     spatialNormalizeF(p, p, count);
     return;
@@ -1417,16 +2099,13 @@ void dumpInitialProbMaps(float *res, float *com, float *os, int count,
     fprintf(stderr, "dumpInitialProb\n");
 
     if ((fname = SMEgetFileName("INITIAL_PROB_RES_MAP")) != NULL) {
-        spatialNormalizeF((float*)outbuf, res, count);
-        writeAscGridMap(fname, time, (char*)outbuf, count, MPI_FLOAT);
+        writeNormAscGridMap(fname, time, res, count);
     }
     if ((fname = SMEgetFileName("INITIAL_PROB_COM_MAP")) != NULL) {
-        spatialNormalizeF((float*)outbuf, com, count);
-        writeAscGridMap(fname, time, (char*)outbuf, count, MPI_FLOAT);
+        writeNormAscGridMap(fname, time, com, count);
     }
     if ((fname = SMEgetFileName("INITIAL_PROB_OS_MAP")) != NULL) {
-        spatialNormalizeF((float*)outbuf, os, count);
-        writeAscGridMap(fname, time, (char*)outbuf, count, MPI_FLOAT);
+        writeNormAscGridMap(fname, time, os, count);
     }
 }
 
@@ -1436,17 +2115,14 @@ void dumpFinalProbMaps(float *res, float *com, float *os, int count, int time)
 
     if ((fname = SMEgetFileName("FINAL_PROB_RES_MAP")) != NULL) {
         updateProbRes(res, count);
-        spatialNormalizeF((float*)outbuf, res, count);
-        writeAscGridMap(fname, time, (char*)outbuf, count, MPI_FLOAT);
+        writeNormAscGridMap(fname, time, res, count);
     }
     if ((fname = SMEgetFileName("FINAL_PROB_COM_MAP")) != NULL) {
         updateProbCom(com, count);
-        spatialNormalizeF((float*)outbuf, com, count);
-        writeAscGridMap(fname, time, (char*)outbuf, count, MPI_FLOAT);
+        writeNormAscGridMap(fname, time, com, count);
     }
     if ((fname = SMEgetFileName("FINAL_PROB_OS_MAP")) != NULL) {
-        spatialNormalizeF((float*)outbuf, os, count);
-        writeAscGridMap(fname, time, (char*)outbuf, count, MPI_FLOAT);
+        writeNormAscGridMap(fname, time, os, count);
     }
 }
 
@@ -1479,8 +2155,9 @@ void normalizeProbMaps(float *res, float *com, float *os, int count)
 // local variables (unique to LU class being developed) :
 //   current -- reference to total current development for given lu class
 //   count   -- reference to the total cell count for the given lu class
+//              (both are global totals, all ranks must call)
 //   p       -- pointer to the probability map
-//   density -- pointer to the density map
+//   density -- the (possibly reduced precision) density map
 //   class   -- the LU class as recorded in the change map
 //   itr     -- the iteration as recorded in the summary map
 // 
@@ -1490,19 +2167,21 @@ void normalizeProbMaps(float *res, float *com, float *os, int count)
 //   summary -- records iteration of change for celss that have changed class
 //   elements - number of active elements arrays
 void developCells(float *current, int *count, float *p, 
-                  float *density, int class, int itr)
+                  QGRID_T *density, int class, int itr)
 {
-    int i;
-
-    for (i=0; i<elements; i+=1)  {
-        if ((ranvals[i] < p[i]) && (density[i] > MIN_DENSITY))  {
-            change[i] = class;
-            lu[i] = class;
-            summary[i] = itr;
-            *current += density[i];
-            *count += 1;
-        }
-    }
+    int cells, gcells;
+    REPRO_SUM total = {0, 0};
+
+    PERFcount(PERF_CELLS, elements);
+    cells = SPATIALdevelop(lu, change, summary, ranvals, p, density,
+                           elements, class, itr, &total);
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(&cells, &gcells, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&gcells, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+    *count += gcells;
+    *current += REPROtotal(&total);
 }
 
 
@@ -1519,67 +2198,51 @@ void updateRandom(float *rand, int count, int itr)
 {
     char fname[1024], *cptr;
     int i;
-    float *newr;
 
     if (debug && myrank == 0)
         fprintf(stderr, "updateRandom called\n");
 
     /* if no maps given just (re-)fill buffer and return */
     if ((cptr = SMEgetFileName("RANDOM_MAP")) == NULL)  {
-        for (i=0; i<count; i+=1)
-            rand[i] = drand48();
+        if (repro)
+            for (i=0; i<count; i+=1)
+                rand[i] = REPROdraw((long)srow * gCols + i, REPRO_RANDOM, itr);
+        else
+            for (i=0; i<count; i+=1)
+                rand[i] = drand48();
         return;
     }
 
     /* insert itr value if requested */
     sprintf(fname, cptr, itr);
-    
-    /* Warning: new random value grid map isn't free'd
-    ** causing a memory leak.  But since this method is only
-    ** used for portability testing we'll live with it.
-    **
-    ** Need grid structure!
+
+    /* read straight into the grid, a delta (.dlt) map patches the
+    ** previous iteration's values in place.
     */
-    newr = (float *)initGridMap(fname, count, sizeof (float));
-    for (i=0; i<count; i+=1)
-        rand[i] = newr[i];
+    if (DELTAisDelta(fname))
+        LUCapplyDelta(fname, (char *)rand, sizeof (float));
+    else  {
+        checkHeader(fname);
+        LUCreadGridMap(fname, (char *)rand, count, sizeof (float));
+    }
 
     return;
 }
 
 
-// readProbmap -- check to see if a new probmap is available
-// and loads it if necessary. If 'year' is 0 or -1 then it is ignored.
-//
-// Note: kind of hack! Probably should use access() instead of the open
-void readProbmap(float **p, int count, int type, char *name, int year)
+/* Run the LUC Model - 
+*/
+/* Neighbor grid of the classes in val: counts 0..8 of the 3x3 window,
+** or with NN_RADIUS the fraction of the wider window as a code.
+*/
+static void neighbors(unsigned char *dst, int val)
 {
-    FILE *f;
-    char *ptr, fname[256], pname[256];
-
-    if (year > 0)  {
-        strcpy(pname, name);
-        ptr = strrchr(pname, '.');
-        *ptr = '\0';
-        sprintf(fname, "%s_%d.%s", pname, year, ptr+1);
-    }
-
-    else {
-        strcpy(fname, name);
-    }
-
-    fprintf(stderr, "Looking for probmap %s\n", fname);
-    if ((f = fopen(fname, "r")) != NULL)  {
-        fclose(f);
-        freeGridMap((char *)*p, type);
-
-        fprintf(stderr, "Reading %s\n", fname);
-        *p = (float *)initGridMap(fname, count, type);
-    }
+    if (nn_radius > 1)
+        SPATIALneighborhood(dst, val, lu, erow-srow+1, gCols, nn_radius);
+    else
+        nearestNeighbors(dst, nntmp, val, lu, erow-srow+1, gCols);
 }
 
-/* Run the LUC Model - 
-*/
 void LUCrun()
 {
     int i, time, itr = 0;
@@ -1590,6 +2253,12 @@ void LUCrun()
     char *cptr;
     unsigned char *mask;
     double score;
+    ACCURACY_T acc;
+    int nf, ftype[3], fuseres;
+    float *field[3], frate[3];
+    int npatch = 0;
+    PATCH_STATS *pstats = NULL;
+    float err, pmerr = 0.0;
 
     stime = SMEgetInt("START_DATE", 0);
     etime = SMEgetInt("END_DATE", 0);
@@ -1610,40 +2279,66 @@ void LUCrun()
     if (debug && myrank == 0)
         fprintf(stderr, "Initializing diffusion out %d steps\n", 
                 diffusion_init_step);
-    for (i=1; i<diffusion_init_step; i+=1)  {
-        spatialDiffusion(utilities_res, utilities_tmp, diffusion_rate, 
-                        diffusion_res_flags, lu, erow-srow, gCols);
-        spatialDiffusion(utilities_com, utilities_tmp, diffusion_rate, 
-                        diffusion_com_flags, lu, erow-srow, gCols);
-        spatialDiffusion(utilities_os, utilities_tmp, diffusion_rate_os, 
-                        diffusion_os_flags, lu, erow-srow, gCols);
+    if (diffusion_init_step > 1)  {
+        field[0] = utilities_res;  frate[0] = diffusion_rate;
+        ftype[0] = diffusion_res_flags;
+        field[1] = utilities_com;  frate[1] = diffusion_rate;
+        ftype[1] = diffusion_com_flags;
+        field[2] = utilities_os;   frate[2] = diffusion_rate_os;
+        ftype[2] = diffusion_os_flags;
+        if (diffusion_mg)
+            MGdiffusion(3, field, frate, ftype, lu, erow-srow+1, gCols,
+                        diffusion_init_step-1, diffusion_depth);
+        else
+            SPATIALdiffusionSteps(3, field, frate, ftype, lu, erow-srow+1,
+                                  gCols, diffusion_init_step-1,
+                                  diffusion_depth);
     }
 
-    // Ensure we attempt to read probmaps with start time (stime)
-    // in their names.
-    readProbmap(&probmap_res, elements, sizeof (float),
-                SMEgetFileName("PROBMAP_RES"), stime);
-    readProbmap(&probmap_com, elements, sizeof (float),
-                SMEgetFileName("PROBMAP_COM"), stime);
+    // The yearly res diffusion can join the com diffusion ahead of the
+    // com development when that development can't change which cells
+    // are res sources: no res source class is developable and com
+    // isn't one of them.
+    fuseres = ResModel && ComModel &&
+              (diffusion_res_flags & COM_FLAG) == 0 &&
+              (diffusion_res_flags & DIFFUSE_SOURCES
+               & ~nondevelopable_flags) == 0;
+    if (debug && myrank == 0)
+        fprintf(stderr, "res diffusion %s com diffusion\n",
+                (fuseres) ? "fused with" : "separate from");
+
+    // patch metrics of the start map and then of every year
+    if (patches != NULL)  {
+        pstats = (PATCH_STATS *)getMem(((etime - stime) / timestep + 2)
+                                       * sizeof (PATCH_STATS), "patch stats");
+        pstats[npatch].year = stime;
+        PATCHlabel(patches, lu, change, &pstats[npatch++]);
+    }
+
+    // Start with the probmaps in effect at the start time (stime).
+    PERFstart(PERF_PROBMAP);
+    PROBMAPyear(pm_res, stime);
+    PROBMAPyear(pm_com, stime);
+    PERFstop(PERF_PROBMAP);
 
 
     //   MAINLOOP
     for (time=stime+timestep; time<etime+timestep; time+=timestep)  {
 
         itr += 1;
+        curitr = itr;
 
         if (debug && myrank == 0)  {
             fprintf(stderr, "\n\n\nStarting time %d, iteration = %d\n",
                     time, itr);
         }
 
-        // Attempt to read probmaps for the current time period.
-        // Warning: if timestep is > 1 then it is possible to miss
-        // reading existing probmaps.
-        readProbmap(&probmap_res, elements, sizeof (float),
-                    SMEgetFileName("PROBMAP_RES"), time);
-        readProbmap(&probmap_com, elements, sizeof (float),
-                    SMEgetFileName("PROBMAP_COM"), time);
+        // Switch to the probmaps for the current time period, the
+        // next keyframe is read in the background.
+        PERFstart(PERF_PROBMAP);
+        PROBMAPyear(pm_res, time);
+        PROBMAPyear(pm_com, time);
+        PERFstop(PERF_PROBMAP);
 
         desired_res = GRAPHinterp(demandres, time) - 
                       GRAPHinterp(demandres, stime);
@@ -1658,26 +2353,46 @@ void LUCrun()
             desired_res, desired_com, desired_os);
 
 
-        nearestNeighbors(nndev, nntmp, RES_FLAG | COM_FLAG, lu, 
-                         erow-srow, gCols);
-        nearestNeighbors(nnres, nntmp, RES_FLAG, lu, erow-srow, gCols);
-        nearestNeighbors(nncom, nntmp, COM_FLAG, lu, erow-srow, gCols);
+        neighbors(nndev, RES_FLAG | COM_FLAG);
+        neighbors(nnres, RES_FLAG);
+        neighbors(nncom, COM_FLAG);
+        updateProximity();
+        updateAttractors();
+        updateKernels();
 #ifdef OPENSPACE
-        nearestNeighbors(nnos, nntmp, OS_FLAG, lu, erow-srow, gCols);
+        neighbors(nnos, OS_FLAG);
 #endif
 
 
+        PERFstart(PERF_RANDOM);
         updateRandom(ranvals, elements, itr);
+        PERFstop(PERF_RANDOM);
 
 
         // COMMERCIAL DEVELOPMENT
-        spatialDiffusion(utilities_com, utilities_tmp, diffusion_rate, 
-                        diffusion_com_flags, lu, erow-srow, gCols);
-        if (desired_com - current_com > delta_com)  {
-            flagDevelopable(developable, lu, elements, nondevelopable_flags);
+        nf = 0;
+        if (ComModel)  {
+            field[nf] = utilities_com;  frate[nf] = diffusion_rate;
+            ftype[nf++] = diffusion_com_flags;
+        }
+        if (fuseres)  {
+            field[nf] = utilities_res;  frate[nf] = diffusion_rate;
+            ftype[nf++] = diffusion_res_flags;
+        }
+        if (nf > 0)
+            SPATIALdiffusionSteps(nf, field, frate, ftype, lu,
+                                  erow-srow+1, gCols, 1, 1);
+        if (ComModel && desired_com - current_com > delta_com)  {
+            SPATIALflagDevelopable(developable, lu, elements,
+                                   nondevelopable_flags);
+            PERFstart(PERF_PROB);
+            PERFcount(PERF_CELLS, elements);
             calcProbCom(comprob, elements);
+            PERFstop(PERF_PROB);
+            PERFstart(PERF_DEVELOP);
             developCells(&current_com, &cell_count_com, comprob, density_com,
                         LU_COM, itr); 
+            PERFstop(PERF_DEVELOP);
             com = spatialCount(lu, elements, LU_COM);
         }
 
@@ -1688,13 +2403,20 @@ void LUCrun()
         
 
         // RESIDENTIAL DEVELOPMENT
-        spatialDiffusion(utilities_res, utilities_tmp, diffusion_rate, 
-                        diffusion_res_flags, lu, erow-srow, gCols);
-        if (desired_res - current_res > delta_res)  {
-            flagDevelopable(developable, lu, elements, nondevelopable_flags);
+        if (ResModel && !fuseres)
+            spatialDiffusion(utilities_res, utilities_tmp, diffusion_rate, 
+                            diffusion_res_flags, lu, erow-srow+1, gCols);
+        if (ResModel && desired_res - current_res > delta_res)  {
+            SPATIALflagDevelopable(developable, lu, elements,
+                                   nondevelopable_flags);
+            PERFstart(PERF_PROB);
+            PERFcount(PERF_CELLS, elements);
             calcProbRes(resprob, elements);
+            PERFstop(PERF_PROB);
+            PERFstart(PERF_DEVELOP);
             developCells(&current_res, &cell_count_res, resprob, density_res,
                      LU_LRES, itr); 
+            PERFstop(PERF_DEVELOP);
             res = spatialCount(lu, elements, LU_LRES);
         }
 
@@ -1705,16 +2427,29 @@ void LUCrun()
 
 #ifdef OPENSPACE
         // OPENSPACE DEVELOPMENT
-        spatialDiffusion(utilities_os, utilities_tmp, diffusion_rate_os, 
-                        diffusion_os_flags, lu, erow-srow, gCols);
-        flagDevelopable(developable, lu, elements, nondevelopable_flags);
-        calcProbOS(osprob, elements);
-        developCells(&current_os, &cell_count_os, osprob, density_os,
-                     LU_OS, itr); 
+        if (OSModel)  {
+            spatialDiffusion(utilities_os, utilities_tmp, diffusion_rate_os, 
+                            diffusion_os_flags, lu, erow-srow+1, gCols);
+            SPATIALflagDevelopable(developable, lu, elements,
+                                   nondevelopable_flags);
+            PERFstart(PERF_PROB);
+            PERFcount(PERF_CELLS, elements);
+            calcProbOS(osprob, elements);
+            PERFstop(PERF_PROB);
+            PERFstart(PERF_DEVELOP);
+            developCells(&current_os, &cell_count_os, osprob, density_os,
+                         LU_OS, itr); 
+            PERFstop(PERF_DEVELOP);
+        }
 #endif
 
-        shareGrid(change, elements, MPI_UNSIGNED_CHAR);
         updateLU(lu, change, elements);
+        shareGrid(lu, elements, MPI_UNSIGNED_CHAR);
+
+        if (patches != NULL)  {
+            pstats[npatch].year = time;
+            PATCHlabel(patches, lu, change, &pstats[npatch++]);
+        }
 
         // Dump initial probmaps if they are requested
         // Note: technically we should identify these as 'time' rather
@@ -1728,6 +2463,8 @@ void LUCrun()
             fprintf(stderr, "ITR %d: cell_count_com = %d, current_com = %f\n",
                     itr, cell_count_com, current_com);
         }
+
+        PERFyear(time);
     }
 
     // Dump the final probability maps if requested in config
@@ -1739,11 +2476,11 @@ void LUCrun()
     os = spatialCount(lu, elements, LU_OS);
 
     writeAscGridMap(SMEgetFileName("FINAL_DIFFUSION_RES_MAP"), etime,
-                 (char *)utilities_res, elements, MPI_FLOAT);
+                 (char *)utilities_res, elements, MPI_FLOAT, 1.0);
     writeAscGridMap(SMEgetFileName("FINAL_DIFFUSION_COM_MAP"), etime,
-                 (char *)utilities_com, elements, MPI_FLOAT);
+                 (char *)utilities_com, elements, MPI_FLOAT, 1.0);
     writeAscGridMap(SMEgetFileName("FINAL_DIFFUSION_OS_MAP"), etime,
-                 (char *)utilities_os, elements, MPI_FLOAT);
+                 (char *)utilities_os, elements, MPI_FLOAT, 1.0);
 
     writeGridMap(SMEgetFileName("FINAL_LAND_USE_MAP"), etime, (char*)lu, 
                  elements, MPI_UNSIGNED_CHAR);
@@ -1757,6 +2494,28 @@ void LUCrun()
     writeGridMap(SMEgetFileName("FINAL_LAND_USE_CHANGE_MAP"), etime, 
                  (char*)change, elements, MPI_UNSIGNED_CHAR);
 
+    /* score new residential cells against the reference counts,
+    ** the score is also returned to the GA engine if there is one.
+    */
+    if (refzones > 0 && refcounts != NULL)
+        score = scoreResults(refcounts, refzones, refmap, change, elements);
+
+    /* the accuracy against the reference land use, its fit is the one
+    ** returned to the GA engine when there is a reference land use map
+    */
+    if (accuracy)
+        score = scoreAccuracy(lu, &acc);
+
+    /* the worst quantization error of every keyframe and delta read,
+    ** the startup report only saw the base maps
+    */
+    if (probmap_os->mode != QUANT_F32)  {
+        err = probmap_os->maxerr;
+        if (pm_res->maxerr > err) err = pm_res->maxerr;
+        if (pm_com->maxerr > err) err = pm_com->maxerr;
+        MPI_Reduce(&err, &pmerr, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+
     if (debug)
         fprintf(stderr, "P%d: Model Run Complete\n", myrank);
 
@@ -1825,5 +2584,24 @@ void LUCrun()
         printf("Actual Change: Res = %.2f, Com = %.2f, OS = %.2f\n", 
                 current_res, current_com, current_os);
 
+        if (probmap_os->mode != QUANT_F32)  {
+            printf("\n");
+            printf("Probmap precision %s, max error = %g\n",
+                   QGRIDname(probmap_os->mode), pmerr);
+        }
+
+        if (patches != NULL)  {
+            printf("\n");
+            printf("Patch Metrics (residential and commercial)\n");
+            PATCHreport(pstats, npatch, cellsize);
+        }
+
+        if (accuracy)  {
+            printf("\n");
+            scoreAccuracyReport(&acc);
+        }
+
     }
+    if (pstats != NULL)
+        freeMem(pstats);
 }
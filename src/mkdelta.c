@@ -0,0 +1,56 @@
+/*
+** mkdelta builds a sparse delta layer (see delta.c) holding the cells
+** of a BIL grid that differ from a base grid, typically the previous
+** year's version of the same input.
+**
+** Usage: mkdelta base.bil new.bil out.dlt
+**
+** Both grids must have the same dimensions and type, the cell size is
+** taken from NBITS in the header.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "bil.h"
+#include "delta.h"
+
+int debug = 0;
+int myrank = 0, nproc = 1;
+
+
+int main(int argc, char *argv[])
+{
+    int rows, cols, bits, r2, c2, b2, runs;
+    char *base, *grid;
+
+    MPI_Init(&argc, &argv);
+
+    if (argc != 4)  {
+        fprintf(stderr, "Usage: %s base.bil new.bil out%s\n", argv[0],
+                DELTA_EXT);
+        MPI_Finalize();
+        exit(1);
+    }
+
+    BILreadHeader(argv[1], &rows, &cols, &bits);
+    BILreadHeader(argv[2], &r2, &c2, &b2);
+    if (rows != r2 || cols != c2 || bits != b2 || bits % 8)
+        errorExit("grids must have identical dimensions and type");
+
+    base = getMem(rows * cols * bits/8, "base grid");
+    grid = getMem(rows * cols * bits/8, "new grid");
+    BILreadBuffer(argv[1], 0, base, rows * cols, bits/8);
+    BILreadBuffer(argv[2], 0, grid, rows * cols, bits/8);
+
+    runs = DELTAwrite(argv[3], base, grid, rows, cols, bits/8);
+    printf("%s: %d runs\n", argv[3], runs);
+
+    freeMem(base);
+    freeMem(grid);
+    MPI_Finalize();
+    return 0;
+}
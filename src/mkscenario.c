@@ -0,0 +1,242 @@
+/*
+** mkscenario writes a self-consistent synthetic gluc project of any
+** size, so scaling runs and bug reports don't need restricted inputs.
+**
+** Usage: mkscenario [-r rows] [-c cols] [-y start,end] [-s seed] dir
+**
+** The directory gets a boundary, a land use map with clustered towns,
+** roads, water and open space, residential and commercial probmaps and
+** density maps, the Population and Employment demand graphs and an SME
+** configuration (scenario.cfg).  Run it with
+**
+**     cd dir && mpirun -np N gluc -ci scenario.cfg
+**
+** Every layer is a function of the cell position and the seed and is
+** written a row at a time, so memory use doesn't grow with the grid.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "bil.h"
+
+int debug = 0;
+int myrank = 0, nproc = 1;
+
+#define TOWNS_PER_MCELL  25       /* town centres per million cells */
+#define MAX_TOWNS        4096
+
+static int rows = 1000, cols = 1000, stime = 2000, etime = 2030;
+static unsigned long long seed = 1;
+static char *dir;
+
+static int ntowns;
+static float townx[MAX_TOWNS], towny[MAX_TOWNS], townr[MAX_TOWNS];
+
+
+/* uniform [0,1) value for an integer lattice point and layer */
+static double hash01(long x, long y, int layer)
+{
+    unsigned long long z;
+
+    z = seed * 0x9e3779b97f4a7c15ULL + x * 0xbf58476d1ce4e5b9ULL
+        + y * 0x94d049bb133111ebULL + layer;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* smooth value noise in [0,1) with features about scale cells wide */
+static double noise(int r, int c, double scale, int layer)
+{
+    double x = c / scale, y = r / scale, fx, fy, a, b;
+    long ix = (long)floor(x), iy = (long)floor(y);
+
+    fx = x - ix;  fy = y - iy;
+    fx = fx * fx * (3.0 - 2.0 * fx);
+    fy = fy * fy * (3.0 - 2.0 * fy);
+    a = hash01(ix, iy, layer) * (1-fx) + hash01(ix+1, iy, layer) * fx;
+    b = hash01(ix, iy+1, layer) * (1-fx) + hash01(ix+1, iy+1, layer) * fx;
+    return a * (1-fy) + b * fy;
+}
+
+/* two octaves, roughly features at scale and scale/4 */
+static double fractal(int r, int c, double scale, int layer)
+{
+    return 0.7 * noise(r, c, scale, layer)
+           + 0.3 * noise(r, c, scale / 4.0, layer + 100);
+}
+
+/* urban intensity, 1 at a town centre falling off with distance */
+static double urban(int r, int c)
+{
+    int i;
+    double d, u = 0.0, v;
+
+    for (i=0; i<ntowns; i+=1)  {
+        d = hypot(c - townx[i], r - towny[i]) / townr[i];
+        if (d < 3.0 && (v = exp(-d * d)) > u)
+            u = v;
+    }
+    return u;
+}
+
+static void placeTowns()
+{
+    int i;
+
+    ntowns = (int)((double)rows * cols / 1e6 * TOWNS_PER_MCELL) + 1;
+    if (ntowns > MAX_TOWNS) ntowns = MAX_TOWNS;
+    for (i=0; i<ntowns; i+=1)  {
+        townx[i] = cols * (0.1 + 0.8 * hash01(i, 0, 900));
+        towny[i] = rows * (0.1 + 0.8 * hash01(i, 1, 900));
+        townr[i] = 10.0 + 0.03 * sqrt((double)rows * cols)
+                   * hash01(i, 2, 900);
+    }
+}
+
+static FILE *createLayer(char *name, int size, char *type)
+{
+    char fname[1024];
+
+    sprintf(fname, "%s/%s", dir, name);
+    BILwriteHeader(fname, rows, cols, size, type, 0.0, rows * 30.0,
+                   30.0, 30.0);
+    return BILopenBinary(fname, "wb");
+}
+
+int main(int argc, char *argv[])
+{
+    int i, r, c, inside;
+    double u, n, e, cx, cy;
+    double capres = 0.0, capcom = 0.0;
+    unsigned char *b8, *l8;
+    float *pres, *pcom, *dres, *dcom;
+    FILE *fb, *fl, *fpr, *fpc, *fdr, *fdc, *f;
+    char fname[1024];
+
+    MPI_Init(&argc, &argv);
+
+    for (i=1; i<argc-1; i+=1)  {
+        if (!strcmp(argv[i], "-r"))
+            rows = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c"))
+            cols = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-y"))
+            sscanf(argv[++i], "%d,%d", &stime, &etime);
+        else if (!strcmp(argv[i], "-s"))
+            seed = strtoull(argv[++i], NULL, 10);
+        else
+            break;
+    }
+    if (i != argc-1 || rows < 3 || cols < 3 || etime <= stime)  {
+        fprintf(stderr, "Usage: %s [-r rows] [-c cols] [-y start,end] "
+                "[-s seed] dir\n", argv[0]);
+        MPI_Finalize();
+        exit(1);
+    }
+    dir = argv[argc-1];
+    mkdir(dir, 0755);
+    placeTowns();
+
+    fb = createLayer("boundary.bil", 1, "MPI_UNSIGNED_CHAR");
+    fl = createLayer("lu.bil", 1, "MPI_UNSIGNED_CHAR");
+    fpr = createLayer("probres.bil", sizeof (float), "MPI_FLOAT");
+    fpc = createLayer("probcom.bil", sizeof (float), "MPI_FLOAT");
+    fdr = createLayer("density_res.bil", sizeof (float), "MPI_FLOAT");
+    fdc = createLayer("density_com.bil", sizeof (float), "MPI_FLOAT");
+
+    b8 = (unsigned char *)getMem(cols, "boundary row");
+    l8 = (unsigned char *)getMem(cols, "land use row");
+    pres = (float *)getMem(cols * sizeof (float), "probres row");
+    pcom = (float *)getMem(cols * sizeof (float), "probcom row");
+    dres = (float *)getMem(cols * sizeof (float), "density_res row");
+    dcom = (float *)getMem(cols * sizeof (float), "density_com row");
+
+    cx = cols / 2.0;  cy = rows / 2.0;
+    for (r=0; r<rows; r+=1)  {
+        for (c=0; c<cols; c+=1)  {
+
+            /* study area is a ragged ellipse */
+            e = hypot((c - cx) / cx, (r - cy) / cy);
+            inside = e < 0.85 + 0.25 * fractal(r, c, 40.0, 1);
+            b8[c] = inside;
+
+            u = urban(r, c);
+            n = fractal(r, c, 25.0, 2);
+
+            /* land use, towns first then the landscape */
+            if (!inside)
+                l8[c] = 0;
+            else if (fractal(r, c, 60.0, 3) > 0.82)
+                l8[c] = LU_WATER;
+            else if ((r % 400 < 2 || c % 400 < 2) && n > 0.3)
+                l8[c] = LU_ROAD;
+            else if (u * (0.6 + 0.8 * n) > 0.75)
+                l8[c] = (hash01(c, r, 4) < 0.15 + 0.4 * u) ? LU_COM : LU_LRES;
+            else if (fractal(r, c, 30.0, 5) > 0.78)
+                l8[c] = (hash01(c, r, 6) < 0.3) ? LU_WET : LU_OS;
+            else
+                l8[c] = 82;            /* agriculture, developable */
+
+            /* probabilities favour the edges of towns */
+            pres[c] = inside ? 0.05 + 0.9 * u * (0.5 + 0.5 * n) : 0.0;
+            pcom[c] = inside ? 0.02 + 0.9 * u * u * noise(r, c, 15.0, 7)
+                             : 0.0;
+
+            /* people and jobs per cell, nodata outside */
+            dres[c] = inside ? 1.0 + 6.0 * u + 2.0 * n : -9999.0;
+            dcom[c] = inside ? 2.0 + 20.0 * u * u : -9999.0;
+
+            if (l8[c] == 82)  {
+                capres += dres[c];
+                capcom += dcom[c];
+            }
+        }
+        BILwriteBlock(fb, b8, cols, 1);
+        BILwriteBlock(fl, l8, cols, 1);
+        BILwriteBlock(fpr, pres, cols, sizeof (float));
+        BILwriteBlock(fpc, pcom, cols, sizeof (float));
+        BILwriteBlock(fdr, dres, cols, sizeof (float));
+        BILwriteBlock(fdc, dcom, cols, sizeof (float));
+    }
+
+    BILclose(fb);  BILclose(fl);
+    BILclose(fpr); BILclose(fpc);
+    BILclose(fdr); BILclose(fdc);
+
+    /* demand fills a few percent of the developable capacity */
+    sprintf(fname, "%s/graphs.txt", dir);
+    f = BILopenBinary(fname, "w");
+    fprintf(f, "Population\n%d, 0\n%d, %.0f\n\n", stime, etime, 0.04 * capres);
+    fprintf(f, "Employment\n%d, 0\n%d, %.0f\n", stime, etime, 0.01 * capcom);
+    fclose(f);
+
+    sprintf(fname, "%s/scenario.cfg", dir);
+    f = BILopenBinary(fname, "w");
+    fprintf(f, "# global OT 1 %d %d\n", stime, etime);
+    fprintf(f, "* LU_MAP M (BIL, 1, lu.bil)\n");
+    fprintf(f, "* BOUNDARY_MAP M (BIL, 1, boundary.bil)\n");
+    fprintf(f, "* PROBMAP_RES M (BIL, 1, probres.bil)\n");
+    fprintf(f, "* PROBMAP_COM M (BIL, 1, probcom.bil)\n");
+    fprintf(f, "* DENSITY_MAP_RES M (BIL, 1, density_res.bil)\n");
+    fprintf(f, "* DENSITY_MAP_COM M (BIL, 1, density_com.bil)\n");
+    fprintf(f, "* Population GRAPH graphs.txt\n");
+    fprintf(f, "* FINAL_LAND_USE_MAP M (BIL, 1, out_lu)\n");
+    fprintf(f, "* FINAL_CHANGE_MAP M (BIL, 1, out_change)\n");
+    fclose(f);
+
+    printf("%s: %d x %d cells, %d towns, %d-%d, demand res %.0f com %.0f\n",
+           dir, rows, cols, ntowns, stime, etime, 0.04 * capres,
+           0.01 * capcom);
+
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,323 @@
+/*
+** Multilevel diffusion (DIFFUSION_ENGINE multigrid).
+**
+** The explicit kernel moves utility one cell a step, so a warm-up of
+** n steps costs n sweeps of the grid.  Leaving out the clamp, a step
+** is the operator I + rA with A the mean of the 8 neighbors.  It grows
+** the field by 1+r a step so everything the front has passed is soon
+** clamped at 1, what matters is the speed of the front.  On a grid
+** coarsened by B = 2^L a coarse step stands for B steps and is
+**
+**   u = (1+r)^B * ((1-q) u + q A u)
+**
+** which has the growth of the B steps, q is solved for so that the
+** front moves at the speed of the explicit one (see frontSpeed).  The
+** field is
+** restricted to the coarse grid (the block means, with the fraction
+** of each block that are sources held as a floor), advanced n/B steps
+** there, interpolated back bilinearly and finished with MG_SMOOTH
+** (plus any left over) explicit steps that restore the detail around
+** the sources.  MG_LEVELS (default 3) limits the coarsening.
+**
+** The result is an approximation of the explicit kernel.  The fronts
+** can lag or lead the explicit ones by a cell or two, so while the mean
+** difference is small a cell at a front can be off by nearly the whole
+** 0..1 range.  With MG_CHECK and/or MG_CHECK_MAX set to a tolerance
+** the explicit result is computed as well, the differences are
+** reported and the explicit result is used if the mean difference is
+** above MG_CHECK or the largest is above MG_CHECK_MAX.
+**
+** The coarse grid is 1/B^2 of the cells and global.  Each rank sums
+** its rows' share of the blocks in fixed point, one reduction
+** combines them and every rank advances the whole coarse grid, so
+** the result doesn't depend on the number of ranks.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "multigrid.h"
+#include "perf.h"
+
+extern int srow;
+
+#define MG_FIX  1099511627776.0     /* 2^40, fixed point of block sums */
+
+static int mglevels = 3;            // MG_LEVELS
+static int mgsmooth = 4;            // MG_SMOOTH
+static float mgtol = 0.0;           // MG_CHECK, 0 for no check
+static float mgmaxtol = 0.0;        // MG_CHECK_MAX, 0 for no check
+
+
+void MGconfig(int levels, int smooth, float tol, float maxtol)
+{
+    mglevels = (levels > MG_MAXLEVEL) ? MG_MAXLEVEL : levels;
+    mgsmooth = (smooth < 0) ? 0 : smooth;
+    mgtol = tol;
+    mgmaxtol = maxtol;
+}
+
+/* Coarsening level for steps, the largest leaving MG_MINSTEPS coarse
+** steps.  0 if the explicit kernel should be used.
+*/
+static int mgLevel(int steps)
+{
+    int L, b, cr, cc;
+
+    for (L=mglevels; L>0; L-=1)  {
+        b = 1 << L;
+        cr = (gRows + b-1) / b;
+        cc = (gCols + b-1) / b;
+        if ((steps - mgsmooth) / b >= MG_MINSTEPS && cr >= 2 &&
+            cc >= 2 && (long)cr * cc <= MG_MAXCELLS)
+            return L;
+    }
+    return 0;
+}
+
+/* Speed (cells a step) of the front of u = (a + b A) u, where u grows
+** from small values.  The front is where the growth balances the
+** decay of u, the speed is the minimum over l of log(a + b m(l)) / l
+** with m(l) the moment of A along a row, (1 + 3 cosh l) / 4.
+*/
+static double frontSpeed(double a, double b)
+{
+    double l, v, best = HUGE_VAL;
+
+    for (l=0.05; l<40.0; l+=0.05)  {
+        v = log(a + b * (1.0 + 3.0 * cosh(l)) / 4.0) / l;
+        if (v < best) best = v;
+    }
+    return best;
+}
+
+/* Neighbor weight of a coarse step with growth g so its front keeps
+** up with the explicit one at rate r.
+*/
+static double coarseWeight(double r, double g)
+{
+    int i;
+    double v, lo = -30.0, hi = 0.0, q;
+
+    v = frontSpeed(1.0, r);
+    if (frontSpeed(0.0, g) <= v)
+        return 1.0;
+
+    /* the speed grows with q, bisect on log q */
+    for (i=0; i<50; i+=1)  {
+        q = exp((lo + hi) / 2.0);
+        if (frontSpeed(g * (1.0 - q), g * q) > v)
+            hi = (lo + hi) / 2.0;
+        else
+            lo = (lo + hi) / 2.0;
+    }
+    return exp((lo + hi) / 2.0);
+}
+
+/* n steps on the coarse grid u (cr x cc inside a zero border), s the
+** floor held by the sources and t scratch of the same size.  q is the
+** weight of the neighbors and g the growth of a step.
+*/
+static void coarseSteps(float *u, float *t, float *s, int cr, int cc,
+                        float q, float g, int n)
+{
+    int i, j, k, w = cc + 2;
+    float *p;
+
+    for (k=0; k<n; k+=1)  {
+        for (i=1; i<=cr; i+=1)
+            for (j=1; j<=cc; j+=1)
+                if (u[i*w+j] < s[i*w+j]) u[i*w+j] = s[i*w+j];
+
+        for (i=1; i<=cr; i+=1)  {
+            p = u + i*w;
+            for (j=1; j<=cc; j+=1)
+                t[i*w+j] = (1.0f - q) * p[j] + q * ( p[j-w-1] + p[j-w]
+                           + p[j-w+1] + p[j-1] + p[j+1] + p[j+w-1] + p[j+w]
+                           + p[j+w+1] ) / 8.0f;
+        }
+
+        for (i=1; i<=cr; i+=1)
+            for (j=1; j<=cc; j+=1)
+                u[i*w+j] = (g * t[i*w+j] > 1.0f) ? 1.0f : g * t[i*w+j];
+    }
+}
+
+/* Bilinear interpolation of the coarse grid u onto the local rows of
+** dst, by global position so every rank agrees.
+*/
+static void prolong(float *dst, float *u, int cr, int cc, int L,
+                    int rows, int cols)
+{
+    int r, c, i0, i1, j0, j1, w = cc + 2;
+    double b = 1 << L, y, x, fy, fx;
+
+    for (r=0; r<rows; r+=1)  {
+        y = (srow + r + 0.5) / b - 0.5;
+        i0 = (int)floor(y);
+        fy = y - i0;
+        i1 = (i0+1 < cr) ? i0+1 : cr-1;
+        if (i0 < 0) i0 = 0;
+        for (c=0; c<cols; c+=1)  {
+            x = (c + 0.5) / b - 0.5;
+            j0 = (int)floor(x);
+            fx = x - j0;
+            j1 = (j0+1 < cc) ? j0+1 : cc-1;
+            if (j0 < 0) j0 = 0;
+            dst[r*cols+c] = (1.0 - fy) * ((1.0 - fx) * u[(i0+1)*w+j0+1]
+                                          + fx * u[(i0+1)*w+j1+1])
+                          + fy * ((1.0 - fx) * u[(i1+1)*w+j0+1]
+                                  + fx * u[(i1+1)*w+j1+1]);
+        }
+    }
+}
+
+/* Mean and largest difference between the cells of a and b over all
+** ranks, returns the mean.
+*/
+static double compare(int nf, float **a, float **b, int count,
+                      double *max)
+{
+    int i, f;
+    double e[3], ge[3], d;
+
+    e[0] = e[1] = e[2] = 0.0;
+    for (f=0; f<nf; f+=1)
+        for (i=0; i<count; i+=1)  {
+            d = fabs(a[f][i] - b[f][i]);
+            e[0] += d;
+            if (d > e[2]) e[2] = d;
+        }
+    e[1] = (double)nf * count;
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(e, ge, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(e+2, ge+2, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Bcast(ge, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    *max = ge[2];
+    return ge[0] / ge[1];
+}
+
+/* Approximate steps explicit diffusion steps of the nf grids src, the
+** arguments are those of SPATIALdiffusionSteps which is used when the
+** steps are too few to gain from coarsening.
+*/
+void MGdiffusion(int nf, float **src, float *rate, int *type,
+                 unsigned char *luptr, int rows, int cols,
+                 int steps, int depth)
+{
+    int i, f, r, c, k, L, b, cr, cc, csteps, fine, n, checking, reject;
+    long long *acc, *gacc;
+    float *u, *t, *s, *check[MG_MAXFIELDS];
+    double bs, cells, err, emax, g;
+    LU_FLAG cls;
+
+    L = mgLevel(steps);
+    if (L == 0 || nf > MG_MAXFIELDS)  {
+        SPATIALdiffusionSteps(nf, src, rate, type, luptr, rows, cols,
+                              steps, depth);
+        return;
+    }
+
+    b = 1 << L;
+    cr = (gRows + b-1) / b;
+    cc = (gCols + b-1) / b;
+    csteps = (steps - mgsmooth) / b;
+    fine = steps - csteps * b;
+
+    /* the explicit result, grids with the passive rows */
+    checking = (mgtol > 0.0 || mgmaxtol > 0.0);
+    if (checking)  {
+        for (f=0; f<nf; f+=1)  {
+            check[f] = (float *)initGridMap(NULL, rows*cols,
+                                            sizeof (float));
+            memcpy(check[f] - cols, src[f] - cols,
+                   (rows+2)*cols * sizeof (float));
+        }
+        SPATIALdiffusionSteps(nf, check, rate, type, luptr, rows, cols,
+                              steps, depth);
+    }
+
+    PERFstart(PERF_DIFFUSION);
+    PERFcount(PERF_CELLS, (long)nf*rows*cols);
+
+    /* block sums and source counts of every grid, one reduction */
+    n = 2 * nf * cr * cc;
+    acc = (long long *)getMem(n * sizeof (long long), "multigrid sums");
+    gacc = (long long *)getMem(n * sizeof (long long), "multigrid sums");
+    memset(acc, 0, n * sizeof (long long));
+    for (r=0; r<rows; r+=1)
+        for (c=0; c<cols; c+=1)  {
+            k = ((srow + r) / b) * cc + c / b;
+            cls = SPATIALdiffusionClass(luptr[r*cols+c]);
+            for (f=0; f<nf; f+=1)  {
+                if (type[f] & cls)
+                    acc[(2*f+1)*cr*cc + k] += 1;
+                else
+                    acc[2*f*cr*cc + k] +=
+                        (long long)(src[f][r*cols+c] * MG_FIX);
+            }
+        }
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(acc, gacc, n, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Bcast(gacc, n, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    n = (cr + 2) * (cc + 2);
+    u = (float *)getMem(3 * n * sizeof (float), "multigrid levels");
+    t = u + n;
+    s = t + n;
+    for (f=0; f<nf; f+=1)  {
+        memset(u, 0, 3 * n * sizeof (float));
+        for (i=0; i<cr*cc; i+=1)  {
+            r = i / cc;
+            c = i % cc;
+            cells = (double)(((r+1)*b < gRows ? b : gRows - r*b)) *
+                    ((c+1)*b < gCols ? b : gCols - c*b);
+            bs = gacc[(2*f+1)*cr*cc + i] / cells;
+            k = (r+1) * (cc+2) + c+1;
+            s[k] = bs;
+            u[k] = bs + gacc[2*f*cr*cc + i] / MG_FIX / cells;
+        }
+
+        g = pow(1.0 + rate[f], b);
+        coarseSteps(u, t, s, cr, cc, coarseWeight(rate[f], g), g, csteps);
+        prolong(src[f], u, cr, cc, L, rows, cols);
+    }
+
+    freeMem(u);
+    freeMem(acc);
+    freeMem(gacc);
+    PERFstop(PERF_DIFFUSION);
+
+    /* the explicit steps restore the structure around the sources */
+    if (fine > 0)
+        SPATIALdiffusionSteps(nf, src, rate, type, luptr, rows, cols,
+                              fine, depth);
+
+    if (debug && myrank == 0)
+        fprintf(stderr, "MGdiffusion: %d steps as %d on %dx%d blocks "
+                "and %d explicit\n", steps, csteps, b, b, fine);
+
+    if (checking)  {
+        err = compare(nf, src, check, rows*cols, &emax);
+        reject = (mgtol > 0.0 && err > mgtol) ||
+                 (mgmaxtol > 0.0 && emax > mgmaxtol);
+        if (myrank == 0)
+            fprintf(stderr, "MGdiffusion: difference from explicit mean "
+                    "%g, max %g%s\n", err, emax,
+                    reject ? ", using explicit" : "");
+        for (f=0; f<nf; f+=1)  {
+            if (reject)
+                memcpy(src[f], check[f], rows*cols * sizeof (float));
+            freeGridMap((char *)check[f], sizeof (float));
+        }
+    }
+}
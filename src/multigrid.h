@@ -0,0 +1,24 @@
+/* multigrid.c header file
+**
+** Multilevel alternative to the explicit diffusion kernel for long
+** warm-ups.  Many explicit steps are approximated by a few steps on a
+** coarsened grid followed by explicit smoothing steps on the model
+** grid, see multigrid.c.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#define MG_MAXLEVEL   5             /* coarsest blocks are 32x32 cells */
+#define MG_MINSTEPS   8             /* fewest coarse steps worth taking */
+#define MG_MAXCELLS   (4 << 20)     /* largest coarse grid */
+#define MG_MAXFIELDS  4
+
+extern void MGconfig(int levels, int smooth, float tol, float maxtol);
+extern void MGdiffusion(int nf, float **src, float *rate, int *type,
+                        unsigned char *luptr, int rows, int cols,
+                        int steps, int depth);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+** Patch labelling and landscape metrics (PATCH_METRICS).
+**
+** A patch is a set of cells of the classes connected through any of
+** their 8 neighbors.  Each rank labels its own rows with a union-find
+** in one scan, every root being the first cell of its part of a
+** patch, then flattens the trees in a second scan that also adds up
+** the cells, the edges and whether the part holds a cell of the start
+** map (one not in change).  Parts that reach a strip boundary are only
+** pieces of patches, they and the pairs of pieces touching across the
+** boundaries go to the root, which joins them with a second union-find
+** and sends back the label of each piece's patch.  Only the pieces on
+** the boundary rows travel, not the grid.
+**
+** A patch's label is the global index of its first cell in row major
+** order, so the labels and the metrics don't depend on the number of
+** ranks.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "patch.h"
+#include "perf.h"
+
+extern int srow, erow, elements, gElements;
+
+#define PATCH_OLD     1             /* mark bits of a local root */
+#define PATCH_EDGE    2             /* on the first or last row of a strip */
+
+
+PATCH_T *PATCHinit(LU_FLAG flags)
+{
+    int i;
+    PATCH_T *p;
+
+    p = (PATCH_T *)getMem(sizeof (PATCH_T), "patches");
+    p->flags = flags;
+    p->label = (int *)initGridMap(NULL, elements, sizeof (int));
+    for (i=-gCols; i<elements+gCols; i+=1)
+        p->label[i] = -1;
+    p->size = (int *)getMem(elements * sizeof (int), "patch sizes");
+    p->roots = (int *)getMem(elements * sizeof (int), "patch roots");
+    p->mark = (unsigned char *)getMem(elements, "patch marks");
+    return p;
+}
+
+/* Root of x, halving the path on the way.  Parents never follow their
+** children so the root is the first cell of the tree.
+*/
+static int find(int *l, int x)
+{
+    while (l[x] != x)  {
+        l[x] = l[l[x]];
+        x = l[x];
+    }
+    return x;
+}
+
+static void unite(int *l, int a, int b)
+{
+    a = find(l, a);
+    b = find(l, b);
+    if (a < b)
+        l[b] = a;
+    else if (b < a)
+        l[a] = b;
+}
+
+/* Index of the record with the label, the records are in label order.
+*/
+static int search(int *rec, int n, int label)
+{
+    int lo = 0, hi = n - 1, m;
+
+    while (lo < hi)  {
+        m = (lo + hi) / 2;
+        if (rec[3*m] < label)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
+}
+
+/* Join the pieces of all ranks on the root and give each its patch's
+** label in fin, also adding the joined patches to the sums and the
+** largest.  rec holds label, cells and old of the local pieces, pair
+** the labels of pieces touching across the boundary below.
+*/
+static void join(int *rec, int nrec, int *pair, int npair, int *fin,
+                 double *sum, int *largest)
+{
+    int i, k, a, n[2], *counts = NULL, *rcounts = NULL, *rdispl = NULL;
+    int *pcounts = NULL, *pdispl = NULL, *all = NULL, *allpair = NULL;
+    int *parent = NULL, *allfin = NULL, total = 0, ptotal = 0;
+
+    n[0] = 3 * nrec;
+    n[1] = 2 * npair;
+    if (myrank == 0)
+        counts = (int *)getMem(6 * nproc * sizeof (int), "patch counts");
+    MPI_Gather(n, 2, MPI_INT, counts, 2, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if (myrank == 0)  {
+        rcounts = counts + 2 * nproc;
+        rdispl = rcounts + nproc;
+        pcounts = rdispl + nproc;
+        pdispl = pcounts + nproc;
+        for (i=0; i<nproc; i+=1)  {
+            rcounts[i] = counts[2*i];
+            pcounts[i] = counts[2*i+1];
+            rdispl[i] = total;
+            pdispl[i] = ptotal;
+            total += rcounts[i];
+            ptotal += pcounts[i];
+        }
+        all = (int *)getMem((total + ptotal + 2 * total / 3 + 1)
+                            * sizeof (int), "patch pieces");
+        allpair = all + total;
+        parent = allpair + ptotal;
+        allfin = parent + total / 3;
+    }
+    MPI_Gatherv(rec, 3*nrec, MPI_INT, all, rcounts, rdispl, MPI_INT, 0,
+                MPI_COMM_WORLD);
+    MPI_Gatherv(pair, 2*npair, MPI_INT, allpair, pcounts, pdispl, MPI_INT,
+                0, MPI_COMM_WORLD);
+
+    if (myrank == 0)  {
+        total /= 3;
+        for (k=0; k<total; k+=1)
+            parent[k] = k;
+        for (i=0; i<ptotal; i+=2)
+            unite(parent, search(all, total, allpair[i]),
+                  search(all, total, allpair[i+1]));
+
+        // a root comes before its pieces and gathers their cells
+        for (k=0; k<total; k+=1)  {
+            a = find(parent, k);
+            if (a != k)  {
+                all[3*a+1] += all[3*k+1];
+                all[3*a+2] |= all[3*k+2];
+            }
+            allfin[k] = all[3*a];
+        }
+        for (k=0; k<total; k+=1)  {
+            if (parent[k] != k)
+                continue;
+            sum[0] += 1.0;
+            if (!all[3*k+2])
+                sum[1] += 1.0;
+            if (all[3*k+1] > *largest)
+                *largest = all[3*k+1];
+        }
+
+        for (i=0; i<nproc; i+=1)  {
+            rcounts[i] /= 3;
+            rdispl[i] /= 3;
+        }
+    }
+    MPI_Scatterv(allfin, rcounts, rdispl, MPI_INT, fin, nrec, MPI_INT, 0,
+                 MPI_COMM_WORLD);
+
+    if (myrank == 0)  {
+        freeMem(all);
+        freeMem(counts);
+    }
+}
+
+/* Label the patches of p's classes in lu and return their metrics in
+** s (on every rank).  lu's passive rows must be current, cells not in
+** change are those of the start map.  Must be called by all ranks.
+*/
+void PATCHlabel(PATCH_T *p, unsigned char *lu, unsigned char *change,
+                PATCH_STATS *s)
+{
+    int i, r, j, dc, g, k, n, nroot, nrec, npair, largest = 0, glargest;
+    int nrows = erow - srow + 1, base = srow * gCols, top, bottom;
+    int *l = p->label, *size = p->size, *roots = p->roots, *rec, *pair;
+    int *fin, *edge;
+    long cells = 0, edges = 0;
+    unsigned char *mark = p->mark, in[256];
+    double sum[4] = { 0.0, 0.0, 0.0, 0.0 }, gsum[5];
+
+    PERFstart(PERF_PATCH);
+    for (i=0; i<256; i+=1)
+        in[i] = (SPATIALdiffusionClass(i) & p->flags) != 0;
+    top = srow > 0;
+    bottom = erow < gRows - 1;
+
+    /* join each cell to the neighbors already scanned, if the one above
+    ** is in a patch the other three are already joined to it
+    */
+    for (r=0; r<nrows; r+=1)
+        for (j=0; j<gCols; j+=1)  {
+            i = r * gCols + j;
+            if (!in[lu[i]])  {
+                l[i] = -1;
+                continue;
+            }
+            if (r > 0 && l[i-gCols] >= 0)  {
+                l[i] = l[i-gCols];
+                continue;
+            }
+            if (j > 0 && l[i-1] >= 0)
+                l[i] = l[i-1];
+            else if (r > 0 && j > 0 && l[i-gCols-1] >= 0)
+                l[i] = l[i-gCols-1];
+            else
+                l[i] = i;
+            if (r > 0 && j < gCols-1 && l[i-gCols+1] >= 0)  {
+                if (l[i] == i)
+                    l[i] = l[i-gCols+1];
+                else
+                    unite(l, i, i-gCols+1);
+            }
+        }
+
+    /* point every cell at its root, the roots come first */
+    nroot = 0;
+    for (r=0; r<nrows; r+=1)
+        for (j=0; j<gCols; j+=1)  {
+            i = r * gCols + j;
+            if (l[i] < 0)
+                continue;
+            if (l[i] == i)  {
+                roots[nroot++] = i;
+                size[i] = 0;
+                mark[i] = 0;
+            }
+            else
+                l[i] = l[l[i]];
+            k = l[i];
+            size[k] += 1;
+            if (!change[i])
+                mark[k] |= PATCH_OLD;
+            if ((r == 0 && top) || (r == nrows-1 && bottom))
+                mark[k] |= PATCH_EDGE;
+
+            cells += 1;
+            n = 0;
+            if (r > 0 || top)
+                n += !in[lu[i-gCols]];
+            if (r < nrows-1 || bottom)
+                n += !in[lu[i+gCols]];
+            if (j > 0)
+                n += !in[lu[i-1]];
+            if (j < gCols-1)
+                n += !in[lu[i+1]];
+            edges += n;
+        }
+    sum[2] = cells;
+    sum[3] = edges;
+
+    /* whole patches are counted here, pieces become records */
+    nrec = 0;
+    for (k=0; k<nroot; k+=1)
+        if (mark[roots[k]] & PATCH_EDGE)
+            nrec += 1;
+    rec = (int *)getMem((4 * nrec + 8 * gCols + 1) * sizeof (int),
+                        "patch records");
+    pair = rec + 3 * nrec;
+    edge = pair + 6 * gCols;
+    fin = edge + 2 * gCols;
+    nrec = 0;
+    for (k=0; k<nroot; k+=1)  {
+        i = roots[k];
+        if (mark[i] & PATCH_EDGE)  {
+            rec[3*nrec] = base + i;
+            rec[3*nrec+1] = size[i];
+            rec[3*nrec+2] = mark[i] & PATCH_OLD;
+            size[i] = nrec++;
+            continue;
+        }
+        sum[0] += 1.0;
+        if (!(mark[i] & PATCH_OLD))
+            sum[1] += 1.0;
+        if (size[i] > largest)
+            largest = size[i];
+    }
+
+    /* pieces touching the first row of the rank below */
+    for (j=0; j<gCols; j+=1)  {
+        i = elements - gCols + j;
+        edge[j] = (l[j] < 0) ? -1 : base + l[j];
+        edge[gCols+j] = (l[i] < 0) ? -1 : base + l[i];
+    }
+    shareRows(l-gCols, l+elements, edge, edge+gCols, gCols, MPI_INT);
+    npair = 0;
+    if (bottom)
+        for (j=0; j<gCols; j+=1)  {
+            if ((k = edge[gCols+j]) < 0)
+                continue;
+            for (dc=-1; dc<=1; dc+=1)  {
+                if (j + dc < 0 || j + dc >= gCols)
+                    continue;
+                g = l[elements + j + dc];
+                if (g < 0 || (npair > 0 && pair[2*npair-2] == k &&
+                              pair[2*npair-1] == g))
+                    continue;
+                pair[2*npair] = k;
+                pair[2*npair+1] = g;
+                npair += 1;
+            }
+        }
+
+    PERFstart(PERF_COLLECTIVE);
+    join(rec, nrec, pair, npair, fin, sum, &largest);
+    PERFstop(PERF_COLLECTIVE);
+
+    /* global labels, the pieces take their patch's */
+    if (base > 0 || nrec > 0)
+        for (i=0; i<elements; i+=1)  {
+            if ((k = l[i]) < 0)
+                continue;
+            l[i] = (mark[k] & PATCH_EDGE) ? fin[size[k]] : base + k;
+        }
+    freeMem(rec);
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(sum, gsum, 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&largest, &glargest, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    gsum[4] = glargest;
+    MPI_Bcast(gsum, 5, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    s->patches = (int)gsum[0];
+    s->newpatches = (int)gsum[1];
+    s->cells = gsum[2];
+    s->edges = gsum[3];
+    s->largest = (int)gsum[4];
+    PERFcount(PERF_CELLS, elements);
+    PERFstop(PERF_PATCH);
+}
+
+/* Print the metrics of n years, areas in hectares and lengths in the
+** units of cellsize (meters).  Edges along the grid's border don't
+** count, the landscape is the whole grid.
+*/
+void PATCHreport(PATCH_STATS *s, int n, float cellsize)
+{
+    int i;
+    double ha = cellsize * cellsize / 10000.0;
+
+    printf("%6s %9s %9s %12s %12s %12s\n", "Year", "Patches", "New",
+           "Mean (ha)", "Edge (m/ha)", "Largest (%)");
+    for (i=0; i<n; i+=1)
+        printf("%6d %9d %9d %12.2f %12.2f %12.3f\n", s[i].year,
+               s[i].patches, s[i].newpatches,
+               (s[i].patches > 0) ? s[i].cells * ha / s[i].patches : 0.0,
+               s[i].edges * cellsize / (gElements * ha),
+               100.0 * s[i].largest / gElements);
+}
@@ -0,0 +1,35 @@
+/* patch.c header file
+**
+** Connected patches of a set of land use classes, labelled across the
+** row strips, and the landscape metrics calibration judges realism by.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef PATCH_H
+#define PATCH_H
+
+typedef struct {
+    int    year;
+    int    patches;                 /* patches of the classes */
+    int    newpatches;              /* patches without a cell of the start */
+    int    largest;                 /* cells of the largest patch */
+    double cells;                   /* cells of the classes */
+    double edges;                   /* cell sides between them and others */
+} PATCH_STATS;
+
+typedef struct {
+    LU_FLAG flags;                  /* classes labelled */
+    int   *label;                   /* global index of the patch's first
+                                       cell, -1 off the classes */
+    int   *size;                    /* work space, per local root */
+    int   *roots;                   /* work space, the local roots */
+    unsigned char *mark;            /* work space, per local root */
+} PATCH_T;
+
+extern PATCH_T *PATCHinit(LU_FLAG flags);
+extern void PATCHlabel(PATCH_T *p, unsigned char *lu, unsigned char *change,
+                       PATCH_STATS *s);
+extern void PATCHreport(PATCH_STATS *s, int n, float cellsize);
+
+#endif
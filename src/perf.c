@@ -0,0 +1,204 @@
+/*
+** Performance instrumentation.  The main phases of LUCrun and the
+** spatial kernels are bracketed with PERFstart/PERFstop and count the
+** work they do with PERFcount.  Everything is local until PERFyear or
+** PERFreport, which reduce the values to min/mean/max across ranks so
+** load imbalance shows up directly.
+**
+** PERFyear appends one JSON object per model year to the PERF_LOG
+** file, PERFreport prints a table of the whole run under --timing.
+**
+** Timers are only kept by the main thread (MPI_Wtime), counters can
+** be bumped from the probmap prefetch thread.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "perf.h"
+
+#define PERF_DEPTH  8
+#define PERF_VALUES (PERF_PHASES + PERF_COUNTERS)
+
+static char *phasenames[PERF_PHASES] = {
+    "neighbors", "diffusion", "probmap", "random", "probability",
+    "weights", "develop", "collectives", "halo", "read", "write",
+    "distance", "smoothing", "patches", "scoring",
+};
+
+static char *counternames[PERF_COUNTERS] = {
+    "cells", "bisections", "bytes_exchanged", "bytes_read", "bytes_written",
+    "static_fills",
+};
+
+static int perfon = 0, logging = 0;
+static double phasetime[PERF_PHASES];
+static long counters[PERF_COUNTERS];
+static double lastyear[PERF_VALUES];
+static int stack[PERF_DEPTH], depth = 0;
+static double mark;
+static pthread_t mainthread;
+static FILE *perflog = NULL;
+
+
+/* Turn on instrumentation.  logname (may be NULL) receives the per
+** year JSON records on rank 0.
+*/
+void PERFinit(int on, char *logname)
+{
+    perfon = on || logname != NULL;
+    logging = logname != NULL;
+    mainthread = pthread_self();
+
+    if (myrank == 0 && logname != NULL)  {
+        if ((perflog = fopen(logname, "w")) == NULL)  {
+            sprintf(estring, "Unable to open PERF_LOG %s", logname);
+            errorExit(estring);
+        }
+    }
+}
+
+/* Start a phase, the enclosing phase (if any) is paused.
+*/
+void PERFstart(int phase)
+{
+    double now;
+
+    if (!perfon || !pthread_equal(pthread_self(), mainthread))
+        return;
+
+    now = MPI_Wtime();
+    if (depth > 0)
+        phasetime[stack[depth-1]] += now - mark;
+    if (depth < PERF_DEPTH)
+        stack[depth] = phase;
+    depth += 1;
+    mark = now;
+}
+
+/* End a phase and resume the enclosing one.
+*/
+void PERFstop(int phase)
+{
+    double now;
+
+    if (!perfon || !pthread_equal(pthread_self(), mainthread))
+        return;
+
+    now = MPI_Wtime();
+    if (depth > 0 && depth <= PERF_DEPTH)
+        phasetime[stack[depth-1]] += now - mark;
+    if (depth > 0)
+        depth -= 1;
+    mark = now;
+}
+
+void PERFcount(int counter, long n)
+{
+    if (perfon)
+        __sync_fetch_and_add(counters + counter, n);
+}
+
+/* Reduce vals to min/mean/max on rank 0 (all ranks must call).
+*/
+static void reduceValues(double *vals, double *vmin, double *vmean,
+                         double *vmax)
+{
+    int i;
+
+    MPI_Reduce(vals, vmin, PERF_VALUES, MPI_DOUBLE, MPI_MIN, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(vals, vmax, PERF_VALUES, MPI_DOUBLE, MPI_MAX, 0,
+               MPI_COMM_WORLD);
+    MPI_Reduce(vals, vmean, PERF_VALUES, MPI_DOUBLE, MPI_SUM, 0,
+               MPI_COMM_WORLD);
+    for (i=0; i<PERF_VALUES; i+=1)
+        vmean[i] /= nproc;
+}
+
+static void currentValues(double *vals)
+{
+    int i;
+
+    for (i=0; i<PERF_PHASES; i+=1)
+        vals[i] = phasetime[i];
+    for (i=0; i<PERF_COUNTERS; i+=1)
+        vals[PERF_PHASES+i] = counters[i];
+}
+
+/* Write the work done since the last call as one JSON record.
+** Collective when a PERF_LOG is given, otherwise a no-op.
+*/
+void PERFyear(int year)
+{
+    double vals[PERF_VALUES], vmin[PERF_VALUES];
+    double vmean[PERF_VALUES], vmax[PERF_VALUES];
+    char *name;
+    int i;
+
+    if (!logging)
+        return;
+
+    currentValues(vals);
+    for (i=0; i<PERF_VALUES; i+=1)  {
+        vmin[i] = vals[i];
+        vals[i] -= lastyear[i];
+        lastyear[i] = vmin[i];
+    }
+
+    reduceValues(vals, vmin, vmean, vmax);
+    if (myrank != 0)
+        return;
+
+    fprintf(perflog, "{\"year\": %d, \"ranks\": %d", year, nproc);
+    for (i=0; i<PERF_VALUES; i+=1)  {
+        name = (i < PERF_PHASES) ? phasenames[i]
+                                 : counternames[i-PERF_PHASES];
+        fprintf(perflog, ", \"%s\": {\"min\": %.6g, \"mean\": %.6g, "
+                "\"max\": %.6g}", name, vmin[i], vmean[i], vmax[i]);
+    }
+    fprintf(perflog, "}\n");
+    fflush(perflog);
+}
+
+/* Print the totals for the run.  Must be called by all ranks.
+*/
+void PERFreport()
+{
+    double vals[PERF_VALUES], vmin[PERF_VALUES];
+    double vmean[PERF_VALUES], vmax[PERF_VALUES];
+    int i;
+
+    if (!perfon)
+        return;
+
+    currentValues(vals);
+    reduceValues(vals, vmin, vmean, vmax);
+
+    if (perflog != NULL)
+        fclose(perflog);
+    perflog = NULL;
+
+    if (myrank != 0)
+        return;
+
+    printf("\n===== Phase Information ======\n");
+    printf("%-16s %12s %12s %12s %9s\n", "phase (s)", "min", "mean",
+           "max", "max/mean");
+    for (i=0; i<PERF_PHASES; i+=1)
+        printf("%-16s %12.4f %12.4f %12.4f %9.2f\n", phasenames[i],
+               vmin[i], vmean[i], vmax[i],
+               (vmean[i] > 0.0) ? vmax[i] / vmean[i] : 1.0);
+
+    printf("%-16s %12s %12s %12s %9s\n", "counter", "min", "mean",
+           "max", "max/mean");
+    for (i=PERF_PHASES; i<PERF_VALUES; i+=1)
+        printf("%-16s %12.0f %12.0f %12.0f %9.2f\n",
+               counternames[i-PERF_PHASES], vmin[i], vmean[i], vmax[i],
+               (vmean[i] > 0.0) ? vmax[i] / vmean[i] : 1.0);
+    fflush(stdout);
+}
@@ -0,0 +1,47 @@
+/* perf.c header file
+**
+** Low overhead phase timers and event counters.  Phases nest, the
+** time spent in an inner phase is not charged to the outer one, so the
+** phase times of a rank add up to the time spent inside PERF phases.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef PERF_H
+#define PERF_H
+
+/* phases */
+#define PERF_NEIGHBORS   0
+#define PERF_DIFFUSION   1
+#define PERF_PROBMAP     2
+#define PERF_RANDOM      3
+#define PERF_PROB        4
+#define PERF_WEIGHT      5
+#define PERF_DEVELOP     6
+#define PERF_COLLECTIVE  7
+#define PERF_HALO        8
+#define PERF_READ        9
+#define PERF_WRITE      10
+#define PERF_DISTANCE   11
+#define PERF_SMOOTH     12
+#define PERF_PATCH      13
+#define PERF_SCORE      14
+#define PERF_PHASES     15
+
+/* counters */
+#define PERF_CELLS       0          /* cells visited by the kernels */
+#define PERF_BISECT      1          /* weight search evaluations */
+#define PERF_BYTES_MPI   2          /* bytes sent to other ranks */
+#define PERF_BYTES_READ  3
+#define PERF_BYTES_WRITE 4
+#define PERF_STATIC_FILLS 5         /* static probability terms computed */
+#define PERF_COUNTERS    6
+
+extern void PERFinit(int on, char *logname);
+extern void PERFstart(int phase);
+extern void PERFstop(int phase);
+extern void PERFcount(int counter, long n);
+extern void PERFyear(int year);
+extern void PERFreport();
+
+#endif
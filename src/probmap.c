@@ -0,0 +1,414 @@
+/*
+** Year specific probability maps.
+**
+** Historically every rank tried to fopen "name_YYYY.ext" each year to
+** see if a new probmap had been supplied and re-allocated and read
+** the grid synchronously when one was found.  Rank 0 now scans the
+** directory once at startup and broadcasts the list of keyframe
+** years.  Each probmap keeps a few grid buffers tagged with the
+** keyframe they hold: the ones in use and one that the next keyframe
+** is read into by a helper thread while the current year computes.
+** Reaching a new keyframe just changes which buffer is used.
+**
+** The map used for a year is the latest keyframe at or before that
+** year, so keyframes are no longer missed when TIMESTEP > 1.  With
+** PROBMAP_INTERP the keyframes bracketing the year are both kept
+** resident and blended linearly a block at a time by the probability
+** kernels (see PROBMAPblock), so upstream only needs to produce maps
+** for keyframe years.  The base map is taken to be the start year.
+**
+** A keyframe may also be a sparse delta "name_YYYY.dlt" (see delta.c)
+** against the previous keyframe.  Deltas are not prefetched, they
+** are applied in place to the buffer holding the previous keyframe
+** when it is no longer needed or to a copy of it otherwise.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "probmap.h"
+#include "delta.h"
+
+
+/* build the file name for a keyframe */
+static void keyName(PROBMAP_T *pm, int key, char *fname)
+{
+    char *ptr;
+
+    strcpy(fname, pm->name);
+    if (key == 0)
+        return;
+
+    if ((ptr = strrchr(fname, '.')) != NULL && strchr(ptr, '/') == NULL)
+        sprintf(ptr, "_%d%s", pm->years[key], 
+                pm->delta[key] ? DELTA_EXT : pm->name + (ptr - fname));
+    else
+        sprintf(fname + strlen(fname), "_%d%s", pm->years[key],
+                pm->delta[key] ? DELTA_EXT : "");
+}
+
+static int cmpYear(const void *a, const void *b)
+{
+    return *(int *)a - *(int *)b;
+}
+
+/* Find the keyframes "prefix_YYYY.ext" or "prefix_YYYY.dlt" at or
+** after stime by reading the directory.  Only run on rank 0.  Keys
+** are stored as 2 * year + 1 for deltas, 2 * year otherwise.  Returns
+** the number found which may be larger than max, if so call again.
+*/
+static int scanKeys(char *name, int stime, int *years, int max)
+{
+    DIR *d;
+    struct dirent *e;
+    char dir[256], prefix[256], *base, *ext;
+    int n = 0, year, len, plen;
+
+    strcpy(dir, name);
+    if ((base = strrchr(dir, '/')) != NULL)  {
+        *base++ = '\0';
+        strcpy(prefix, base);
+        base = dir;
+    }
+    else  {
+        strcpy(prefix, dir);
+        base = ".";
+    }
+
+    /* prefix is the file name without extension, ext includes the '.' */
+    if ((ext = strrchr(prefix, '.')) != NULL)  {
+        ext = name + strlen(name) - strlen(ext);
+        prefix[strlen(prefix) - strlen(ext)] = '\0';
+    }
+    else
+        ext = "";
+    plen = strlen(prefix);
+
+    if ((d = opendir(base)) == NULL)
+        return 0;
+
+    while ((e = readdir(d)) != NULL)  {
+        if (strncmp(e->d_name, prefix, plen) || e->d_name[plen] != '_')
+            continue;
+        if (sscanf(e->d_name + plen + 1, "%d%n", &year, &len) != 1)
+            continue;
+        if (year < stime)
+            continue;
+        if (!strcmp(e->d_name + plen + 1 + len, ext))
+            year = 2 * year;
+        else if (!strcmp(e->d_name + plen + 1 + len, DELTA_EXT))
+            year = 2 * year + 1;
+        else
+            continue;
+        if (n < max)
+            years[n] = year;
+        n += 1;
+    }
+    closedir(d);
+
+    return n;
+}
+
+/* read a keyframe file, full map or delta, into float grid g */
+static void readKey(PROBMAP_T *pm, float *g, int key)
+{
+    char fname[256];
+
+    keyName(pm, key, fname);
+    if (myrank == 0)
+        fprintf(stderr, "%s %s\n", pm->delta[key] ? "Applying" : "Reading",
+                fname);
+    if (pm->delta[key])
+        LUCapplyDelta(fname, (char *)g, sizeof (float));
+    else
+        LUCreadGridMap(fname, (char *)g, pm->count, sizeof (float));
+}
+
+/* float grid to work on q with, f32 grids are used directly */
+static float *floatGrid(PROBMAP_T *pm, QGRID_T *q, int decode)
+{
+    float *g;
+
+    if (q->mode == QUANT_F32)
+        return (float *)q->data;
+
+    g = (float *)initGridMap(NULL, pm->count, sizeof (float));
+    if (decode)
+        QGRIDget(q, g);
+    return g;
+}
+
+static void storeGrid(QGRID_T *q, float *g)
+{
+    if (g != (float *)q->data)  {
+        QGRIDset(q, g);
+        freeGridMap((char *)g, sizeof (float));
+    }
+}
+
+/* apply delta keyframe key to q which holds the previous keyframe */
+static void patchKey(PROBMAP_T *pm, QGRID_T *q, int key)
+{
+    float *g = floatGrid(pm, q, 1);
+
+    readKey(pm, g, key);
+    storeGrid(q, g);
+}
+
+/* load keyframe into q */
+static void loadKey(PROBMAP_T *pm, QGRID_T *q, int key)
+{
+    float *g;
+    int i;
+
+    /* a delta needs the previous keyframe, copy it if resident */
+    if (pm->delta[key])  {
+        for (i=0; i<pm->nbufs; i+=1)
+            if (pm->bkey[i] == key-1 && pm->buf[i] != q)
+                break;
+        if (i < pm->nbufs)
+            QGRIDcopy(q, pm->buf[i]);
+        else
+            loadKey(pm, q, key-1);
+        patchKey(pm, q, key);
+        return;
+    }
+
+    g = floatGrid(pm, q, 0);
+    if (key == 0 && !pm->hasbase)  {
+        for (i=-gCols; i<pm->count+gCols; i+=1)
+            g[i] = pm->def;
+    }
+    else
+        readKey(pm, g, key);
+    storeGrid(q, g);
+}
+
+static void *prefetch(void *arg)
+{
+    PROBMAP_T *pm = (PROBMAP_T *)arg;
+
+    loadKey(pm, pm->buf[pm->pbuf], pm->bkey[pm->pbuf]);
+    return NULL;
+}
+
+static void waitPrefetch(PROBMAP_T *pm)
+{
+    if (pm->pending)  {
+        pthread_join(pm->thread, NULL);
+        pm->pending = 0;
+    }
+}
+
+/* pick a buffer that is empty or doesn't hold k1 or k2 */
+static int spareBuf(PROBMAP_T *pm, int k1, int k2)
+{
+    int b;
+
+    for (b=0; b<pm->nbufs; b+=1)
+        if (pm->bkey[b] < 0)
+            return b;
+    for (b=0; b<pm->nbufs; b+=1)
+        if (pm->bkey[b] != k1 && pm->bkey[b] != k2)
+            return b;
+
+    errorExit("no spare probmap buffer");
+    return 0;
+}
+
+/* return the buffer holding key, reading it into a buffer not
+** holding keep if necessary.
+*/
+static QGRID_T *residentKey(PROBMAP_T *pm, int key, int keep)
+{
+    int b;
+
+    for (b=0; b<pm->nbufs; b+=1)
+        if (pm->bkey[b] == key)
+            return pm->buf[b];
+
+    /* patch the previous keyframe in place if it isn't needed */
+    if (pm->delta[key])
+        for (b=0; b<pm->nbufs; b+=1)
+            if (pm->bkey[b] == key-1 && key-1 != keep)  {
+                patchKey(pm, pm->buf[b], key);
+                pm->bkey[b] = key;
+                return pm->buf[b];
+            }
+
+    b = spareBuf(pm, keep, keep);
+    pm->bkey[b] = key;
+    loadKey(pm, pm->buf[b], key);
+    return pm->buf[b];
+}
+
+/* start reading key into a buffer not holding lokey or hikey */
+static void startPrefetch(PROBMAP_T *pm, int key, int lokey, int hikey)
+{
+    int b;
+
+    if (pm->delta[key])
+        return;
+
+    for (b=0; b<pm->nbufs; b+=1)
+        if (pm->bkey[b] == key)
+            return;
+    b = spareBuf(pm, lokey, hikey);
+
+    pm->pbuf = b;
+    pm->bkey[b] = key;
+    if (pthread_create(&pm->thread, NULL, prefetch, pm) == 0)
+        pm->pending = 1;
+    else
+        loadKey(pm, pm->buf[b], key);
+}
+
+
+/* Build the keyframe index for a probmap.  Only keyframes for years
+** >= stime are used.  If name is NULL or the base map doesn't exist
+** the grid defaults to def until the first keyframe.  If flags has
+** PROBMAP_CYCLE (GA runs) the first keyframe is prefetched again
+** after the last one so the next run starts without waiting.
+** Keyframes are stored with precision mode (see quant.c).
+*/
+PROBMAP_T *PROBMAPinit(char *name, int count, float def,
+                       int stime, int flags, int mode)
+{
+    PROBMAP_T *pm;
+    char fname[256];
+    int i, n = 0, max = 64, *years = NULL;
+
+    pm = (PROBMAP_T *)getMem(sizeof (PROBMAP_T), "probmap");
+    pm->name = (name != NULL) ? strdup(name) : NULL;
+    pm->count = count;
+    pm->def = def;
+    pm->flags = flags;
+    pm->start = stime;
+    pm->hasbase = 0;
+
+    if (myrank == 0 && name != NULL)  {
+        pm->hasbase = (access(name, R_OK) == 0);
+        do {
+            if (years != NULL) freeMem(years);
+            years = (int *)getMem((max+1) * sizeof (int), "probmap years");
+            n = scanKeys(name, stime, years+1, max);
+        } while (n > max && (max = n));
+        qsort(years+1, n, sizeof (int), cmpYear);
+
+        /* prefer a full map if there is also a delta for the year */
+        for (i=1, max=0; i<=n; i+=1)
+            if (max == 0 || years[i]/2 != years[max]/2)
+                years[++max] = years[i];
+        n = max;
+    }
+
+    MPI_Bcast(&pm->hasbase, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    pm->nkeys = n + 1;
+    if (myrank != 0 || years == NULL)
+        years = (int *)getMem(pm->nkeys * sizeof (int), "probmap years");
+    MPI_Bcast(years+1, n, MPI_INT, 0, MPI_COMM_WORLD);
+
+    pm->years = years;
+    pm->delta = (int *)getMem(pm->nkeys * sizeof (int), "probmap deltas");
+    for (i=1; i<pm->nkeys; i+=1)  {
+        pm->delta[i] = years[i] & 1;
+        years[i] /= 2;
+    }
+    years[0] = PROBMAP_BASE;
+
+    if (myrank == 0)  {
+        for (i=(pm->hasbase ? 0 : 1); i<pm->nkeys; i+=1)  {
+            keyName(pm, i, fname);
+            if (!pm->delta[i])
+                checkHeader(fname);
+        }
+        if (debug && name != NULL)  {
+            fprintf(stderr, "PROBMAPinit: %s, base=%d, interp=%d, %s, "
+                    "keyframes:", name, pm->hasbase, 
+                    (flags & PROBMAP_INTERP) != 0, QGRIDname(mode));
+            for (i=1; i<pm->nkeys; i+=1)
+                fprintf(stderr, " %d%s", pm->years[i], 
+                        pm->delta[i] ? DELTA_EXT : "");
+            fprintf(stderr, "\n");
+        }
+    }
+
+    /* one buffer per resident keyframe plus one being prefetched */
+    pm->nbufs = (flags & PROBMAP_INTERP) ? 3 : 2;
+    for (i=0; i<pm->nbufs; i+=1)  {
+        pm->buf[i] = QGRIDinit(count, mode);
+        pm->bkey[i] = -1;
+    }
+    pm->lo = pm->hi = pm->buf[0];
+    pm->frac = 0.0;
+    pm->maxerr = 0.0;
+    pm->firstkey = -1;
+    pm->pending = 0;
+
+    return pm;
+}
+
+/* Set up the grid(s) for year, the latest keyframe at or before the
+** year (the base map if year <= 0).  When interpolating, the following
+** keyframe and blend weight are also set for PROBMAPblock.
+*/
+void PROBMAPyear(PROBMAP_T *pm, int year)
+{
+    int key, hikey, nkey, y0;
+
+    for (key=pm->nkeys-1; key>0 && pm->years[key]>year; key-=1)
+        ;
+    if (year > 0 && pm->firstkey < 0)
+        pm->firstkey = key;
+    hikey = -1;
+    if (pm->flags & PROBMAP_INTERP && key+1 < pm->nkeys && year > 0 &&
+        (key > 0 || pm->hasbase))
+        hikey = key + 1;
+
+    waitPrefetch(pm);
+    pm->lo = residentKey(pm, key, hikey);
+    pm->hi = (hikey < 0) ? pm->lo : residentKey(pm, hikey, key);
+
+    pm->lokey = key;
+    pm->hikey = hikey;
+    pm->frac = 0.0;
+    if (hikey >= 0)  {
+        y0 = (key == 0) ? pm->start : pm->years[key];
+        if (year > y0 && pm->years[hikey] > y0)
+            pm->frac = (float)(year - y0) / (pm->years[hikey] - y0);
+    }
+
+    /* start reading the following keyframe */
+    nkey = ((hikey < 0) ? key : hikey) + 1;
+    if (nkey >= pm->nkeys)
+        nkey = (pm->flags & PROBMAP_CYCLE) ? pm->firstkey : -1;
+    if (nkey >= 0)
+        startPrefetch(pm, nkey, key, hikey);
+
+    if (debug && myrank == 0 && hikey >= 0)
+        fprintf(stderr, "PROBMAPyear: %s year %d, key %d->%d, frac = %f\n",
+                pm->name, year, key, hikey, pm->frac);
+
+    if (pm->lo->maxerr > pm->maxerr) pm->maxerr = pm->lo->maxerr;
+    if (pm->hi->maxerr > pm->maxerr) pm->maxerr = pm->hi->maxerr;
+}
+
+void PROBMAPfree(PROBMAP_T *pm)
+{
+    int i;
+
+    waitPrefetch(pm);
+    for (i=0; i<pm->nbufs; i+=1)
+        QGRIDfree(pm->buf[i]);
+    freeMem(pm->years);
+    freeMem(pm->delta);
+    if (pm->name != NULL) free(pm->name);
+    freeMem(pm);
+}
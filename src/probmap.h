@@ -0,0 +1,75 @@
+/*
+** Year specific probability maps.  A probmap named "prob.bil" may be
+** accompanied by keyframes "prob_YYYY.bil" (or deltas "prob_YYYY.dlt")
+** which take effect from year YYYY onwards.  The available keyframes are found once at
+** startup and the next keyframe is read in the background while
+** the model computes the current year.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef PROBMAP_H
+#define PROBMAP_H
+
+#include <pthread.h>
+#include "quant.h"
+
+#define PROBMAP_BASE   -1         /* year of the base (un-suffixed) map */
+
+/* PROBMAPinit flags */
+#define PROBMAP_CYCLE  1          /* prefetch first key after last key */
+#define PROBMAP_INTERP 2          /* blend between bracketing keyframes */
+
+#define PROBMAP_BUFS   3          /* resident + prefetch buffers */
+#define PROBMAP_BLOCK  QUANT_BLOCK          /* cells per PROBMAPblock */
+#define PROBMAP_SCRATCH (2 * PROBMAP_BLOCK) /* floats of caller scratch */
+
+typedef struct {
+    char  *name;                  /* base file name, may be NULL */
+    int   count;                  /* active elements in grid */
+    float def;                    /* value used when no base map */
+    int   flags;
+    int   start;                  /* year of the base map */
+    int   nkeys, *years;          /* keyframes, years[0] is the base */
+    int   *delta;                 /* keyframe is a delta on the previous */
+    int   hasbase;                /* base map exists */
+    int   firstkey;               /* first keyframe requested */
+    int   nbufs;
+    QGRID_T *buf[PROBMAP_BUFS];   /* grid buffers */
+    int   bkey[PROBMAP_BUFS];     /* keyframe held in buffer or -1 */
+    QGRID_T *lo, *hi;             /* bracketing keyframes for year */
+    int   lokey, hikey;           /* and their keys, -1 before first year */
+    float frac;                   /* blend weight of hi */
+    float maxerr;                 /* largest quantization error seen */
+    int   pending, pbuf;          /* buffer being read by thread */
+    pthread_t thread;
+} PROBMAP_T;
+
+extern PROBMAP_T *PROBMAPinit(char *name, int count, float def,
+                              int stime, int flags, int mode);
+extern void PROBMAPyear(PROBMAP_T *pm, int year);
+extern void PROBMAPfree(PROBMAP_T *pm);
+
+
+/* Return the probmap values of cells [i, i+n), n <= PROBMAP_BLOCK,
+** decoded and blended as needed using the caller's scratch buffer
+** (PROBMAP_SCRATCH floats).  For full precision maps without
+** interpolation the resident grid is returned.
+*/
+static inline const float *PROBMAPblock(PROBMAP_T *pm, int i, int n,
+                                        float *blk)
+{
+    const float *lo, *hi;
+    float t = pm->frac;
+    int j;
+
+    lo = QGRIDblock(pm->lo, i, n, blk);
+    if (t == 0.0f)
+        return lo;
+
+    hi = QGRIDblock(pm->hi, i, n, blk + PROBMAP_BLOCK);
+    for (j=0; j<n; j+=1)
+        blk[j] = lo[j] + t * (hi[j] - lo[j]);
+    return blk;
+}
+#endif
@@ -0,0 +1,220 @@
+/*
+** Reduced precision storage for static float grids.
+**
+** Probability and density maps are read once (or once per keyframe)
+** but streamed through the kernels many times a year, so storing
+** them with 16 or 8 bits cuts the memory traffic of those passes.
+** Modes are:
+**
+**   f32   plain floats, QGRIDblock returns the grid itself
+**   f16   IEEE half floats
+**   u16   affine codes 0..65534 spanning the valid range
+**   u8    affine codes 0..254 spanning the valid range
+**
+** Values <= MIN_DENSITY are nodata.  For the affine modes the top
+** code is reserved for them and decodes to the first nodata value
+** seen, half floats keep them (or -inf) which still reads as nodata.
+** The range is that of the local cells so no communication is needed
+** and grids can be (re)quantized by the probmap prefetch thread.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "quant.h"
+#include "arena.h"
+
+static const char *modeNames[] = { "f32", "f16", "u16", "u8" };
+
+
+/* float to half float, round to nearest even */
+static unsigned short floatToHalf(float x)
+{
+    union { unsigned u; float f; } f, infty, f16max, denorm;
+    unsigned sign, odd;
+    unsigned short o;
+
+    infty.u = 255 << 23;
+    f16max.u = (127 + 16) << 23;
+    denorm.u = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    f.f = x;
+    sign = f.u & 0x80000000u;
+    f.u ^= sign;
+
+    if (f.u >= f16max.u)                       /* overflow, inf or nan */
+        o = (f.u > infty.u) ? 0x7e00 : 0x7c00;
+    else if (f.u < (113 << 23))  {             /* denormal or zero */
+        f.f += denorm.f;
+        o = f.u - denorm.u;
+    }
+    else  {
+        odd = (f.u >> 13) & 1;
+        f.u += ((unsigned)(15 - 127) << 23) + 0xfff + odd;
+        o = f.u >> 13;
+    }
+
+    return o | (sign >> 16);
+}
+
+
+int QGRIDmode(char *name)
+{
+    int i;
+
+    if (name == NULL)
+        return QUANT_F32;
+
+    for (i=0; i<sizeof modeNames / sizeof (char *); i+=1)
+        if (!strcasecmp(name, modeNames[i]))
+            return i;
+
+    sprintf(estring, "unknown grid precision '%s'", name);
+    errorExit(estring);
+    return QUANT_F32;
+}
+
+const char *QGRIDname(int mode)
+{
+    return modeNames[mode];
+}
+
+
+QGRID_T *QGRIDinit(int count, int mode)
+{
+    QGRID_T *q;
+
+    q = (QGRID_T *)getMem(sizeof (QGRID_T), "quantized grid");
+    q->mode = mode;
+    q->count = count;
+    q->scale = 0.0;
+    q->offset = 0.0;
+    q->nodata = MIN_DENSITY;
+    q->maxerr = 0.0;
+
+    switch (mode)  {
+    case QUANT_F16:
+    case QUANT_U16:
+        q->data = ARENAalloc(0, count * sizeof (short), "quantized grid data");
+        break;
+    case QUANT_U8:
+        q->data = ARENAalloc(0, count, "quantized grid data");
+        break;
+    default:
+        q->data = initGridMap(NULL, count, sizeof (float));
+        break;
+    }
+
+    return q;
+}
+
+/* Store the active cells of src in q and track the largest error */
+void QGRIDset(QGRID_T *q, const float *src)
+{
+    int i, levels, nodata = 0, valid = 0;
+    unsigned code;
+    float min = 0.0, max = 0.0, v, err;
+    unsigned short *s = (unsigned short *)q->data;
+    unsigned char *c = (unsigned char *)q->data;
+
+    q->maxerr = 0.0;
+
+    switch (q->mode)  {
+    case QUANT_F16:
+        for (i=0; i<q->count; i+=1)  {
+            s[i] = floatToHalf(src[i]);
+            if (src[i] > MIN_DENSITY)  {
+                err = fabsf(QhalfToFloat(s[i]) - src[i]);
+                if (err > q->maxerr) q->maxerr = err;
+            }
+        }
+        break;
+
+    case QUANT_U16:
+    case QUANT_U8:
+        levels = (q->mode == QUANT_U8) ? 0xfe : 0xfffe;
+
+        /* range of the valid cells */
+        for (i=0; i<q->count; i+=1)  {
+            if (src[i] <= MIN_DENSITY)  {
+                if (!nodata++) q->nodata = src[i];
+            }
+            else if (!valid++)
+                min = max = src[i];
+            else if (src[i] < min)
+                min = src[i];
+            else if (src[i] > max)
+                max = src[i];
+        }
+        q->offset = min;
+        q->scale = (max - min) / levels;
+
+        for (i=0; i<q->count; i+=1)  {
+            if (src[i] <= MIN_DENSITY)
+                code = levels + 1;
+            else if (q->scale == 0.0)
+                code = 0;
+            else  {
+                v = rintf((src[i] - min) / q->scale);
+                code = (v > levels) ? levels : (unsigned)v;
+            }
+
+            if (q->mode == QUANT_U8)
+                c[i] = code;
+            else
+                s[i] = code;
+
+            if (code <= levels)  {
+                err = fabsf(q->offset + q->scale * code - src[i]);
+                if (err > q->maxerr) q->maxerr = err;
+            }
+        }
+        break;
+
+    default:
+        memcpy(q->data, src, q->count * sizeof (float));
+        break;
+    }
+}
+
+/* decode all the cells of q into dst */
+void QGRIDget(QGRID_T *q, float *dst)
+{
+    int i, n;
+    const float *p;
+
+    for (i=0; i<q->count; i+=QUANT_BLOCK)  {
+        n = (q->count - i < QUANT_BLOCK) ? q->count - i : QUANT_BLOCK;
+        p = QGRIDblock(q, i, n, dst + i);
+        if (p != dst + i)
+            memcpy(dst + i, p, n * sizeof (float));
+    }
+}
+
+/* copy src to dst, both must have the same mode and size */
+void QGRIDcopy(QGRID_T *dst, QGRID_T *src)
+{
+    static const int size[] = { sizeof (float), sizeof (short),
+                                sizeof (short), 1 };
+
+    memcpy(dst->data, src->data, src->count * size[src->mode]);
+    dst->scale = src->scale;
+    dst->offset = src->offset;
+    dst->nodata = src->nodata;
+    dst->maxerr = src->maxerr;
+}
+
+void QGRIDfree(QGRID_T *q)
+{
+    if (q->mode == QUANT_F32)
+        freeGridMap((char *)q->data, sizeof (float));
+    else
+        ARENAfree(q->data, 0);
+    freeMem(q);
+}
@@ -0,0 +1,94 @@
+/* quant.c header file
+**
+** Reduced precision storage for static float grids.  A QGRID holds
+** the active cells of a grid as 32-bit floats, IEEE half floats or
+** affine quantized 16 or 8-bit codes.  Values are decoded a block at
+** a time inside the kernels with QGRIDblock.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef QUANT_H
+#define QUANT_H
+
+#define QUANT_F32  0
+#define QUANT_F16  1
+#define QUANT_U16  2
+#define QUANT_U8   3
+
+#define QUANT_BLOCK  256          /* cells decoded per QGRIDblock */
+
+typedef struct {
+    int   mode, count;
+    void  *data;              /* count cells, f32 is an initGridMap grid */
+    float scale, offset;      /* affine codes: v = offset + scale * code */
+    float nodata;             /* value of the reserved top code */
+    float maxerr;             /* largest quantization error */
+} QGRID_T;
+
+extern int QGRIDmode(char *name);
+extern const char *QGRIDname(int mode);
+extern QGRID_T *QGRIDinit(int count, int mode);
+extern void QGRIDset(QGRID_T *q, const float *src);
+extern void QGRIDget(QGRID_T *q, float *dst);
+extern void QGRIDcopy(QGRID_T *dst, QGRID_T *src);
+extern void QGRIDfree(QGRID_T *q);
+
+
+/* half float to float, handles denormals, inf and nan */
+static inline float QhalfToFloat(unsigned short h)
+{
+    union { unsigned u; float f; } o, magic;
+    unsigned exp;
+
+    magic.u = 113 << 23;
+    o.u = (unsigned)(h & 0x7fff) << 13;
+    exp = o.u & (0x7c00 << 13);
+    o.u += (127 - 15) << 23;
+    if (exp == (0x7c00 << 13))
+        o.u += (128 - 16) << 23;
+    else if (exp == 0)  {
+        o.u += 1 << 23;
+        o.f -= magic.f;
+    }
+    o.u |= (unsigned)(h & 0x8000) << 16;
+    return o.f;
+}
+
+/* Return the values of cells [i, i+n) either directly from the grid
+** (f32) or decoded into the caller's block buffer.
+*/
+static inline const float *QGRIDblock(const QGRID_T *q, int i, int n,
+                                      float *restrict blk)
+{
+    const unsigned short *restrict s;
+    const unsigned char *restrict c;
+    float scale = q->scale, offset = q->offset;
+    int j;
+
+    switch (q->mode)  {
+    case QUANT_F16:
+        s = (const unsigned short *)q->data + i;
+        for (j=0; j<n; j+=1)
+            blk[j] = QhalfToFloat(s[j]);
+        break;
+
+    case QUANT_U16:
+        s = (const unsigned short *)q->data + i;
+        for (j=0; j<n; j+=1)
+            blk[j] = (s[j] == 0xffff) ? q->nodata : offset + scale * s[j];
+        break;
+
+    case QUANT_U8:
+        c = (const unsigned char *)q->data + i;
+        for (j=0; j<n; j+=1)
+            blk[j] = (c[j] == 0xff) ? q->nodata : offset + scale * c[j];
+        break;
+
+    default:
+        return (const float *)q->data + i;
+    }
+
+    return blk;
+}
+#endif
@@ -0,0 +1,58 @@
+/*
+** Deterministic execution mode (DETERMINISTIC or --deterministic).
+**
+** With the mode on the outputs are bitwise identical for any number
+** of ranks.  The model's random numbers come from REPROdraw, a hash of
+** the seed, the global cell index, the iteration and the stream, so
+** a cell sees the same draws whichever rank owns it.  The float sums
+** that steer the model (development totals, the weight search) are
+** accumulated with REPROadd and combined exactly by REPROtotal.
+**
+** The seed is RANDOM_SEED (default 0) or the clock with --random,
+** rank 0's value is used everywhere.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "repro.h"
+#include "perf.h"
+
+int repro = 0;
+unsigned long long reproseed = 0;
+
+
+void REPROinit(int on, long seed)
+{
+    repro = on;
+
+    MPI_Bcast(&seed, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    reproseed = (unsigned long long)seed * 0xbf58476d1ce4e5b9ULL;
+
+    if (repro && myrank == 0)
+        fprintf(stderr, "Deterministic mode, seed = %ld\n", seed);
+}
+
+/* Combine the partial sums of all ranks, returns the global total on
+** every rank.  Must be called by all ranks.
+*/
+double REPROtotal(REPRO_SUM *s)
+{
+    long long part[2], total[2];
+
+    part[0] = s->whole;
+    part[1] = s->frac;
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(part, total, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Bcast(total, 2, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    /* carry the fraction into the whole part before converting */
+    total[0] += total[1] >> 32;
+    total[1] &= 0xffffffffLL;
+    return (double)total[0] + total[1] / REPRO_FRAC;
+}
@@ -0,0 +1,63 @@
+/* repro.c header file
+**
+** Deterministic execution mode.  Random draws are keyed on the global
+** cell index, the iteration and a stream id instead of being taken
+** from drand48 in storage order, and float reductions are carried out
+** in fixed point so the result doesn't depend on how the cells are
+** split between ranks (or threads) or the order the partials arrive.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef REPRO_H
+#define REPRO_H
+
+#include <math.h>
+
+/* draw streams, one per use of random numbers in a model year */
+#define REPRO_RANDOM     1          /* the development dice (ranvals) */
+#define REPRO_SPONT_RES  2          /* spontaneous growth terms */
+#define REPRO_SPONT_COM  3
+#define REPRO_SPONT_OS   4
+
+/* Exact sum of doubles as a whole part plus a fraction in units of
+** 2^-32.  Both parts add as integers so the total is independent of
+** order.  Resolution is 2^-32, good for up to 2^31 terms.
+*/
+#define REPRO_FRAC  4294967296.0
+
+typedef struct {
+    long long whole;
+    long long frac;
+} REPRO_SUM;
+
+extern int repro;
+extern unsigned long long reproseed;
+
+extern void REPROinit(int on, long seed);
+extern double REPROtotal(REPRO_SUM *s);
+
+
+/* uniform [0,1) float for a global cell, stream and iteration */
+static inline float REPROdraw(long cell, int stream, int itr)
+{
+    unsigned long long z;
+
+    z = reproseed + (unsigned long long)cell * 0x9e3779b97f4a7c15ULL
+        + ((unsigned long long)stream << 32 | (unsigned)itr)
+          * 0xd1b54a32d192ed03ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 40) * (1.0f / 16777216.0f);
+}
+
+static inline void REPROadd(REPRO_SUM *s, double x)
+{
+    double w = floor(x);
+
+    s->whole += (long long)w;
+    s->frac += (long long)((x - w) * REPRO_FRAC);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Strong and weak scaling runs of gluc on synthetic projects built by
+# mkscenario.  Run from the source directory after make gluc mkscenario.
+#
+#   ./scaling.sh [-n "1 2 4 8"] [-r rows] [-c cols] [-y start,end]
+#                [-w workdir] [-m mpirun] [-T seconds]
+#
+# Strong scaling keeps the grid at rows x cols for every rank count,
+# weak scaling gives each rank rows x cols cells (the grid grows by
+# rows).  For each run the wallclock and the mean and max time of each
+# phase (from --timing) are collected, the summary reports
+#
+#   strong efficiency  T(1) / (N * T(N))
+#   weak efficiency    T(1) / T(N)
+#
+# relative to the smallest rank count.  Raw output and the PERF_LOG of
+# each run are left in workdir.
+#
+# Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+
+ranks="1 2 4 8"
+rows=1000
+cols=1000
+years=2000,2010
+work=/tmp/gluc-scaling
+mpirun=${MPIRUN:-mpirun}
+limit=1800
+bin=`pwd`
+
+while [ $# -gt 0 ]; do
+    case $1 in
+    -n) ranks=$2; shift ;;
+    -r) rows=$2; shift ;;
+    -c) cols=$2; shift ;;
+    -y) years=$2; shift ;;
+    -w) work=$2; shift ;;
+    -m) mpirun=$2; shift ;;
+    -T) limit=$2; shift ;;
+    *)  sed -n '3,8s/^# \{0,1\}//p' $0; exit 1 ;;
+    esac
+    shift
+done
+
+[ -x $bin/gluc -a -x $bin/mkscenario ] || {
+    echo "scaling.sh: build gluc and mkscenario first" >&2; exit 1; }
+mkdir -p $work || exit 1
+
+# run <mode> <ranks> <rows>: one timed run, appends a line to results
+run()
+{
+    dir=$work/$3x$cols
+    [ -f $dir/scenario.cfg ] || $bin/mkscenario -r $3 -c $cols -y $years \
+        $dir > /dev/null || exit 1
+
+    log=$work/$1-np$2.log
+    (cd $dir && rm -f out_* && timeout $limit $mpirun -np $2 $bin/gluc \
+        -ci scenario.cfg --timing --PERF_LOG=$work/$1-np$2.json) > $log 2>&1
+    rc=$?
+
+    awk -v mode=$1 -v np=$2 -v rows=$3 -v cols=$cols -v rc=$rc '
+        /run complete, wallclock time/ { wall = $NF }
+        /^phase \(s\)/ { inphase = 1; next }
+        /^counter/ { inphase = 0 }
+        inphase && NF == 5 { phases = phases " " $1 "=" $3 "/" $4 }
+        END {
+            if (rc != 0 || wall == "")
+                printf "%s %d %d %d FAILED(rc=%d)\n", mode, np, rows, cols, rc
+            else
+                printf "%s %d %d %d %s%s\n", mode, np, rows, cols, wall, phases
+        }' $log >> $work/results
+}
+
+rm -f $work/results
+for n in $ranks; do
+    run strong $n $rows
+    run weak $n `expr $rows \* $n`
+done
+
+# summary, efficiencies are relative to the first rank count of a mode
+awk '
+    $5 ~ /FAILED/ {
+        printf "%-6s %5d %7dx%-7d %s\n", $1, $2, $3, $4, $5; next }
+    {
+        if (!($1 in t0))  { t0[$1] = $5; n0[$1] = $2 }
+        eff = ($1 == "strong") ? t0[$1] * n0[$1] / ($2 * $5) : t0[$1] / $5
+        printf "%-6s %5d %7dx%-7d %10.3f %8.1f%%\n", $1, $2, $3, $4, $5,
+               100.0 * eff
+        for (i=6; i<=NF; i+=1)  {
+            split($i, kv, "=");  split(kv[2], mm, "/")
+            if (mm[2] > 0.05 * $5)
+                printf "         %-12s mean %8.3f  max %8.3f  max/mean %5.2f\n",
+                       kv[1], mm[1], mm[2], (mm[1] > 0) ? mm[2] / mm[1] : 1
+        }
+    }
+    BEGIN {
+        printf "%-6s %5s %15s %10s %9s\n", "mode", "ranks", "grid",
+               "wall (s)", "eff"
+    }' $work/results
@@ -1,15 +1,24 @@
 /*
-** This module was used provided a mechanism to  score the model resultsi
-** as part of an experiment using genetic algorithms to assign model weights.
-** It should be removed at this point.
+** This module scores the model results for calibration of the model
+** weights with a genetic algorithm (see GA.c): counts of new residential
+** cells per reference zone, and the accuracy engine below comparing the
+** land use with a reference land use map.
 **
 ** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <mpi.h>
 
 #include "leam.h"
+#include "GA.h"
+#include "score.h"
+#include "perf.h"
+
+extern int srow, erow, elements;
+
+static int accuracy = 0;            // the accuracy fit goes to the GA
 
 /*
 ** Simple routine for reading in reference counts
@@ -126,7 +135,7 @@ double scoreSumErrSquared(int *ref, int *totals, int *active, int len)
     if (debug && myrank == 0)
         fprintf(stderr, "SumErrSquared: Score = %f\n", sum);
 
-    if (myrank == 0 && SMEgetFileName("GA_ENGINE") != NULL)
+    if (myrank == 0 && SMEgetFileName("GA_ENGINE") != NULL && !accuracy)
         GAsendFit(sum);
 
     return sum;
@@ -146,7 +155,8 @@ double scoreSumErrSquared(int *ref, int *totals, int *active, int len)
 double scoreResults(int *refcounts, int reflen, int *refmap, 
                   unsigned char *lu, int count)
 {
-    int *totals, *active;
+    int *totals;
+    static int *active = NULL, activelen = 0;
     double score;
 
     /* if no reference map given return without scoring */
@@ -156,8 +166,14 @@ double scoreResults(int *refcounts, int reflen, int *refmap,
     if (debug && myrank == 0)
         fprintf(stderr, "Scoring results, reflen = %d\n", reflen);
 
-    active = (int *)getMem(reflen * sizeof (int), "active zones");
-    spatialHistogram(active, reflen, refmap, count);
+    /* the zones don't change, their histogram is kept across runs */
+    if (active == NULL || activelen != reflen)  {
+        if (active != NULL)
+            freeMem(active);
+        active = (int *)getMem(reflen * sizeof (int), "active zones");
+        spatialHistogram(active, reflen, refmap, count);
+        activelen = reflen;
+    }
 
     totals = (int *)getMem(reflen * sizeof (int), "score totals array");
     spatialCorrelatedCount(totals, reflen, refmap, lu, count, LU_LRES);
@@ -169,7 +185,371 @@ double scoreResults(int *refcounts, int reflen, int *refmap,
     */
     score = scoreSumErrSquared(refcounts, totals, active, reflen);
 
-    free(totals);
-    free(active);
+    freeMem(totals);
     return score;
 }
+
+
+/*
+** The accuracy engine compares the simulated land use with a reference
+** land use map (REFERENCE_LU_MAP), by the classes of accnames:
+**   kappa       -- cell by cell agreement beyond chance
+**   fom         -- figure of merit of the change from the start map,
+**                  hits / (misses + hits + wrong hits + false alarms)
+**   agreement   -- share of the cells matched within windows of 1, 2,
+**                  4, .. cells, sum over the windows and classes of
+**                  the smaller of the two counts
+**   zone errors -- simulated less reference cells of every class in
+**                  each zone of REFERENCE_MAP
+**
+** The windows are aggregation pyramids of the simulated less reference
+** counts of a window, each level adding four windows of the one below.
+** A rank does the windows starting in its rows, the rows they reach
+** below come from the next rank (the reference ones once).  One pass
+** over the rows adds a table of start, simulated and reference class,
+** which holds kappa and the figure of merit, the zone counts and the
+** pyramid errors into one array reduced once.  The reference zone
+** counts don't change and are kept from scoreAccuracyInit.
+*/
+
+static char *accnames[ACC_CLASSES] = {
+    "other", "water", "res", "com", "road", "os", "wetland"
+};
+static unsigned char accclass[256];
+static unsigned char *refcode;      // reference classes, and the rows below
+static unsigned char *startcode;    // start map classes
+static unsigned char *simrows;      // simulated first rows, and rows below
+static int *acczones, accnzones, acclevels, accrows, accfitkind;
+static long *zoneref;               // reference cells per zone and class
+static long *accsum, *accgsum;      // the fused sums
+static int *pyramid[ACC_LEVELS];    // window counts of a row of windows
+#define ACC_TABLE  (ACC_CLASSES * ACC_CLASSES * ACC_CLASSES)
+
+static int accClass(int v)
+{
+    switch (v)  {
+    case LU_WATER:                return 1;
+    case LU_LRES: case LU_HRES:   return 2;
+    case LU_COM:                  return 3;
+    case LU_ROAD:                 return 4;
+    case LU_OS:                   return 5;
+    case LU_WET: case LU_HWET:    return 6;
+    default:                      return 0;
+    }
+}
+
+/* The first n bytes of the rank below into dst.
+*/
+static void rowsBelow(unsigned char *dst, unsigned char *first, int n)
+{
+    int up, down;
+    MPI_Status status;
+
+    up = (myrank > 0) ? myrank - 1 : MPI_PROC_NULL;
+    down = (myrank < nproc - 1) ? myrank + 1 : MPI_PROC_NULL;
+    PERFstart(PERF_HALO);
+    PERFcount(PERF_BYTES_MPI, n);
+    MPI_Sendrecv(first, n, MPI_UNSIGNED_CHAR, up, 31, dst, n,
+                 MPI_UNSIGNED_CHAR, down, 31, MPI_COMM_WORLD, &status);
+    PERFstop(PERF_HALO);
+}
+
+/* Set up the engine with the start and reference land use, cells off
+** the mask (which may be NULL) aren't compared.  zones may be NULL.
+** levels are the pyramid levels, fit is fom, kappa or multires.  Must
+** be called by all ranks.
+*/
+void scoreAccuracyInit(unsigned char *start, unsigned char *ref,
+                       unsigned char *mask, int *zones, int nzones,
+                       int levels, char *fit)
+{
+    int i, k, n, rows, grows;
+    long *z;
+
+    if (levels < 1 || levels > ACC_LEVELS)
+        errorExit("ACCURACY_LEVELS out of range");
+    if (!strcmp(fit, "fom"))
+        accfitkind = 0;
+    else if (!strcmp(fit, "kappa"))
+        accfitkind = 1;
+    else if (!strcmp(fit, "multires"))
+        accfitkind = 2;
+    else
+        errorExit("ACCURACY_FIT must be fom, kappa or multires");
+
+    /* the windows of a rank reach into the rank below only */
+    acclevels = levels;
+    accrows = (1 << (levels - 1)) - 1;
+    rows = erow - srow + 1;
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(&rows, &grows, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&grows, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+    if (grows < accrows)
+        errorExit("ACCURACY_LEVELS too deep for the rows of each rank");
+
+    for (i=0; i<256; i+=1)
+        accclass[i] = accClass(i);
+    n = accrows * gCols;
+    refcode = (unsigned char *)getMem(elements + n, "accuracy reference");
+    startcode = (unsigned char *)getMem(elements, "accuracy start");
+    simrows = (unsigned char *)getMem(2 * n + 1, "accuracy rows");
+    for (i=0; i<elements; i+=1)  {
+        refcode[i] = (mask == NULL || mask[i]) ? accclass[ref[i]]
+                                               : ACC_CLASSES;
+        startcode[i] = accclass[start[i]];
+    }
+    if (n > 0)
+        rowsBelow(refcode + elements, refcode, n);
+    for (k=1; k<levels; k+=1)
+        pyramid[k] = (int *)getMem(((gCols + (1 << k) - 1) >> k)
+                                   * ACC_CLASSES * sizeof (int),
+                                   "accuracy pyramid");
+
+    acczones = (nzones > 0) ? zones : NULL;
+    accnzones = (nzones > 0) ? nzones : 0;
+    n = ACC_TABLE + ACC_LEVELS + accnzones * ACC_CLASSES;
+    accsum = (long *)getMem(2 * n * sizeof (long), "accuracy sums");
+    accgsum = accsum + n;
+
+    if (accnzones > 0)  {
+        zoneref = (long *)getMem(accnzones * ACC_CLASSES * sizeof (long),
+                                 "accuracy zones");
+        z = accsum;
+        for (i=0; i<elements; i+=1)
+            if (refcode[i] < ACC_CLASSES && zones[i] >= 0 &&
+                zones[i] < accnzones)
+                z[zones[i] * ACC_CLASSES + refcode[i]] += 1;
+        PERFstart(PERF_COLLECTIVE);
+        MPI_Reduce(z, zoneref, accnzones * ACC_CLASSES, MPI_LONG, MPI_SUM,
+                   0, MPI_COMM_WORLD);
+        MPI_Bcast(zoneref, accnzones * ACC_CLASSES, MPI_LONG, 0,
+                  MPI_COMM_WORLD);
+        PERFstop(PERF_COLLECTIVE);
+    }
+    accuracy = 1;
+}
+
+/* The pyramid levels whose row of windows ends at global row r add
+** their errors and pass their counts up.
+*/
+static void closeWindows(long *err, int r)
+{
+    int k, c, n, *w, *up;
+    long e;
+
+    for (k=1; k<acclevels; k+=1)  {
+        if ((r + 1) % (1 << k) != 0 && r != gRows - 1)
+            break;
+        w = pyramid[k];
+        n = ((gCols + (1 << k) - 1) >> k) * ACC_CLASSES;
+        e = 0;
+        for (c=0; c<n; c+=1)
+            e += (w[c] < 0) ? -w[c] : w[c];
+        err[k] += e;
+        if (k + 1 < acclevels)  {
+            up = pyramid[k+1];
+            for (c=0; c<n; c+=1)
+                up[(c / ACC_CLASSES / 2) * ACC_CLASSES + c % ACC_CLASSES]
+                    += w[c];
+        }
+        memset(w, 0, n * sizeof (int));
+    }
+}
+
+/* Score lu against the reference, the metrics go in a (on all ranks)
+** and the fit is returned and sent to the GA engine if there is one.
+** Must be called by all ranks.
+*/
+double scoreAccuracy(unsigned char *lu, ACCURACY_T *a)
+{
+    int i, j, k, r, st, s, rc, z, first, last, b, *w;
+    int n = ACC_TABLE + ACC_LEVELS + accnzones * ACC_CLASSES;
+    unsigned char *sim, *ref;
+    long *tab = accsum, *err = accsum + ACC_TABLE;
+    long *zs = err + ACC_LEVELS, *zr, conf, rowm, colm;
+    double cells, diag, pe, e, fit;
+    FILE *fptr;
+    char *cptr;
+
+    PERFstart(PERF_SCORE);
+    b = accrows * gCols;
+    for (i=0; i<b; i+=1)
+        simrows[b + i] = accclass[lu[i]];
+    if (b > 0)
+        rowsBelow(simrows, simrows + b, b);
+    memset(accsum, 0, n * sizeof (long));
+    for (k=1; k<acclevels; k+=1)
+        memset(pyramid[k], 0, ((gCols + (1 << k) - 1) >> k)
+                              * ACC_CLASSES * sizeof (int));
+
+    /* windows starting in these rows, down to where they end */
+    b = accrows + 1;
+    first = (srow + b - 1) / b * b;
+    last = (first > erow) ? erow : erow / b * b + b - 1;
+    if (last > gRows - 1)
+        last = gRows - 1;
+
+    for (r=srow; r<=last; r+=1)  {
+        i = (r - srow) * gCols;
+        ref = refcode + i;
+        sim = (r <= erow) ? NULL : simrows + (r - erow - 1) * gCols;
+
+        if (r <= erow)
+            for (j=0; j<gCols; j+=1)  {
+                if ((rc = ref[j]) == ACC_CLASSES)
+                    continue;
+                s = accclass[lu[i+j]];
+                st = startcode[i+j];
+                tab[(st * ACC_CLASSES + s) * ACC_CLASSES + rc] += 1;
+                if (acczones != NULL && (z = acczones[i+j]) >= 0 &&
+                    z < accnzones)
+                    zs[z * ACC_CLASSES + s] += 1;
+            }
+
+        if (r < first || acclevels == 1)
+            continue;
+        w = pyramid[1];
+        for (j=0; j<gCols; j+=1)  {
+            if ((rc = ref[j]) == ACC_CLASSES)
+                continue;
+            s = (sim == NULL) ? accclass[lu[i+j]] : sim[j];
+            if (s != rc)  {
+                w[(j >> 1) * ACC_CLASSES + s] += 1;
+                w[(j >> 1) * ACC_CLASSES + rc] -= 1;
+            }
+        }
+        closeWindows(err, r);
+    }
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(accsum, accgsum, n, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Bcast(accgsum, n, MPI_LONG, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+    tab = accgsum;
+    err = accgsum + ACC_TABLE;
+    zs = err + ACC_LEVELS;
+
+    /* kappa from the table summed over the start classes */
+    memset(a, 0, sizeof (ACCURACY_T));
+    cells = diag = pe = 0.0;
+    for (s=0; s<ACC_CLASSES; s+=1)  {
+        rowm = colm = 0;
+        for (k=0; k<ACC_CLASSES; k+=1)
+            for (st=0; st<ACC_CLASSES; st+=1)  {
+                rowm += tab[(st * ACC_CLASSES + s) * ACC_CLASSES + k];
+                colm += tab[(st * ACC_CLASSES + k) * ACC_CLASSES + s];
+            }
+        for (st=0, conf=0; st<ACC_CLASSES; st+=1)
+            conf += tab[(st * ACC_CLASSES + s) * ACC_CLASSES + s];
+        cells += rowm;
+        diag += conf;
+        pe += (double)rowm * colm;
+    }
+    a->cells = cells;
+    if (cells > 0.0)  {
+        pe /= cells * cells;
+        a->kappa = (pe < 1.0) ? (diag / cells - pe) / (1.0 - pe) : 1.0;
+    }
+
+    /* figure of merit, the change is a class other than the start's */
+    for (st=0; st<ACC_CLASSES; st+=1)
+        for (s=0; s<ACC_CLASSES; s+=1)
+            for (rc=0; rc<ACC_CLASSES; rc+=1)  {
+                e = tab[(st * ACC_CLASSES + s) * ACC_CLASSES + rc];
+                if (rc != st && s == st)
+                    a->misses += e;
+                else if (rc != st && s == rc)
+                    a->hits += e;
+                else if (rc != st)
+                    a->wronghits += e;
+                else if (s != st)
+                    a->falsealarms += e;
+            }
+    e = a->misses + a->hits + a->wronghits + a->falsealarms;
+    a->fom = (e > 0.0) ? a->hits / e : 1.0;
+
+    /* multiple resolution agreement */
+    a->levels = acclevels;
+    fit = 0.0;
+    for (k=0; k<acclevels; k+=1)  {
+        if (cells > 0.0)
+            a->agreement[k] = (k == 0) ? diag / cells
+                                       : 1.0 - err[k] / (2.0 * cells);
+        fit += a->agreement[k] / acclevels;
+    }
+
+    /* zone errors, mean over the zones holding compared cells */
+    for (k=0; k<ACC_CLASSES && accnzones>0; k+=1)  {
+        for (z=0, i=0; z<accnzones; z+=1)  {
+            zr = zoneref + z * ACC_CLASSES;
+            for (j=0, conf=0; j<ACC_CLASSES; j+=1)
+                conf += zr[j];
+            if (conf == 0)
+                continue;
+            e = zs[z * ACC_CLASSES + k] - zr[k];
+            a->zonemae[k] += (e < 0.0) ? -e : e;
+            i += 1;
+        }
+        if (i > 0)
+            a->zonemae[k] /= i;
+    }
+
+    if (accfitkind == 0)
+        a->fit = 1.0 - a->fom;
+    else if (accfitkind == 1)
+        a->fit = 1.0 - a->kappa;
+    else
+        a->fit = 1.0 - fit;
+
+    /* zone table, simulated and reference cells of every class */
+    cptr = SMEgetFileName("ACCURACY_RESULTS");
+    if (myrank == 0 && cptr != NULL && accnzones > 0)  {
+        if ((fptr = fopen(cptr, "w")) == NULL)  {
+            sprintf(estring, "failed opening ACCURACY_RESULTS = %s\n", cptr);
+            errorExit(estring);
+        }
+        fprintf(fptr, "ZONE\tCLASS\tSIM\tREF\n");
+        for (z=0; z<accnzones; z+=1)
+            for (k=0; k<ACC_CLASSES; k+=1)
+                if (zs[z * ACC_CLASSES + k] || zoneref[z * ACC_CLASSES + k])
+                    fprintf(fptr, "%d\t%s\t%ld\t%ld\n", z, accnames[k],
+                            zs[z * ACC_CLASSES + k],
+                            zoneref[z * ACC_CLASSES + k]);
+        fclose(fptr);
+    }
+
+    if (debug && myrank == 0)
+        fprintf(stderr, "Accuracy: kappa = %f, fom = %f, fit = %f\n",
+                a->kappa, a->fom, a->fit);
+    if (myrank == 0 && SMEgetFileName("GA_ENGINE") != NULL)
+        GAsendFit(a->fit);
+
+    PERFstop(PERF_SCORE);
+    return a->fit;
+}
+
+/* Print the metrics for the Run Report.
+*/
+void scoreAccuracyReport(ACCURACY_T *a)
+{
+    int k;
+
+    printf("Accuracy\n");
+    printf("Cells = %.0f, Kappa = %.4f, Figure of Merit = %.4f\n",
+           a->cells, a->kappa, a->fom);
+    printf("Misses = %.0f, Hits = %.0f, Wrong Hits = %.0f, "
+           "False Alarms = %.0f\n", a->misses, a->hits, a->wronghits,
+           a->falsealarms);
+    printf("Agreement:");
+    for (k=0; k<a->levels; k+=1)
+        printf(" %dx%d = %.4f", 1 << k, 1 << k, a->agreement[k]);
+    printf("\n");
+    if (accnzones > 0)  {
+        printf("Zone Mean Abs Error:");
+        for (k=0; k<ACC_CLASSES; k+=1)
+            printf(" %s = %.2f", accnames[k], a->zonemae[k]);
+        printf("\n");
+    }
+    printf("Fit = %f\n", a->fit);
+}
@@ -0,0 +1,32 @@
+/* score.c header file
+**
+** Accuracy of the simulated land use against a reference land use
+** map, computed in the model so calibration needs no rasters.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef SCORE_H
+#define SCORE_H
+
+#define ACC_CLASSES    7            /* see accnames in score.c */
+#define ACC_LEVELS     8            /* most windows, 1 to 128 cells */
+
+typedef struct {
+    int    levels;                  /* windows of 1, 2, 4, .. cells */
+    double cells;                   /* cells compared */
+    double kappa;
+    double fom;                     /* figure of merit of the change */
+    double misses, hits, wronghits, falsealarms;
+    double agreement[ACC_LEVELS];   /* share of the cells matched */
+    double zonemae[ACC_CLASSES];    /* mean abs error of the zone counts */
+    double fit;                     /* the error the GA engine gets */
+} ACCURACY_T;
+
+extern void scoreAccuracyInit(unsigned char *start, unsigned char *ref,
+                              unsigned char *mask, int *zones, int nzones,
+                              int levels, char *fit);
+extern double scoreAccuracy(unsigned char *lu, ACCURACY_T *a);
+extern void scoreAccuracyReport(ACCURACY_T *a);
+
+#endif
@@ -0,0 +1,263 @@
+/*
+** Recursive smoothing for the kernel density layers.
+**
+** A Gaussian of standard deviation sigma is approximated by a third
+** order recursive filter run forward and then backward (Young and van
+** Vliet, 1995), the exponential kernel exp(-|d|/scale) by a first
+** order one.  Either costs the same few multiplies per cell whatever
+** the scale, and a kernel over the grid is a pass along the rows
+** followed by a pass along the columns.  Both kernels keep a constant
+** grid constant, the edges are extended with the edge values.
+**
+** The row pass is local.  Each block of SMOOTH_LANES rows is copied
+** column-major so the recursion along the row runs on all lanes at
+** once and vectorizes.  The column pass runs down the rows and back
+** up, each rank continuing the recursion from the last three rows of
+** the rank above (the first three of the rank below on the way up).
+** The columns go a chunk at a time so the ranks work as a pipeline,
+** a rank starts on a chunk as soon as the one above has finished it.
+** Every cell sees the same operations in the same order however the
+** rows are split, so the result is the same for any number of ranks.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "smooth.h"
+#include "perf.h"
+
+extern int srow, erow, elements;
+
+#define SMOOTH_LANES  8             /* rows filtered together */
+#define SMOOTH_CHUNK  256           /* columns a pipeline message */
+
+typedef struct {
+    float b, a1, a2, a3;            /* y = b x + a1 y1 + a2 y2 + a3 y3 */
+} COEF_T;
+
+static float *lanes = NULL;         // SMOOTH_LANES rows column-major
+static float *state;                // three rows of a chunk, and a copy
+
+
+int SMOOTHkind(char *name)
+{
+    if (!strcmp(name, "gauss"))
+        return SMOOTH_GAUSS;
+    if (!strcmp(name, "exp"))
+        return SMOOTH_EXP;
+    errorExit("smoothing kernel must be gauss or exp");
+    return -1;
+}
+
+static void coefficients(COEF_T *k, int kind, float scale)
+{
+    double q, b0, b1, b2, b3, a;
+
+    if (kind == SMOOTH_EXP)  {
+        if (scale <= 0.0)
+            errorExit("exponential kernel scale must be positive");
+        a = exp(-1.0 / scale);
+        k->b = 1.0 - a;
+        k->a1 = a;
+        k->a2 = k->a3 = 0.0;
+        return;
+    }
+
+    if (scale < 0.5)
+        errorExit("Gaussian kernel sigma must be at least 0.5");
+    q = (scale >= 2.5) ? 0.98711 * scale - 0.96330
+                       : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * scale);
+    b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+    b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+    b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+    b3 = 0.422205 * q * q * q;
+    k->a1 = b1 / b0;
+    k->a2 = b2 / b0;
+    k->a3 = b3 / b0;
+    k->b = 1.0 - (b1 + b2 + b3) / b0;
+}
+
+/* Forward and backward along the local rows of src into dst.
+*/
+static void rowPass(float *dst, float *src, COEF_T *k, int nrows)
+{
+    int r, n, l, j;
+    float *t, y1[SMOOTH_LANES], y2[SMOOTH_LANES], y3[SMOOTH_LANES];
+
+    for (r=0; r<nrows; r+=SMOOTH_LANES)  {
+        n = (nrows - r < SMOOTH_LANES) ? nrows - r : SMOOTH_LANES;
+        for (l=0; l<SMOOTH_LANES; l+=1)
+            for (j=0; j<gCols; j+=1)
+                lanes[j*SMOOTH_LANES + l] = (l < n) ? src[(r+l)*gCols + j]
+                                                    : 0.0f;
+
+        for (l=0; l<SMOOTH_LANES; l+=1)
+            y1[l] = y2[l] = y3[l] = lanes[l];
+        for (j=0; j<gCols; j+=1)  {
+            t = lanes + j*SMOOTH_LANES;
+            for (l=0; l<SMOOTH_LANES; l+=1)  {
+                t[l] = k->b * t[l] + (k->a1 * y1[l] + k->a2 * y2[l]
+                                      + k->a3 * y3[l]);
+                y3[l] = y2[l];
+                y2[l] = y1[l];
+                y1[l] = t[l];
+            }
+        }
+
+        t = lanes + (gCols-1)*SMOOTH_LANES;
+        for (l=0; l<SMOOTH_LANES; l+=1)
+            y1[l] = y2[l] = y3[l] = t[l];
+        for (j=gCols-1; j>=0; j-=1)  {
+            t = lanes + j*SMOOTH_LANES;
+            for (l=0; l<SMOOTH_LANES; l+=1)  {
+                t[l] = k->b * t[l] + (k->a1 * y1[l] + k->a2 * y2[l]
+                                      + k->a3 * y3[l]);
+                y3[l] = y2[l];
+                y2[l] = y1[l];
+                y1[l] = t[l];
+            }
+        }
+
+        for (l=0; l<n; l+=1)
+            for (j=0; j<gCols; j+=1)
+                dst[(r+l)*gCols + j] = lanes[j*SMOOTH_LANES + l];
+    }
+}
+
+/* The recursion down (dir 1) or up (dir -1) the columns c0..c0+n-1 of
+** the local rows, continuing from the three rows y1, y2, y3 before
+** them.  Returns the last row done in y1 (y2, y3 the ones before).
+*/
+static void columnChunk(float *g, COEF_T *k, int nrows, int dir,
+                        float **y1, float **y2, float **y3, int n)
+{
+    int r, j;
+    float *row, *p1 = *y1, *p2 = *y2, *p3 = *y3;
+
+    for (r=0; r<nrows; r+=1)  {
+        row = g + ((dir > 0) ? r : nrows-1 - r) * gCols;
+        for (j=0; j<n; j+=1)
+            row[j] = k->b * row[j] + (k->a1 * p1[j] + k->a2 * p2[j]
+                                      + k->a3 * p3[j]);
+        p3 = p2;
+        p2 = p1;
+        p1 = row;
+    }
+    *y1 = p1;
+    *y2 = p2;
+    *y3 = p3;
+}
+
+/* Down and back up the columns of g, pipelined across the ranks.
+*/
+static void columnPass(float *g, COEF_T *k, int nrows)
+{
+    int c, n, j, dir, from, to, first, last;
+    float *y1, *y2, *y3, *edge;
+    MPI_Status status;
+
+    for (dir=1; dir>=-1; dir-=2)  {
+        first = (dir > 0) ? srow == 0 : erow == gRows - 1;
+        last = (dir > 0) ? erow == gRows - 1 : srow == 0;
+        from = (dir > 0) ? myrank - 1 : myrank + 1;
+        to = (dir > 0) ? myrank + 1 : myrank - 1;
+        edge = g + ((dir > 0) ? 0 : (nrows-1) * gCols);
+
+        for (c=0; c<gCols; c+=SMOOTH_CHUNK)  {
+            n = (gCols - c < SMOOTH_CHUNK) ? gCols - c : SMOOTH_CHUNK;
+            y1 = state;
+            y2 = state + SMOOTH_CHUNK;
+            y3 = state + 2*SMOOTH_CHUNK;
+            if (first)  {
+                for (j=0; j<n; j+=1)
+                    y1[j] = y2[j] = y3[j] = edge[c + j];
+            }
+            else  {
+                PERFstart(PERF_HALO);
+                MPI_Recv(state, 3*SMOOTH_CHUNK, MPI_FLOAT, from, 30,
+                         MPI_COMM_WORLD, &status);
+                PERFstop(PERF_HALO);
+            }
+
+            columnChunk(g + c, k, nrows, dir, &y1, &y2, &y3, n);
+
+            if (!last)  {
+                memcpy(state + 3*SMOOTH_CHUNK, y1, n * sizeof (float));
+                memcpy(state + 4*SMOOTH_CHUNK, y2, n * sizeof (float));
+                memcpy(state + 5*SMOOTH_CHUNK, y3, n * sizeof (float));
+                PERFstart(PERF_HALO);
+                PERFcount(PERF_BYTES_MPI, 3 * SMOOTH_CHUNK * sizeof (float));
+                MPI_Send(state + 3*SMOOTH_CHUNK, 3*SMOOTH_CHUNK, MPI_FLOAT,
+                         to, 30, MPI_COMM_WORLD);
+                PERFstop(PERF_HALO);
+            }
+        }
+    }
+}
+
+/* Smooth the float grid src into dst (which may be src) with the kernel
+** of the kind and scale (sigma or the exponential length, in cells).
+** Must be called by all ranks.
+*/
+void SMOOTHgrid(float *dst, float *src, int kind, float scale)
+{
+    int nrows = erow - srow + 1;
+    COEF_T k;
+
+    PERFstart(PERF_SMOOTH);
+    if (lanes == NULL)  {
+        lanes = (float *)getMem(SMOOTH_LANES * gCols * sizeof (float),
+                                "smoothing lanes");
+        state = (float *)getMem(6 * SMOOTH_CHUNK * sizeof (float),
+                                "smoothing state");
+    }
+
+    coefficients(&k, kind, scale);
+    rowPass(dst, src, &k, nrows);
+    columnPass(dst, &k, nrows);
+    PERFcount(PERF_CELLS, elements);
+    PERFstop(PERF_SMOOTH);
+}
+
+/* Smooth the mask of the land use classes, the share of the kernel's
+** weight on cells of the classes.
+*/
+void SMOOTHclass(float *dst, unsigned char *lu, LU_FLAG flags, int kind,
+                 float scale)
+{
+    int i;
+    float in[256];
+
+    for (i=0; i<256; i+=1)
+        in[i] = (SPATIALdiffusionClass(i) & flags) ? 1.0f : 0.0f;
+    for (i=0; i<elements; i+=1)
+        dst[i] = in[lu[i]];
+    SMOOTHgrid(dst, dst, kind, scale);
+}
+
+/* Byte codes of a smoothed grid, 1 at 0 and SMOOTH_CODE at the largest
+** value of the whole grid.
+*/
+void SMOOTHcodes(unsigned char *codes, float *src)
+{
+    int i;
+    float v, max = 0.0, gmax;
+
+    for (i=0; i<elements; i+=1)
+        if (src[i] > max) max = src[i];
+
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(&max, &gmax, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&gmax, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
+
+    for (i=0; i<elements; i+=1)  {
+        v = (gmax > 0.0 && src[i] > 0.0) ? src[i] / gmax : 0.0f;
+        codes[i] = 1 + (int)((SMOOTH_CODE-1) * v + 0.5f);
+    }
+}
@@ -0,0 +1,22 @@
+/* smooth.c header file
+**
+** Separable recursive (IIR) smoothing of float grids with a Gaussian
+** of any sigma or an exponential kernel, at a constant cost per cell.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+
+#ifndef SMOOTH_H
+#define SMOOTH_H
+
+#define SMOOTH_GAUSS   0
+#define SMOOTH_EXP     1
+#define SMOOTH_CODE    255          /* code of the densest cell */
+
+extern int  SMOOTHkind(char *name);
+extern void SMOOTHgrid(float *dst, float *src, int kind, float scale);
+extern void SMOOTHclass(float *dst, unsigned char *lu, LU_FLAG flags,
+                        int kind, float scale);
+extern void SMOOTHcodes(unsigned char *codes, float *src);
+
+#endif
@@ -8,8 +8,12 @@
 #include <stdio.h>
 #include <mpi.h>
 #include <math.h>
+#include <string.h>
 
 #include "leam.h"
+#include "perf.h"
+
+extern int srow, erow;
 
 #define COMP_NW(p,val) ((*(p - cols - 1) == val) ? 1: 0)
 #define COMP_N(p,val)  ((*(p - cols) == val) ? 1 : 0)
@@ -29,9 +33,98 @@
 #define GET_S(p)   (*(p + cols))
 #define GET_SE(p)  (*(p + cols + 1))
 
+#define DIFFUSE_MAXDEPTH 64       /* steps per halo exchange */
+#define DIFFUSE_MAXFIELDS 4       /* grids diffused together */
+
+
+/* Land use class as an LU_FLAG for the neighbor counts */
+static LU_FLAG neighborClass(int v)
+{
+    if (v == LU_WATER)
+        return WATER_FLAG;
+    return SPATIALdiffusionClass(v);
+}
+
+/* Fraction of the cells within radius of a cell that are of the
+** types in val, as a code 0..NN_FRACTION.  The window is the (2r+1)^2
+** square less the cell itself, clipped to the grid.
+**
+** The window sums come from a summed-area table kept a row at a time:
+** the column sums of the window rows are updated as the window moves
+** down (one add and one subtract) and each cell's sum is the
+** difference of two prefix sums along the row, so the cost per cell
+** doesn't depend on the radius.  The radius rows above and below come
+** from the neighboring ranks, every rank must have at least radius
+** rows.
+*/
+void SPATIALneighborhood(unsigned char *dst, int val, unsigned char *src,
+                         int rows, int cols, int radius)
+{
+    int i, j, c, lo, hi, nr, nc, n, up, down;
+    int *colsum, *pre;
+    unsigned char *top, *bot, *p, in[256];
+
+#define LUROW(j)  (((j) < 0) ? top + ((j)+radius)*cols : \
+                   ((j) >= rows) ? bot + ((j)-rows)*cols : src + (j)*cols)
+
+    PERFstart(PERF_NEIGHBORS);
+    PERFcount(PERF_CELLS, rows*cols);
+
+    for (i=0; i<256; i+=1)
+        in[i] = (neighborClass(i) & val) ? 1 : 0;
+
+    top = (unsigned char *)getMem(2 * radius * cols, "neighborhood halo");
+    bot = top + radius * cols;
+    shareRows(top, bot, src, src + (rows-radius)*cols, radius*cols,
+              MPI_UNSIGNED_CHAR);
+
+    /* rows off the grid are left out of the window */
+    up = (srow > 0) ? -radius : 0;
+    down = (erow < gRows-1) ? rows-1 + radius : rows-1;
+
+    colsum = (int *)getMem((2*cols + 1) * sizeof (int), "neighborhood sums");
+    pre = colsum + cols;
+    for (j=-radius; j<radius; j+=1)
+        if (j >= up && j <= down)
+            for (p=LUROW(j), c=0; c<cols; c+=1)
+                colsum[c] += in[p[c]];
+
+    for (j=0; j<rows; j+=1)  {
+
+        /* slide the window down to rows j-radius..j+radius */
+        if (j + radius <= down)
+            for (p=LUROW(j+radius), c=0; c<cols; c+=1)
+                colsum[c] += in[p[c]];
+        if (j - radius - 1 >= up)
+            for (p=LUROW(j-radius-1), c=0; c<cols; c+=1)
+                colsum[c] -= in[p[c]];
+
+        pre[0] = 0;
+        for (c=0; c<cols; c+=1)
+            pre[c+1] = pre[c] + colsum[c];
+
+        lo = (j - radius > up) ? j - radius : up;
+        hi = (j + radius < down) ? j + radius : down;
+        nr = hi - lo + 1;
+        for (c=0; c<cols; c+=1)  {
+            lo = (c > radius) ? c - radius : 0;
+            hi = (c + radius < cols-1) ? c + radius : cols-1;
+            nc = hi - lo + 1;
+            n = pre[hi+1] - pre[lo] - in[src[j*cols+c]];
+            dst[j*cols+c] = (n * NN_FRACTION + (nr*nc-1) / 2) / (nr*nc-1);
+        }
+    }
+#undef LUROW
+
+    freeMem(top);
+    freeMem(colsum);
+    PERFstop(PERF_NEIGHBORS);
+}
+
 
 /* Compute the number of nearest neighbors of a particular type,
-** stores results in a grid.
+** stores results in a grid.  The passive rows of src must be current,
+** they are classified along with the active rows.
 */
 void nearestNeighbors(unsigned char *dst, unsigned char *tmp, int val,
                       unsigned char *src, int rows, int cols)
@@ -39,7 +132,9 @@ void nearestNeighbors(unsigned char *dst, unsigned char *tmp, int val,
     int i, j, offset;
     int res=0, com=0;
 
-    for (i=0; i<rows*cols; i+=1)  {
+    PERFstart(PERF_NEIGHBORS);
+    PERFcount(PERF_CELLS, rows*cols);
+    for (i=-cols; i<(rows+1)*cols; i+=1)  {
       switch (src[i])  {
       case LU_LRES: case LU_HRES:
         tmp[i] = (val & RES_FLAG) ? 1 : 0;
@@ -91,6 +186,7 @@ void nearestNeighbors(unsigned char *dst, unsigned char *tmp, int val,
                       + GET_SW(tmp+offset) + GET_S(tmp+offset)
                       ;
     }
+    PERFstop(PERF_NEIGHBORS);
 }
 
 /* Compute the weighted sum of all the cells that match a value,
@@ -100,12 +196,21 @@ float SPATIALweightedSum(float *w, unsigned char *src, int count, int val)
 {
     int i;
     float total = 0, gtotal;
+    REPRO_SUM exact = {0, 0};
+
+    if (repro)  {
+        for (i=0; i<count; i+=1)
+            if (src[i] == val) REPROadd(&exact, w[i]);
+        return REPROtotal(&exact);
+    }
 
     for (i=0; i<count; i+=1)
         total += (src[i] == val) ? w[i] : 0.0;
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&total, &gtotal, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gtotal, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gtotal;
 }
@@ -116,43 +221,157 @@ float SPATIALfalseDev(float w, float *probmap, float *density,
 {
     int i;
     float total = 0, gtotal;
+    REPRO_SUM exact = {0, 0};
 
     // check the density map to catch possible nodata values
     for (i=0; i<count; i+=1)  {
-        if (ranvals[i] < powf(probmap[i], w))  {
-            total += (density[i] > MIN_DENSITY) ? density[i] : 0.0;
+        if (ranvals[i] < powf(probmap[i], w) && density[i] > MIN_DENSITY)  {
+            if (repro)
+                REPROadd(&exact, density[i]);
+            else
+                total += density[i];
         }
     }
+    if (repro)
+        return REPROtotal(&exact);
 
-    MPI_Reduce(&total, &gtotal, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(&total, &gtotal, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gtotal, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gtotal;
 }
 
 
-float SPATIALfalseDev2(float w, float best, float *probmap, float *density,
+float SPATIALfalseDev2(float w, float best, float *probmap, QGRID_T *density,
                       float *ranvals, int count)
 {
-    int i, cells = 0;
+    int i, b, n, cells = 0;
     float p, total = 0, gtotal;
+    float blk[QUANT_BLOCK];
+    const float *d;
+    REPRO_SUM exact = {0, 0};
+
+    PERFcount(PERF_BISECT, 1);
+    PERFcount(PERF_CELLS, count);
 
     // check the density map to catch possible nodata values
-    for (i=0; i<count; i+=1)  {
-        p = (probmap[i] * w > best) ? best : probmap[i] * w;
-        if (ranvals[i] < p)  {
-            cells += 1;
-            total += (density[i] > MIN_DENSITY) ? density[i] : 0.0;
+    for (b=0; b<count; b+=QUANT_BLOCK)  {
+        n = (count - b < QUANT_BLOCK) ? count - b : QUANT_BLOCK;
+        d = QGRIDblock(density, b, n, blk) - b;
+        for (i=b; i<b+n; i+=1)  {
+            p = (probmap[i] * w > best) ? best : probmap[i] * w;
+            if (ranvals[i] < p && d[i] > MIN_DENSITY)  {
+                cells += 1;
+                if (repro)
+                    REPROadd(&exact, d[i]);
+                else
+                    total += d[i];
+            }
         }
     }
+    if (repro)
+        return REPROtotal(&exact);
 
-    MPI_Reduce(&total, &gtotal, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+    PERFstart(PERF_COLLECTIVE);
+    MPI_Reduce(&total, &gtotal, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gtotal, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gtotal;
 }
 
 
+/* Determine which cells are currently developable.
+** 
+** POSSIBLE_LU_FOR_COM_IND = if LAND_USE = 11 OR LAND_USE = 21 OR 
+**    LAND_USE = 22 OR LAND_USE = 23 OR LAND_USE = 24 OR 
+**    LAND_USE = 91 OR LAND_USE = 92 OR LAND_USE = 85 then 0 else 1
+** POSSIBLE_LU_FOR_OPENSPACE = if LAND_USE = 11 OR LAND_USE = 21 OR 
+**    LAND_USE = 22 OR LAND_USE = 23 OR LAND_USE = 24 OR LAND_USE = 91 OR
+**    LAND_USE = 92 OR LAND_USE = 85 then 0 else 1
+** POSSIBLE_LU_FOR_RES = if LAND_USE = 11 OR LAND_USE = 21 OR 
+**    LAND_USE = 22 OR LAND_USE = 23 OR LAND_USE = 24 OR LAND_USE = 91 OR
+**    LAND_USE = 92  OR LAND_USE = 85 then 0 else 1
+**
+** This routine should be probably combine additional
+** information from boundary and nogrowth map (others?) to
+** simplify the checking for active cells in the calcProb routines
+** but we'll leave it this way for now.
+**
+** We should probably be able flag different landuse types as developable
+** i.e. wetlands, ect.  Or even better have probabiliy based on landuse type.
+** Recommend we get rid of this routine.
+** The switch statement could get replaced with an equation that
+** would eliminates all the comparisons for performance.
+*/
+void SPATIALflagDevelopable(unsigned char *dev, unsigned char *luptr, 
+                            int count, LU_FLAG flag)
+{
+    int i;
+
+    for (i=0; i<count; i+=1)  {
+        switch (*(luptr+i))  {
+        case LU_WATER:
+            *(dev+i) = !(WATER_FLAG & flag);
+            break;
+        case LU_LRES: case LU_HRES:
+            *(dev+i) = !(RES_FLAG & flag);
+            break;
+        case LU_COM:
+            *(dev+i) = !(COM_FLAG & flag);
+            break;
+        case LU_ROAD:
+            *(dev+i) = !(ROAD_FLAG & flag);
+            break;
+        case LU_HWET: case LU_WET:
+            *(dev+i) = !(WETLAND_FLAG & flag);
+            break;
+        case LU_OS:
+            *(dev+i) = !(OS_FLAG & flag);
+            break;
+
+        default:
+            *(dev+i) = 1;
+
+        }
+    }
+}
+
+/* Develop the cells whose random draw falls under their probability
+** and that have a valid density.  Developed cells are marked in lu,
+** change and summary (with the iteration), their density is added to
+** *total (combine the ranks with REPROtotal).  Returns the number of
+** cells developed on this rank.
+*/
+int SPATIALdevelop(unsigned char *lu, unsigned char *change,
+                   unsigned char *summary, float *ranvals, float *p,
+                   QGRID_T *density, int count, int class, int itr,
+                   REPRO_SUM *total)
+{
+    int i, b, n, cells = 0;
+    float blk[QUANT_BLOCK];
+    const float *d;
+
+    for (b=0; b<count; b+=QUANT_BLOCK)  {
+        n = (count - b < QUANT_BLOCK) ? count - b : QUANT_BLOCK;
+        d = QGRIDblock(density, b, n, blk) - b;
+        for (i=b; i<b+n; i+=1)  {
+            if ((ranvals[i] < p[i]) && (d[i] > MIN_DENSITY))  {
+                change[i] = class;
+                lu[i] = class;
+                summary[i] = itr;
+                REPROadd(total, d[i]);
+                cells += 1;
+            }
+        }
+    }
+
+    return cells;
+}
+
+
 /* Compute the total number of cells that match a value, returns
 ** a scalar value.
 */
@@ -163,8 +382,10 @@ int spatialCount(unsigned char *src, int count, int val)
     for (i=0; i<count; i+=1)
         total += (*(src+i) == val) ? 1 : 0;
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&total, &gtotal, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gtotal, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gtotal;
 }
@@ -176,8 +397,10 @@ int spatialCountGreaterF(float *map, int count, float val)
    for (i=0; i<count; i+=1)
        total += ((map[i] > val) ? 1 : 0);
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&total, &gtotal, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gtotal, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gtotal;
 }
@@ -205,11 +428,13 @@ void spatialCorrelatedCount(int *totals, int len, int *map,
         if (src[i] == val) totals[map[i]] += 1;
     }
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(totals, gtotals, len, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
     for (i=0; i<len; i+=1)  totals[i] = gtotals[i];
     MPI_Bcast(totals, len, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
-    free(gtotals);
+    freeMem(gtotals);
     return;
 }
 
@@ -230,8 +455,10 @@ void spatialCorrelatedSumF(float *totals, int len, int *map,
       for (i=0; i<count; i+=1)
            sums[map[i]] += src[i];
 
+      PERFstart(PERF_COLLECTIVE);
       MPI_Reduce(sums, gsums, len, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
       MPI_Bcast(gsums, len, MPI_FLOAT, 0, MPI_COMM_WORLD);
+      PERFstop(PERF_COLLECTIVE);
 
       if (myrank == 0)  {
           printf("GRID_ID,     Delta Pop\n");
@@ -240,6 +467,7 @@ void spatialCorrelatedSumF(float *totals, int len, int *map,
       }
         
       freeMem(sums);
+      freeMem(gsums);
       return;
 }
 
@@ -249,12 +477,21 @@ float spatialSumF(float *src, int count)
 {
     int i;
     float total = 0.0, gtotal;
+    REPRO_SUM exact = {0, 0};
+
+    if (repro)  {
+        for (i=0; i<count; i+=1)
+            REPROadd(&exact, src[i]);
+        return REPROtotal(&exact);
+    }
 
     for (i=0; i<count; i+=1)
         total += *(src+i);
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&total, &gtotal, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gtotal, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gtotal;
 }
@@ -266,12 +503,21 @@ float spatialSumOneF(float *src, int count)
 {
     int i;
     float total = 0.0, gtotal;
+    REPRO_SUM exact = {0, 0};
+
+    if (repro)  {
+        for (i=0; i<count; i+=1)
+            REPROadd(&exact, (src[i] > 1.0) ? 1.0 : src[i]);
+        return REPROtotal(&exact);
+    }
 
     for (i=0; i<count; i+=1)
         total += (*(src+i) > 1.0) ? 1.0 : *(src+i);
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&total, &gtotal, 1, MPI_FLOAT, MPI_SUM, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gtotal, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gtotal;
 }
@@ -288,8 +534,10 @@ float spatialMaxF(float *src, int count)
         if (src[i] > max)
             max = src[i];
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&max, &gmax, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gmax, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gmax;
 }
@@ -318,8 +566,10 @@ float spatialMinF(float *src, int count, int gt_zero)
                 min = src[i];
     }
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&min, &gmin, 1, MPI_FLOAT, MPI_MIN, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gmin, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gmin;
 }
@@ -351,8 +601,10 @@ int spatialMax(int *src, int count)
         if (src[i] > max)
             max = src[i];
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(&max, &gmax, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
     MPI_Bcast(&gmax, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
     return gmax;
 }
@@ -376,11 +628,13 @@ void spatialHistogram(int *hist, int len, int *src, int count)
             hist[src[i]] += 1;
     }
 
+    PERFstart(PERF_COLLECTIVE);
     MPI_Reduce(hist, ghist, len, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
     for (i=0; i<len; i+=1)  hist[i] = ghist[i];
     MPI_Bcast(hist, len, MPI_INT, 0, MPI_COMM_WORLD);
+    PERFstop(PERF_COLLECTIVE);
 
-    free(ghist);
+    freeMem(ghist);
     return;
 }
 
@@ -425,6 +679,72 @@ void SPATIALhistogramLog(float *src, int count)
   }
 }
 
+/* Land use class of a cell as an LU_FLAG for the diffusion sources,
+** 0 if the class never is one.
+*/
+LU_FLAG SPATIALdiffusionClass(unsigned char lu)
+{
+   switch (lu)  {
+   case LU_LRES: case LU_HRES:  return RES_FLAG;
+   case LU_COM:                 return COM_FLAG;
+   case LU_ROAD:                return ROAD_FLAG;
+   case LU_OS:                  return OS_FLAG;
+   }
+   return 0;
+}
+
+/* Set utilities to max for the n cells of the types given, fields
+** nf utilities grids (or rows) sharing the land use.  This jumps
+** newly developed cells to the max level so they can begin diffusing
+** in earnest.
+*/
+static void diffuseSet(int nf, float **src, int *type, unsigned char *luptr,
+                       int n)
+{
+   int i, f;
+   LU_FLAG c;
+
+   for (i=0; i<n; i+=1)  {
+       if ((c = SPATIALdiffusionClass(luptr[i])) == 0)
+           continue;
+       for (f=0; f<nf; f+=1)
+           if (type[f] & c) src[f][i] = 1.0;
+   }
+}
+
+/* Inflow of one row from its 8 neighbors, up and down are the rows
+** above and below src.  The edge cells only see the neighbors on
+** the grid.
+*/
+static void diffuseRow(float *tmp, float *up, float *src, float *down,
+                       float rate, int cols)
+{
+   int i;
+
+   tmp[0] = rate * ( + up[0] + up[1] + src[1] + down[0] + down[1] ) / 8.0;
+
+   for (i=1; i<cols-1; i+=1)
+       tmp[i] = rate * ( up[i-1] + up[i] + up[i+1] + src[i-1] + src[i+1]
+                       + down[i-1] + down[i] + down[i+1] ) / 8.0;
+
+   i = cols - 1;
+   tmp[i] = rate * ( + up[i-1] + up[i] + src[i-1] + down[i-1] + down[i] )
+            / 8.0;
+}
+
+/* Add the inflow, clamping utilities at 1 */
+static void diffuseAdd(float *src, float *tmp, int n)
+{
+   int i;
+
+   for (i=0; i<n; i+=1)
+#ifdef NOCLAMP
+       src[i] += tmp[i];
+#else
+       src[i] = (src[i] + tmp[i] > 1.0) ? 1.0 : src[i] + tmp[i];
+#endif
+}
+
 /*
 ** Originally this was called the utility model but we're now calling
 ** it the diffision model with is more discriptive and accurate.
@@ -464,74 +784,163 @@ void SPATIALhistogramLog(float *src, int count)
 int spatialDiffusion(float *src, float *tmp, float rate, int type,
                     unsigned char *luptr, int rows, int cols)
 {
-   int i, j, offset;
-
-   /* Set utilities to max for specified cells.  This jumps newly 
-   ** developed cells to the max level so they can begin diffusing 
-   ** in earnest.
-   */
-   for (i=0; i<rows*cols; i+=1)  {
-       tmp[i] = 0.0;
-       switch (*(luptr+i))  {
-       case LU_LRES: case LU_HRES:
-           if (type & RES_FLAG) *(src+i) = 1.0;
-           break;
-
-       case LU_COM:
-           if (type & COM_FLAG) *(src+i) = 1.0;
-           break;
-
-       case LU_ROAD:
-           if (type & ROAD_FLAG) *(src+i) = 1.0;
-           break;
-
-       case LU_OS:
-           if (type & OS_FLAG) *(src+i) = 1.0;
-           break;
-       }
-   }
+   int j;
 
-   for (j=0; j<rows; j+=1)  {
-
-       /* row's left most cell */
-       offset = j * cols;
-       *(tmp+offset) = rate *
-                      ( 
-                      + GET_N(src+offset) + GET_NE(src+offset)
-                      +                      GET_E(src+offset)
-                      + GET_S(src+offset) + GET_SE(src+offset)
-                      ) / 8.0;
-
-       /* row's middle cells */
-       for (i=1; i<cols-1; i+=1)
-           *(tmp+offset+i) += rate * 
-                      ( GET_NW(src+offset+i)
-                      + GET_N(src+offset+i) 
-                      + GET_NE(src+offset+i) 
-                      + GET_W(src+offset+i) 
-                      + GET_E(src+offset+i) 
-                      + GET_SW(src+offset+i) 
-                      + GET_S(src+offset+i) 
-                      + GET_SE(src+offset+i) 
-                      ) / 8.0;
-
-       /* row's right most cell */
-       offset = (j * cols) + cols - 1;
-       *(tmp+offset) = rate *
-                      ( 
-                      + GET_NW(src+offset) + GET_N(src+offset)
-                      + GET_W(src+offset)
-                      + GET_SW(src+offset) + GET_S(src+offset)
-                      ) / 8.0;
-   }
+   PERFstart(PERF_DIFFUSION);
+   PERFcount(PERF_CELLS, rows*cols);
 
-   /* clamp utilities at 1 */
-   for (i=0; i<rows * cols; i+=1)
-#ifdef NOCLAMP
-       src[i] += tmp[i];
-#else
-       src[i] = (src[i] + tmp[i] > 1.0) ? 1.0 : src[i] + tmp[i];
-#endif
+   diffuseSet(1, &src, &type, luptr, rows*cols);
 
+   /* neighbors need the levels set by the ranks above and below */
    shareGrid((char *)src, rows*cols, MPI_FLOAT);
+
+   for (j=0; j<rows; j+=1)
+       diffuseRow(tmp + j*cols, src + (j-1)*cols, src + j*cols,
+                  src + (j+1)*cols, rate, cols);
+
+   diffuseAdd(src, tmp, rows*cols);
+
+   PERFstop(PERF_DIFFUSION);
+}
+
+/* Advance nf utilities grids sharing the land use by steps steps with
+** the land use fixed, rate and type are per grid.  The result is
+** bitwise the same as steps calls of spatialDiffusion for each grid.
+**
+** The steps are taken depth at a time (bounded by the rows of the
+** smallest rank) with one exchange of depth halo rows, the rows in
+** the halo are advanced redundantly and the valid band shrinks by a
+** row a step.  The halo rows of all the grids and of the land use go
+** to a neighbor in a single packed message.  Within a round the steps
+** run as a wavefront over the rows, step s works two rows behind step
+** s-1, so a row is read from memory once per round rather than once
+** per step, and a cell's land use is classified once for all grids.
+** Each step keeps the inflow of its last two rows, a row is updated
+** once the inflow of the row below it has been computed from the old
+** values.
+*/
+void SPATIALdiffusionSteps(int nf, float **src, float *rate, int *type,
+                           unsigned char *luptr, int rows, int cols,
+                           int steps, int depth)
+{
+   int f, k, s, t, r, up, down, minrows, reallo, realhi, n;
+   int lo[DIFFUSE_MAXDEPTH], hi[DIFFUSE_MAXDEPTH];
+   float *top, *bot, *sendup, *senddown, *inc, *row[DIFFUSE_MAXFIELDS];
+   unsigned char *btop, *bbot;
+
+   if (nf > DIFFUSE_MAXFIELDS)
+       errorExit("too many fields for SPATIALdiffusionSteps");
+   if (depth > DIFFUSE_MAXDEPTH) depth = DIFFUSE_MAXDEPTH;
+   if (depth > steps) depth = steps;
+
+   /* every rank must be able to supply depth rows to its neighbors */
+   minrows = rows;
+   if (nproc > 1)  {
+       PERFstart(PERF_COLLECTIVE);
+       MPI_Reduce(&rows, &minrows, 1, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+       MPI_Bcast(&minrows, 1, MPI_INT, 0, MPI_COMM_WORLD);
+       PERFstop(PERF_COLLECTIVE);
+   }
+   if (depth > minrows) depth = minrows;
+   if (depth < 1) depth = 1;
+
+   PERFstart(PERF_DIFFUSION);
+   PERFcount(PERF_CELLS, (long)nf*rows*cols*steps);
+
+   /* a halo message is the rows of each grid followed by the land use */
+   n = depth * cols * (nf * sizeof (float) + 1);
+   top = (float *)getMem(n, "diffusion halo");
+   bot = (float *)getMem(n, "diffusion halo");
+   sendup = (float *)getMem(n, "diffusion halo");
+   senddown = (float *)getMem(n, "diffusion halo");
+   inc = (float *)getMem(nf * 2 * depth * cols * sizeof (float),
+                         "diffusion inflow");
+
+   up = (myrank > 0);
+   down = (myrank < nproc - 1);
+
+   for (; steps > 0; steps -= k)  {
+       k = (steps < depth) ? steps : depth;
+
+       /* the utilities are exchanged unset, every step sets its rows */
+       for (f=0; f<nf; f+=1)  {
+           memcpy(sendup + f*k*cols, src[f], k*cols * sizeof (float));
+           memcpy(senddown + f*k*cols, src[f] + (rows-k)*cols,
+                  k*cols * sizeof (float));
+       }
+       memcpy(sendup + nf*k*cols, luptr, k*cols);
+       memcpy(senddown + nf*k*cols, luptr + (rows-k)*cols, k*cols);
+       n = k * cols * (nf * sizeof (float) + 1);
+       shareRows(top, bot, sendup, senddown, n, MPI_BYTE);
+       btop = (unsigned char *)(top + nf*k*cols);
+       bbot = (unsigned char *)(bot + nf*k*cols);
+
+       /* at the edges of the grid the passive row is fixed */
+       for (f=0; f<nf; f+=1)  {
+           if (!up)
+               memcpy(top + (f*k + k-1)*cols, src[f] - cols,
+                      cols * sizeof (float));
+           if (!down)
+               memcpy(bot + f*k*cols, src[f] + rows*cols,
+                      cols * sizeof (float));
+       }
+
+       /* rows that step s brings up to date */
+       for (s=0; s<k; s+=1)  {
+           lo[s] = (up) ? -(k-1-s) : 0;
+           hi[s] = (down) ? rows-1 + (k-1-s) : rows-1;
+       }
+       reallo = (up) ? -k : 0;
+       realhi = (down) ? rows-1 + k : rows-1;
+
+#define FROW(f,r) (((r) < 0) ? top + ((f)*k + k+(r))*cols : \
+                   ((r) >= rows) ? bot + ((f)*k + (r)-rows)*cols : \
+                   src[f] + (r)*cols)
+#define BROW(r)   (((r) < 0) ? btop + (k+(r))*cols : \
+                   ((r) >= rows) ? bbot + ((r)-rows)*cols : luptr + (r)*cols)
+#define INC(f,s,r) (inc + ((2*((f)*k + (s))) + ((r) & 1))*cols)
+#define SETROW(r) for (f=0; f<nf; f+=1) row[f] = FROW(f,r); \
+                  diffuseSet(nf, row, type, BROW(r), cols)
+
+       /* the first step's set runs ahead of its wavefront */
+       for (r=lo[0]-1; r<=lo[0]; r+=1)
+           if (r >= reallo)  {
+               SETROW(r);
+           }
+
+       for (t=lo[0]; t<=hi[k-1] + 1 + 2*(k-1); t+=1)  {
+           for (s=0; s<k; s+=1)  {
+               r = t - 2*s;
+               if (r >= lo[s] && r <= hi[s])  {
+                   if (s == 0 && r+1 <= realhi)  {
+                       SETROW(r+1);
+                   }
+                   for (f=0; f<nf; f+=1)
+                       diffuseRow(INC(f,s,r), FROW(f,r-1), FROW(f,r),
+                                  FROW(f,r+1), rate[f], cols);
+               }
+
+               /* the row above can take this step's inflow now */
+               r -= 1;
+               if (r >= lo[s] && r <= hi[s])  {
+                   for (f=0; f<nf; f+=1)
+                       diffuseAdd(FROW(f,r), INC(f,s,r), cols);
+                   if (s < k-1)  {
+                       SETROW(r);
+                   }
+               }
+           }
+       }
+#undef FROW
+#undef BROW
+#undef INC
+#undef SETROW
+   }
+
+   freeMem(top);
+   freeMem(bot);
+   freeMem(sendup);
+   freeMem(senddown);
+   freeMem(inc);
+   PERFstop(PERF_DIFFUSION);
 }
@@ -0,0 +1,1028 @@
+/*
+** spatialbench times the hot spatial.c kernels on synthetic grids and
+** checks them against plain reference implementations kept here.
+** It uses the model's own row decomposition so it runs on one rank or
+** under mpirun on many.
+**
+** Usage: spatialbench [-r rows] [-c cols] [-n reps] [-s sparsity]
+**                     [-m res,com,os,water,road] [-q precision] [-seed n]
+**
+**   sparsity  -- fraction of cells holding one of the mixed classes,
+**                the rest are undeveloped (default 0.3)
+**   mix       -- relative weights of the classes (default 6,2,1,1,1)
+**   precision -- density map storage, f32, f16, u16 or u8 (see quant.c)
+**
+** The synthetic grids are a function of the global cell index and the
+** seed only, so results don't depend on the number of ranks.  Times
+** are the slowest rank, cells/s and GB/s are for the whole grid with
+** GB/s counting the bytes each kernel must read and write once.
+**
+** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "leam.h"
+#include "distance.h"
+#include "cost.h"
+#include "smooth.h"
+#include "patch.h"
+#include "multigrid.h"
+
+int debug = 0;
+int myrank, nproc;
+char *runName = NULL;
+float ulx, uly, xdim, ydim;
+char *projection;
+
+extern int srow, erow, elements;
+
+static int rows = 2000, cols = 2000, reps = 10, qmode = QUANT_F32;
+static double sparsity = 0.3;
+static double mix[5] = { 6.0, 2.0, 1.0, 1.0, 1.0 };
+static int classes[5] = { LU_LRES, LU_COM, LU_OS, LU_WATER, LU_ROAD };
+static unsigned long long seed = 1;
+
+static unsigned char *lu, *tmp, *nn, *dev, *change, *summary;
+static unsigned char *ref8, *lu0;
+static float *util, *utmp, *prob, *ranvals, *dens, *reff, *util0;
+static QGRID_T *density;
+static int failures = 0;
+
+#define MG_BENCH_TOL  0.15        /* mean difference multigrid may make */
+
+
+/* uniform [0,1) draw for a global cell and stream */
+static double cellRandom(long cell, int stream)
+{
+    unsigned long long z;
+
+    z = seed * 0x9e3779b97f4a7c15ULL + cell * 0xbf58476d1ce4e5b9ULL + stream;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void makeGrids()
+{
+    int i, k;
+    long cell;
+    double total = 0.0, r;
+
+    for (k=0; k<5; k+=1)
+        total += mix[k];
+
+    lu = (unsigned char *)initGridMap(NULL, elements, 1);
+    lu0 = (unsigned char *)initGridMap(NULL, elements, 1);
+    tmp = (unsigned char *)initGridMap(NULL, elements, 1);
+    nn = (unsigned char *)initGridMap(NULL, elements, 1);
+    dev = (unsigned char *)initGridMap(NULL, elements, 1);
+    change = (unsigned char *)initGridMap(NULL, elements, 1);
+    summary = (unsigned char *)initGridMap(NULL, elements, 1);
+    ref8 = (unsigned char *)initGridMap(NULL, elements, 1);
+    util = (float *)initGridMap(NULL, elements, sizeof (float));
+    util0 = (float *)initGridMap(NULL, elements, sizeof (float));
+    utmp = (float *)initGridMap(NULL, elements, sizeof (float));
+    prob = (float *)initGridMap(NULL, elements, sizeof (float));
+    ranvals = (float *)initGridMap(NULL, elements, sizeof (float));
+    dens = (float *)initGridMap(NULL, elements, sizeof (float));
+    reff = (float *)initGridMap(NULL, elements, sizeof (float));
+
+    for (i=0; i<elements; i+=1)  {
+        cell = (long)srow * cols + i;
+        lu0[i] = 0;
+        if (cellRandom(cell, 0) < sparsity)  {
+            r = cellRandom(cell, 1) * total;
+            for (k=0; k<4 && r >= mix[k]; k+=1)
+                r -= mix[k];
+            lu0[i] = classes[k];
+        }
+        util0[i] = cellRandom(cell, 2);
+        prob[i] = 0.25 * cellRandom(cell, 3);
+        ranvals[i] = cellRandom(cell, 4);
+        dens[i] = (cellRandom(cell, 5) < 0.01) ? -9999.0
+                                               : 10.0 * cellRandom(cell, 6);
+    }
+
+    density = QGRIDinit(elements, qmode);
+    if (qmode == QUANT_F32)
+        memcpy(density->data, dens, elements * sizeof (float));
+    else
+        QGRIDset(density, dens);
+    QGRIDget(density, dens);      /* the reference sees decoded values */
+}
+
+
+/***** reference implementations *****/
+
+static int landFlag(int v)
+{
+    switch (v)  {
+    case LU_WATER:           return WATER_FLAG;
+    case LU_LRES: case LU_HRES: return RES_FLAG;
+    case LU_COM:             return COM_FLAG;
+    case LU_ROAD:            return ROAD_FLAG;
+    case LU_OS:              return OS_FLAG;
+    case LU_WET: case LU_HWET: return WETLAND_FLAG;
+    default:                 return 0;
+    }
+}
+
+/* neighbors of class val, cells off the east and west edges don't count
+** but the passive rows above and below do
+*/
+static void refNeighbors(unsigned char *dst, int val, unsigned char *src,
+                         int nrows)
+{
+    int r, c, dr, dc, n;
+    unsigned char *t = tmp;
+
+    for (r=-cols; r<(nrows+1)*cols; r+=1)
+        t[r] = (landFlag(src[r]) & val & ~WETLAND_FLAG) ? 1 : 0;
+
+    for (r=0; r<nrows; r+=1)
+        for (c=0; c<cols; c+=1)  {
+            n = 0;
+            for (dr=-1; dr<=1; dr+=1)
+                for (dc=-1; dc<=1; dc+=1)
+                    if ((dr || dc) && c+dc >= 0 && c+dc < cols)
+                        n += t[(r+dr)*cols + c+dc];
+            dst[r*cols+c] = n;
+        }
+}
+
+/* radius r neighborhood codes by brute force over the whole grid,
+** gathered on every rank
+*/
+static void refNeighborhood(unsigned char *dst, int val, unsigned char *src,
+                            int nrows, int r)
+{
+    int i, j, c, dr, dc, g, n, cells, *counts, *displs;
+    unsigned char *all;
+
+    counts = (int *)getMem(2 * nproc * sizeof (int), "counts");
+    displs = counts + nproc;
+    MPI_Allgather(&elements, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+    for (i=1; i<nproc; i+=1)
+        displs[i] = displs[i-1] + counts[i-1];
+    all = (unsigned char *)getMem(rows * cols, "whole grid");
+    MPI_Allgatherv(src, elements, MPI_UNSIGNED_CHAR, all, counts, displs,
+                   MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
+
+    for (j=0; j<nrows; j+=1)
+        for (c=0; c<cols; c+=1)  {
+            n = cells = 0;
+            for (dr=-r; dr<=r; dr+=1)
+                for (dc=-r; dc<=r; dc+=1)  {
+                    g = srow + j + dr;
+                    if ((dr || dc) && g >= 0 && g < rows && c+dc >= 0 &&
+                        c+dc < cols)  {
+                        cells += 1;
+                        if (landFlag(all[g*cols + c+dc]) & val
+                            & ~WETLAND_FLAG)
+                            n += 1;
+                    }
+                }
+            dst[j*cols+c] = (n * NN_FRACTION + cells / 2) / cells;
+        }
+
+    freeMem(all);
+    freeMem(counts);
+}
+
+/* squared distances to the nearest road capped at the reach, painting
+** the window of every road of the whole grid
+*/
+static void refDistance(int *dst, unsigned char *src, int reach)
+{
+    int i, r, c, g, j, v, far = reach * reach + 1, *counts, *displs;
+    unsigned char *all;
+
+    counts = (int *)getMem(2 * nproc * sizeof (int), "counts");
+    displs = counts + nproc;
+    MPI_Allgather(&elements, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+    for (i=1; i<nproc; i+=1)
+        displs[i] = displs[i-1] + counts[i-1];
+    all = (unsigned char *)getMem(rows * cols, "whole grid");
+    MPI_Allgatherv(src, elements, MPI_UNSIGNED_CHAR, all, counts, displs,
+                   MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
+
+    for (i=0; i<elements; i+=1)
+        dst[i] = far;
+    for (i=0; i<rows*cols; i+=1)  {
+        if (all[i] != LU_ROAD)
+            continue;
+        for (g=i/cols-reach; g<=i/cols+reach; g+=1)  {
+            if (g < srow || g > erow)
+                continue;
+            for (c=i%cols-reach; c<=i%cols+reach; c+=1)  {
+                if (c < 0 || c >= cols)
+                    continue;
+                r = g - i/cols;
+                j = c - i%cols;
+                v = r*r + j*j;
+                if (v <= reach * reach && v < dst[(g-srow)*cols + c])
+                    dst[(g-srow)*cols + c] = v;
+            }
+        }
+    }
+
+    freeMem(all);
+    freeMem(counts);
+}
+
+/* least costs to the roads by forward and backward sweeps over the
+** whole grid until nothing changes
+*/
+static void refCost(int *dst, unsigned char *src, int reach)
+{
+    int i, k, n, r, c, x, f, g, v, pass, changed, *cost, *counts, *displs;
+    static const int dr[8] = { -1, -1, -1, 0, 0, 1, 1, 1 };
+    static const int dc[8] = { -1, 0, 1, -1, 1, -1, 0, 1 };
+    unsigned char *all;
+
+    counts = (int *)getMem(2 * nproc * sizeof (int), "counts");
+    displs = counts + nproc;
+    MPI_Allgather(&elements, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+    for (i=1; i<nproc; i+=1)
+        displs[i] = displs[i-1] + counts[i-1];
+    all = (unsigned char *)getMem(rows * cols, "whole grid");
+    MPI_Allgatherv(src, elements, MPI_UNSIGNED_CHAR, all, counts, displs,
+                   MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
+
+    cost = (int *)getMem(rows * cols * sizeof (int), "whole costs");
+    for (i=0; i<rows*cols; i+=1)
+        cost[i] = (all[i] == LU_ROAD) ? 0 : COST_FAR;
+
+    do  {
+        changed = 0;
+        for (pass=0; pass<2; pass+=1)
+            for (k=0; k<rows*cols; k+=1)  {
+                i = (pass == 0) ? k : rows*cols - 1 - k;
+                if ((f = COSTfriction(all[i])) < 0)
+                    continue;
+                r = i / cols;
+                c = i % cols;
+                for (n=0; n<8; n+=1)  {
+                    if (r+dr[n] < 0 || r+dr[n] >= rows || c+dc[n] < 0 ||
+                        c+dc[n] >= cols)
+                        continue;
+                    x = i + dr[n] * cols + dc[n];
+                    g = COSTfriction(all[x]);
+                    if (cost[x] == COST_FAR || g < 0)
+                        continue;
+                    v = cost[x] + ((dr[n] && dc[n])
+                                   ? (int)((f + g) * M_SQRT2 + 0.5) : f + g);
+                    if (v <= reach && v < cost[i])  {
+                        cost[i] = v;
+                        changed = 1;
+                    }
+                }
+            }
+    }  while (changed);
+
+    memcpy(dst, cost + srow * cols, elements * sizeof (int));
+    freeMem(cost);
+    freeMem(all);
+    freeMem(counts);
+}
+
+/* patches of the res and com cells by flood fills over the whole grid
+** in row major order, so a patch's label is its first cell
+*/
+static void refPatches(int *dst, PATCH_STATS *s, unsigned char *src,
+                       unsigned char *ch)
+{
+    int i, x, y, r, c, dr, dc, n, old, *label, *stack, *counts, *displs;
+    unsigned char *all, *allch;
+
+    counts = (int *)getMem(2 * nproc * sizeof (int), "counts");
+    displs = counts + nproc;
+    MPI_Allgather(&elements, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+    for (i=1; i<nproc; i+=1)
+        displs[i] = displs[i-1] + counts[i-1];
+    all = (unsigned char *)getMem(2 * rows * cols, "whole grid");
+    allch = all + rows * cols;
+    MPI_Allgatherv(src, elements, MPI_UNSIGNED_CHAR, all, counts, displs,
+                   MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
+    MPI_Allgatherv(ch, elements, MPI_UNSIGNED_CHAR, allch, counts, displs,
+                   MPI_UNSIGNED_CHAR, MPI_COMM_WORLD);
+    label = (int *)getMem(2 * rows * cols * sizeof (int), "whole labels");
+    stack = label + rows * cols;
+
+    memset(s, 0, sizeof (PATCH_STATS));
+    for (i=0; i<rows*cols; i+=1)
+        label[i] = -1;
+    for (i=0; i<rows*cols; i+=1)  {
+        if (!(landFlag(all[i]) & (RES_FLAG | COM_FLAG)))
+            continue;
+        s->cells += 1.0;
+        r = i / cols;
+        c = i % cols;
+        if (r > 0 && !(landFlag(all[i-cols]) & (RES_FLAG | COM_FLAG)))
+            s->edges += 1.0;
+        if (r < rows-1 && !(landFlag(all[i+cols]) & (RES_FLAG | COM_FLAG)))
+            s->edges += 1.0;
+        if (c > 0 && !(landFlag(all[i-1]) & (RES_FLAG | COM_FLAG)))
+            s->edges += 1.0;
+        if (c < cols-1 && !(landFlag(all[i+1]) & (RES_FLAG | COM_FLAG)))
+            s->edges += 1.0;
+        if (label[i] >= 0)
+            continue;
+
+        label[i] = i;
+        stack[0] = i;
+        n = 1;
+        old = 0;
+        s->patches += 1;
+        for (x=0; x<n; x+=1)  {
+            old |= !allch[stack[x]];
+            r = stack[x] / cols;
+            c = stack[x] % cols;
+            for (dr=-1; dr<=1; dr+=1)
+                for (dc=-1; dc<=1; dc+=1)  {
+                    if (r + dr < 0 || r + dr >= rows ||
+                        c + dc < 0 || c + dc >= cols)
+                        continue;
+                    y = (r + dr) * cols + c + dc;
+                    if (label[y] < 0 &&
+                        (landFlag(all[y]) & (RES_FLAG | COM_FLAG)))  {
+                        label[y] = i;
+                        stack[n++] = y;
+                    }
+                }
+        }
+        if (!old)
+            s->newpatches += 1;
+        if (n > s->largest)
+            s->largest = n;
+    }
+
+    memcpy(dst, label + srow * cols, elements * sizeof (int));
+    freeMem(label);
+    freeMem(all);
+    freeMem(counts);
+}
+
+/* one recursive pass over the n values x[0], x[s], .. */
+static void refRecursive(float *x, int n, int s, double *k)
+{
+    int i;
+    float y1, y2, y3;
+
+    y1 = y2 = y3 = x[0];
+    for (i=0; i<n; i+=1)  {
+        x[i*s] = (float)k[0] * x[i*s] + ((float)k[1] * y1 + (float)k[2] * y2
+                                         + (float)k[3] * y3);
+        y3 = y2;
+        y2 = y1;
+        y1 = x[i*s];
+    }
+}
+
+/* Gaussian smoothing of the whole grid on every rank, the rows and then
+** the columns forward and back
+*/
+static void refSmooth(float *dst, float *src, float sigma)
+{
+    int i, *counts, *displs;
+    double q, b0, k[4];
+    float *all;
+
+    q = (sigma >= 2.5) ? 0.98711 * sigma - 0.96330
+                       : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+    k[1] = (2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q) / b0;
+    k[2] = -(1.4281 * q * q + 1.26661 * q * q * q) / b0;
+    k[3] = 0.422205 * q * q * q / b0;
+    k[0] = 1.0 - (2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q
+                  - (1.4281 * q * q + 1.26661 * q * q * q)
+                  + 0.422205 * q * q * q) / b0;
+
+    counts = (int *)getMem(2 * nproc * sizeof (int), "counts");
+    displs = counts + nproc;
+    MPI_Allgather(&elements, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+    for (i=1; i<nproc; i+=1)
+        displs[i] = displs[i-1] + counts[i-1];
+    all = (float *)getMem(rows * cols * sizeof (float), "whole grid");
+    MPI_Allgatherv(src, elements, MPI_FLOAT, all, counts, displs,
+                   MPI_FLOAT, MPI_COMM_WORLD);
+
+    for (i=0; i<rows; i+=1)  {
+        refRecursive(all + i*cols, cols, 1, k);
+        refRecursive(all + i*cols + cols-1, cols, -1, k);
+    }
+    for (i=0; i<cols; i+=1)  {
+        refRecursive(all + i, rows, cols, k);
+        refRecursive(all + (rows-1)*cols + i, rows, -cols, k);
+    }
+
+    memcpy(dst, all + srow * cols, elements * sizeof (float));
+    freeMem(all);
+    freeMem(counts);
+}
+
+static void refDiffusion(float *src, float *t, float rate, int type,
+                         unsigned char *luptr, int nrows)
+{
+    int r, c, i, dr, dc;
+    float s;
+
+    for (i=0; i<nrows*cols; i+=1)
+        if (landFlag(luptr[i]) & type & ~(WATER_FLAG | WETLAND_FLAG))
+            src[i] = 1.0;
+    shareGrid((char *)src, nrows*cols, MPI_FLOAT);
+
+    for (r=0; r<nrows; r+=1)
+        for (c=0; c<cols; c+=1)  {
+            s = 0.0;
+            for (dr=-1; dr<=1; dr+=1)
+                for (dc=-1; dc<=1; dc+=1)
+                    if ((dr || dc) && c+dc >= 0 && c+dc < cols)
+                        s += src[(r+dr)*cols + c+dc];
+            t[r*cols+c] = rate * s / 8.0;
+        }
+
+    for (i=0; i<nrows*cols; i+=1)
+        src[i] = (src[i] + t[i] > 1.0) ? 1.0 : src[i] + t[i];
+}
+
+/* mirrors the reduction used by SPATIALfalseDev2 */
+static float refFalseDev(float w, float best)
+{
+    int i;
+    float p, total = 0.0, gtotal;
+
+    for (i=0; i<elements; i+=1)  {
+        p = (prob[i] * w > best) ? best : prob[i] * w;
+        if (ranvals[i] < p && dens[i] > MIN_DENSITY)
+            total += dens[i];
+    }
+    MPI_Allreduce(&total, &gtotal, 1, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
+    return gtotal;
+}
+
+static void refFlag(unsigned char *d, unsigned char *luptr, int flag)
+{
+    int i;
+
+    for (i=0; i<elements; i+=1)
+        d[i] = !(landFlag(luptr[i]) & flag);
+}
+
+static int refDevelop(unsigned char *l, unsigned char *ch, int class,
+                      double *total)
+{
+    int i, cells = 0;
+
+    for (i=0; i<elements; i+=1)
+        if (ranvals[i] < prob[i] && dens[i] > MIN_DENSITY)  {
+            l[i] = ch[i] = class;
+            *total += dens[i];
+            cells += 1;
+        }
+    return cells;
+}
+
+
+/***** timing and checking *****/
+
+/* time and check of a kernel, it fails if err is above tol on any rank
+*/
+static void reportTol(char *name, double t, double bytes, double err,
+                      double tol, char *what)
+{
+    double tmax, gerr, cells = (double)rows * cols;
+
+    MPI_Reduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&err, &gerr, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (myrank != 0)
+        return;
+
+    if (gerr > tol) failures += 1;
+    tmax /= reps;
+    printf("%-14s %10.3f %12.1f %9.2f   %s", name, tmax * 1e3,
+           cells / tmax / 1e6, bytes * cells / tmax / 1e9,
+           (gerr > tol) ? "FAIL" : "ok");
+    if (gerr > 0.0)
+        printf(" (%s %g)", what, gerr);
+    printf("\n");
+}
+
+static void report(char *name, double t, double bytes, double err)
+{
+    reportTol(name, t, bytes, err, 1e-5, "max error");
+}
+
+static double densityBytes()
+{
+    return (qmode == QUANT_F32) ? 4.0 : (qmode == QUANT_U8) ? 1.0 : 2.0;
+}
+
+static double diff8(unsigned char *a, unsigned char *b)
+{
+    int i;
+    double e = 0.0;
+
+    for (i=0; i<elements; i+=1)
+        if (a[i] != b[i]) e = 1.0;
+    return e;
+}
+
+static double difff(float *a, float *b)
+{
+    int i;
+    double e = 0.0, d;
+
+    for (i=0; i<elements; i+=1)  {
+        d = fabs(a[i] - b[i]) / (fabs(b[i]) > 1.0 ? fabs(b[i]) : 1.0);
+        if (d > e) e = d;
+    }
+    return e;
+}
+
+static void benchNeighbors(int nrows)
+{
+    int i;
+    double t;
+
+    memcpy(lu, lu0, elements);
+    nearestNeighbors(nn, tmp, RES_FLAG | COM_FLAG, lu, nrows, cols);
+    refNeighbors(ref8, RES_FLAG | COM_FLAG, lu, nrows);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        nearestNeighbors(nn, tmp, RES_FLAG | COM_FLAG, lu, nrows, cols);
+    t = MPI_Wtime() - t;
+
+    /* read lu, write and re-read tmp, write counts */
+    report("neighbors", t, 4.0, diff8(nn, ref8));
+}
+
+static void benchNeighborhood(int nrows)
+{
+    int i;
+    double t;
+
+    memcpy(lu, lu0, elements);
+    shareGrid(lu, elements, MPI_UNSIGNED_CHAR);
+    refNeighborhood(ref8, RES_FLAG | COM_FLAG, lu, nrows, 5);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        SPATIALneighborhood(nn, RES_FLAG | COM_FLAG, lu, nrows, cols, 5);
+    t = MPI_Wtime() - t;
+
+    /* read lu, write codes */
+    report("neighbors r5", t, 2.0, diff8(nn, ref8));
+}
+
+static void benchDiffusion(int nrows)
+{
+    int i;
+    double t, err;
+
+    memcpy(lu, lu0, elements);
+    memcpy(util, util0, elements * sizeof (float));
+    memcpy(reff, util0, elements * sizeof (float));
+    spatialDiffusion(util, utmp, 0.5, RES_FLAG, lu, nrows, cols);
+    refDiffusion(reff, utmp, 0.5, RES_FLAG, lu, nrows);
+    err = difff(util, reff);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        spatialDiffusion(util, utmp, 0.5, RES_FLAG, lu, nrows, cols);
+    t = MPI_Wtime() - t;
+
+    /* read lu, read/write src, write and re-read tmp */
+    report("diffusion", t, 17.0, err);
+}
+
+static void benchDiffusionSteps(int nrows)
+{
+    int i, type[2] = { RES_FLAG, COM_FLAG | OS_FLAG };
+    double t, err;
+    float *f[2], rate[2] = { 0.5, 0.3 };
+    static float *util2, *ref2;
+
+    if (util2 == NULL)  {
+        util2 = (float *)initGridMap(NULL, elements, sizeof (float));
+        ref2 = (float *)initGridMap(NULL, elements, sizeof (float));
+    }
+
+    /* reps single steps of each grid are the reference, the result
+    ** must be bitwise the same
+    */
+    memcpy(lu, lu0, elements);
+    memcpy(reff, util0, elements * sizeof (float));
+    memcpy(ref2, util0, elements * sizeof (float));
+    for (i=0; i<reps; i+=1)  {
+        spatialDiffusion(reff, utmp, rate[0], type[0], lu, nrows, cols);
+        spatialDiffusion(ref2, utmp, rate[1], type[1], lu, nrows, cols);
+    }
+
+    memcpy(util, util0, elements * sizeof (float));
+    memcpy(util2, util0, elements * sizeof (float));
+    f[0] = util;
+    f[1] = util2;
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    SPATIALdiffusionSteps(2, f, rate, type, lu, nrows, cols, reps, 8);
+    t = MPI_Wtime() - t;
+    err = (memcmp(util, reff, elements * sizeof (float)) ||
+           memcmp(util2, ref2, elements * sizeof (float))) ? 1.0 : 0.0;
+
+    /* two grids: read lu, read/write both once per 8 steps, the time
+    ** and cells are per grid step
+    */
+    report("diffusion 2x8", t / 2.0, 17.0 / 8.0 / 2.0, err);
+}
+
+/* multilevel warm-up against the explicit steps it stands in for, from
+** zero utility around sparse roads so the fronts are still moving.  It
+** is an approximation, a cell at a front can be off by nearly the whole
+** range, the check bounds the mean difference.
+*/
+static void benchMultigrid(int nrows)
+{
+    int i, type = ROAD_FLAG, steps = 100;
+    long cell;
+    double t, e[2], ge[2], d;
+    float rate = 0.2;
+    char what[64];
+
+    for (i=0; i<elements; i+=1)  {
+        cell = (long)srow * cols + i;
+        lu[i] = (cellRandom(cell, 7) < 0.0005) ? LU_ROAD : 0;
+        util[i] = reff[i] = 0.0;
+    }
+    SPATIALdiffusionSteps(1, &reff, &rate, &type, lu, nrows, cols,
+                          steps, 8);
+
+    MGconfig(3, 4, 0.0, 0.0);
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    MGdiffusion(1, &util, &rate, &type, lu, nrows, cols, steps, 8);
+    t = MPI_Wtime() - t;
+
+    e[0] = e[1] = 0.0;
+    for (i=0; i<elements; i+=1)  {
+        d = fabs(util[i] - reff[i]);
+        e[0] += d;
+        if (d > e[1]) e[1] = d;
+    }
+    MPI_Allreduce(e, ge, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(e+1, ge+1, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    sprintf(what, "max difference %.3g, mean error", ge[1]);
+
+    /* the time and cells are per explicit step stood in for */
+    reportTol("multigrid", t * reps / steps, 17.0 / 8.0,
+              ge[0] / ((double)rows * cols), MG_BENCH_TOL, what);
+}
+
+/* distance to sparse roads, the full transform and an update adding a
+** fifth as many roads again
+*/
+static void benchDistance()
+{
+    int i, reach = 24, *ref, *d2;
+    double t, err;
+    long cell;
+    unsigned char *lu2, *feature, *grid;
+    DIST_T *d;
+
+    ref = (int *)getMem(elements * sizeof (int), "reference distances");
+    d2 = (int *)getMem(elements * sizeof (int), "saved distances");
+    feature = (unsigned char *)getMem(elements, "saved features");
+    grid = (unsigned char *)getMem(elements, "saved codes");
+    lu2 = (unsigned char *)initGridMap(NULL, elements, 1);
+    for (i=0; i<elements; i+=1)  {
+        cell = (long)srow * cols + i;
+        lu[i] = (cellRandom(cell, 7) < 0.001) ? LU_ROAD : 0;
+        lu2[i] = (cellRandom(cell, 8) < 0.0002) ? LU_ROAD : lu[i];
+    }
+
+    d = DISTinit(ROAD_FLAG, reach);
+    DISTupdate(d, lu, 1);
+    refDistance(ref, lu, reach);
+    err = 0.0;
+    for (i=0; i<elements; i+=1)
+        if (d->d2[i] != ref[i] || d->grid[i] != DISTcode(ref[i], reach))
+            err = 1.0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        DISTupdate(d, lu, 1);
+    t = MPI_Wtime() - t;
+
+    /* read lu, write g, both transposes, write the codes */
+    report("distance", t, 22.0, err);
+
+    memcpy(d2, d->d2, elements * sizeof (int));
+    memcpy(feature, d->feature, elements);
+    memcpy(grid, d->grid, elements);
+    t = 0.0;
+    for (i=0; i<reps; i+=1)  {
+        memcpy(d->d2, d2, elements * sizeof (int));
+        memcpy(d->feature, feature, elements);
+        memcpy(d->grid, grid, elements);
+        MPI_Barrier(MPI_COMM_WORLD);
+        t -= MPI_Wtime();
+        err = DISTupdate(d, lu2, 0);      /* must not need a transform */
+        t += MPI_Wtime();
+    }
+    refDistance(ref, lu2, reach);
+    for (i=0; i<elements; i+=1)
+        if (d->d2[i] != ref[i] || d->grid[i] != DISTcode(ref[i], reach))
+            err = 1.0;
+
+    /* read lu, the disks are a small part of the grid */
+    report("distance incr", t, 1.0, err);
+
+    freeGridMap((char *)lu2, 1);
+    freeMem(grid);
+    freeMem(feature);
+    freeMem(d2);
+    freeMem(ref);
+}
+
+/* cost distance to the roads of the mixed grid, from scratch and an
+** update adding a road in every 2000 cells
+*/
+static void benchCost()
+{
+    int i, k, *ref, *saved;
+    double t, err;
+    unsigned char *lu2;
+    COST_T *c;
+
+    ref = (int *)getMem(elements * sizeof (int), "reference costs");
+    saved = (int *)getMem(2 * (elements + 2 * cols) * sizeof (int),
+                          "saved costs");
+    lu2 = (unsigned char *)initGridMap(NULL, elements, 1);
+    memcpy(lu, lu0, elements);
+    for (i=0; i<elements; i+=1)
+        lu2[i] = (cellRandom((long)srow * cols + i, 8) < 0.0005) ? LU_ROAD
+                                                                 : lu[i];
+
+    COSTconfig(1.0, 2.0, 4.0, -1.0, 8.0);
+    c = COSTinit(ROAD_FLAG, NULL, 12.0);
+    COSTupdate(c, lu, 1);
+    refCost(ref, lu, c->reach);
+    err = 0.0;
+    for (i=0; i<elements; i+=1)
+        if (c->cost[i] != ref[i])
+            err = 1.0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        COSTupdate(c, lu, 1);
+    t = MPI_Wtime() - t;
+
+    /* read lu, read/write cost and friction */
+    report("cost", t, 17.0, err);
+
+    memcpy(saved, c->cost - cols, (elements + 2 * cols) * sizeof (int));
+    memcpy(saved + elements + 2 * cols, c->fric - cols,
+           (elements + 2 * cols) * sizeof (int));
+    t = 0.0;
+    for (i=0; i<reps; i+=1)  {
+        memcpy(c->cost - cols, saved, (elements + 2 * cols) * sizeof (int));
+        memcpy(c->fric - cols, saved + elements + 2 * cols,
+               (elements + 2 * cols) * sizeof (int));
+        for (k=0; k<elements; k+=1)
+            c->source[k] = (lu[k] == LU_ROAD);
+        MPI_Barrier(MPI_COMM_WORLD);
+        t -= MPI_Wtime();
+        err = COSTupdate(c, lu2, 0);      /* must not start over */
+        t += MPI_Wtime();
+    }
+    refCost(ref, lu2, c->reach);
+    for (i=0; i<elements; i+=1)
+        if (c->cost[i] != ref[i])
+            err = 1.0;
+
+    /* read lu, the cells lowered are a small part of the grid */
+    report("cost incr", t, 1.0, err);
+
+    freeGridMap((char *)lu2, 1);
+    freeMem(saved);
+    freeMem(ref);
+}
+
+static void benchSmooth()
+{
+    int i;
+    double t, err;
+
+    refSmooth(reff, util0, 8.0);
+    SMOOTHgrid(util, util0, SMOOTH_GAUSS, 8.0);
+    err = (memcmp(util, reff, elements * sizeof (float))) ? 1.0 : 0.0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        SMOOTHgrid(util, util0, SMOOTH_GAUSS, 8.0);
+    t = MPI_Wtime() - t;
+
+    /* read src, write dst, the lanes and the column passes */
+    report("smooth gauss", t, 24.0, err);
+}
+
+/* patches of the res and com cells of the mixed grid, half of the
+** cells count as new
+*/
+static void benchPatches()
+{
+    int i, *ref;
+    double t, err;
+    PATCH_T *p;
+    PATCH_STATS s, rs;
+
+    ref = (int *)getMem(elements * sizeof (int), "reference labels");
+    for (i=0; i<elements; i+=1)  {
+        lu[i] = lu0[i];
+        change[i] = cellRandom((long)srow * cols + i, 9) < 0.5;
+    }
+    shareGrid(lu, elements, MPI_UNSIGNED_CHAR);
+
+    p = PATCHinit(RES_FLAG | COM_FLAG);
+    PATCHlabel(p, lu, change, &s);
+    refPatches(ref, &rs, lu, change);
+    err = (memcmp(p->label, ref, elements * sizeof (int)) ||
+           s.patches != rs.patches || s.newpatches != rs.newpatches ||
+           s.largest != rs.largest || s.cells != rs.cells ||
+           s.edges != rs.edges) ? 1.0 : 0.0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        PATCHlabel(p, lu, change, &s);
+    t = MPI_Wtime() - t;
+
+    /* read lu and change, both scans of the labels, sizes and marks */
+    report("patches", t, 19.0, err);
+
+    freeMem(p->mark);
+    freeMem(p->roots);
+    freeMem(p->size);
+    freeGridMap((char *)p->label, sizeof (int));
+    freeMem(p);
+    freeMem(ref);
+}
+
+static void benchFalseDev()
+{
+    int i;
+    double t, err;
+    float a, b;
+
+    a = SPATIALfalseDev2(1.0, 0.25, prob, density, ranvals, elements);
+    b = refFalseDev(1.0, 0.25);
+    err = fabs(a - b) / (fabs(b) > 1.0 ? fabs(b) : 1.0);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        SPATIALfalseDev2(1.0 + 0.1 * i, 0.25, prob, density, ranvals,
+                         elements);
+    t = MPI_Wtime() - t;
+
+    /* read prob, ranvals and the density codes */
+    report("falseDev2", t, 8.0 + densityBytes(), err);
+}
+
+static void benchFlag()
+{
+    int i;
+    double t;
+
+    memcpy(lu, lu0, elements);
+    SPATIALflagDevelopable(dev, lu, elements, NONDEVELOPABLE_FLAGS);
+    refFlag(ref8, lu, NONDEVELOPABLE_FLAGS);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t = MPI_Wtime();
+    for (i=0; i<reps; i+=1)
+        SPATIALflagDevelopable(dev, lu, elements, NONDEVELOPABLE_FLAGS);
+    t = MPI_Wtime() - t;
+
+    report("flag", t, 2.0, diff8(dev, ref8));
+}
+
+static void benchDevelop()
+{
+    int i, a, b;
+    double t = 0.0, t0, err;
+    double tb = 0.0, gtb;
+    REPRO_SUM ta = {0, 0};
+
+    memcpy(lu, lu0, elements);
+    memset(change, 0, elements);
+    a = SPATIALdevelop(lu, change, summary, ranvals, prob, density,
+                       elements, LU_COM, 1, &ta);
+    memcpy(tmp, lu0, elements);
+    memset(ref8, 0, elements);
+    b = refDevelop(tmp, ref8, LU_COM, &tb);
+    MPI_Allreduce(&tb, &gtb, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    tb = REPROtotal(&ta);
+    err = diff8(lu, tmp) + diff8(change, ref8) + (a != b)
+          + fabs(tb - gtb) / (gtb > 1.0 ? gtb : 1.0);
+
+    for (i=0; i<reps; i+=1)  {
+        memcpy(lu, lu0, elements);
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        SPATIALdevelop(lu, change, summary, ranvals, prob, density,
+                       elements, LU_COM, 1, &ta);
+        t += MPI_Wtime() - t0;
+    }
+
+    report("develop", t, 8.0 + densityBytes(), err);
+}
+
+
+static void usage(char *prog)
+{
+    if (myrank == 0)
+        fprintf(stderr, "Usage: %s [-r rows] [-c cols] [-n reps] "
+                "[-s sparsity] [-m res,com,os,water,road] [-q precision] "
+                "[-seed n]\n", prog);
+    MPI_Finalize();
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, *gridrows;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+
+    for (i=1; i<argc; i+=1)  {
+        if (i+1 == argc)
+            usage(argv[0]);
+        else if (!strcmp(argv[i], "-r"))
+            rows = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c"))
+            cols = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n"))
+            reps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s"))
+            sparsity = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-m"))
+            sscanf(argv[++i], "%lf,%lf,%lf,%lf,%lf", mix, mix+1, mix+2,
+                   mix+3, mix+4);
+        else if (!strcmp(argv[i], "-q"))
+            qmode = QGRIDmode(argv[++i]);
+        else if (!strcmp(argv[i], "-seed"))
+            seed = strtoull(argv[++i], NULL, 10);
+        else
+            usage(argv[0]);
+    }
+    if (rows < nproc || cols < 3 || reps < 1)
+        usage(argv[0]);
+
+    /* same split as distributeGridRows */
+    gridrows = (int *)getMem(sizeof (int) * (nproc + 1), "gridrows");
+    for (i=0; i<=nproc; i+=1)
+        gridrows[i] = (i == 0) ? 0 : gridrows[i-1] + rows / nproc
+                                     + ((i <= rows % nproc) ? 1 : 0);
+    LUCconfigGrids(rows, cols, gridrows);
+    makeGrids();
+
+    if (myrank == 0)  {
+        printf("spatialbench: %d x %d cells, %d ranks, %d reps, "
+               "sparsity %.2f, density %s\n", rows, cols, nproc, reps,
+               sparsity, QGRIDname(qmode));
+        printf("%-14s %10s %12s %9s   %s\n", "kernel", "ms/rep",
+               "Mcells/s", "GB/s", "check");
+    }
+
+    benchNeighbors(erow - srow + 1);
+    benchNeighborhood(erow - srow + 1);
+    benchDiffusion(erow - srow + 1);
+    benchDiffusionSteps(erow - srow + 1);
+    benchMultigrid(erow - srow + 1);
+    benchDistance();
+    benchCost();
+    benchSmooth();
+    benchPatches();
+    benchFalseDev();
+    benchFlag();
+    benchDevelop();
+
+    MPI_Bcast(&failures, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Finalize();
+    return failures ? 1 : 0;
+}
@@ -1,37 +1,252 @@
 /*
 ** This module provide wrapper functions for malloc (calloc really).
 **
+** Every block handed out by getMem carries a small header so freeMem
+** can account for it.  Live and peak bytes are kept per label (the
+** description passed to getMem) and MEMreport summarizes them across
+** ranks at the end of a run.
+**
 ** Copyright (C) 2013 LEAMgroup, Inc. Released under GPL v2.
 */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
 #include <mpi.h>
 
 #include "leam.h"
 
 char estring[1024];
 
+#define MEM_MAGIC   0x4d454d4c
+#define MEM_LABELS  512
+#define MEM_LABELLEN 48
+#define MEM_TOP     12
+
+/* header in front of each block, 16 bytes keeps calloc alignment */
+typedef struct {
+    size_t bytes;
+    int label;
+    int magic;
+} memhdr;
+
+typedef struct {
+    char name[MEM_LABELLEN];
+    unsigned hash;
+    int allocs, frees;
+    size_t live, peak;
+} memlabel;
+
+static memlabel labels[MEM_LABELS];
+static int nlabels = 0;
+static size_t live = 0, peak = 0, budget = 0;
+static int allocs = 0, frees = 0;
+static double peaktime = 0.0;
+static struct timeval memstart;
+static pthread_t mainthread;
+static int started = 0, overbudget = 0;
+static pthread_mutex_t memlock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static double elapsed()
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - memstart.tv_sec)
+           + (now.tv_usec - memstart.tv_usec) / 1e6;
+}
+
+/* find or add the label, the last slot collects any overflow
+*/
+static int findLabel(char *name)
+{
+    unsigned h = 2166136261u;
+    char *p;
+    int i;
+
+    if (name == NULL) name = "(none)";
+    for (p=name; *p && p-name < MEM_LABELLEN-1; p+=1)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+
+    for (i=0; i<nlabels; i+=1)
+        if (labels[i].hash == h
+            && !strncmp(labels[i].name, name, MEM_LABELLEN-1))
+            return i;
+
+    if (nlabels == MEM_LABELS - 1)  {
+        strcpy(labels[nlabels].name, "(other)");
+        return nlabels;
+    }
+
+    strncpy(labels[nlabels].name, name, MEM_LABELLEN-1);
+    labels[nlabels].hash = h;
+    return nlabels++;
+}
+
+/* print this rank's labels with the largest peaks
+*/
+static void printLabels(FILE *f, int top)
+{
+    int i, j, order[MEM_LABELS], n = nlabels;
+
+    if (n < MEM_LABELS && labels[n].allocs) n += 1;
+    for (i=0; i<n; i+=1)  {
+        for (j=i; j>0 && labels[order[j-1]].peak < labels[i].peak; j-=1)
+            order[j] = order[j-1];
+        order[j] = i;
+    }
+
+    fprintf(f, "P%d: %-40s %7s %7s %10s %10s\n", myrank, "label",
+            "allocs", "frees", "peak MB", "live MB");
+    for (i=0; i<n && i<top; i+=1)  {
+        j = order[i];
+        fprintf(f, "P%d: %-40.40s %7d %7d %10.3f %10.3f\n", myrank,
+                labels[j].name, labels[j].allocs, labels[j].frees,
+                labels[j].peak / 1048576.0, labels[j].live / 1048576.0);
+    }
+}
+
+/* Limit the live bytes per rank, 0 turns the check off.
+*/
+void MEMsetBudget(int mb)
+{
+    budget = (size_t)mb << 20;
+}
+
+
+/* Account for bytes allocated under label and return its slot.
+** Also used by the grid arena which does its own allocation.
+*/
+int MEMtrack(char *label, long bytes)
+{
+   int idx, over;
+
+   pthread_mutex_lock(&memlock);
+   if (!started)  {
+       gettimeofday(&memstart, NULL);
+       mainthread = pthread_self();
+       started = 1;
+   }
+   idx = findLabel(label);
+   labels[idx].allocs += 1;
+   labels[idx].live += bytes;
+   if (labels[idx].live > labels[idx].peak)
+       labels[idx].peak = labels[idx].live;
+   allocs += 1;
+   live += bytes;
+   if (live > peak)  {
+       peak = live;
+       peaktime = elapsed();
+   }
+   if (budget && live > budget) overbudget = 1;
+
+   // MPI is only called from the main thread
+   over = overbudget && pthread_equal(pthread_self(), mainthread);
+   pthread_mutex_unlock(&memlock);
+
+   if (over)  {
+       fprintf(stderr, "P%d: memory budget of %lu MB exceeded, "
+               "%.1f MB live at %.2fs\n", myrank,
+               (unsigned long)(budget >> 20), live / 1048576.0, elapsed());
+       printLabels(stderr, MEM_TOP);
+       sprintf(estring, "memory budget exceeded allocating %ld bytes for %s",
+               bytes, label);
+       errorExit(estring);
+   }
+
+   return idx;
+}
+
+void MEMuntrack(int idx, long bytes)
+{
+    pthread_mutex_lock(&memlock);
+    labels[idx].frees += 1;
+    labels[idx].live -= bytes;
+    frees += 1;
+    live -= bytes;
+    pthread_mutex_unlock(&memlock);
+}
+
 
 char *getMem(int bytes, char *description)
 {
    char *ptr;
+   memhdr *h;
 
-   if ((ptr=calloc(bytes, 1)) == NULL)  {
+   if ((ptr=calloc(bytes + sizeof (memhdr), 1)) == NULL)  {
        sprintf(estring, "Insufficient Memory for %s, %d bytes requested",
                description, bytes);
        errorExit(estring);
        return ptr;          /* can't get here, but stops warnings */
    }
-   else 
-       return ptr;
+
+   h = (memhdr *)ptr;
+   h->bytes = bytes;
+   h->magic = MEM_MAGIC;
+   h->label = MEMtrack(description, bytes);
+
+   return ptr + sizeof (memhdr);
 }
 
 /* simple wrapper, just to be consistant with getMem
 */
 void freeMem(void *ptr)
 {
+    memhdr *h;
+
+    if (ptr == NULL) return;
+    h = (memhdr *)((char *)ptr - sizeof (memhdr));
+    if (h->magic != MEM_MAGIC)
+        errorExit("freeMem called on memory not from getMem");
+
+    MEMuntrack(h->label, h->bytes);
+    h->magic = 0;
+    free(h);
+}
+
+
+/* Summarize memory use across ranks.  Must be called by all ranks,
+** rank 0 prints the min/max/sum of the per rank peaks and of what
+** is still allocated, plus its own largest labels.
+*/
+void MEMreport()
+{
+    double local[3], lmin[3], lmax[3], lsum[3];
+    double ptimes;
+    int i;
+
+    local[0] = peak / 1048576.0;
+    local[1] = live / 1048576.0;
+    local[2] = allocs - frees;
+    MPI_Reduce(local, lmin, 3, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local, lmax, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local, lsum, 3, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&peaktime, &ptimes, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (debug)  {
+        for (i=0; i<nlabels; i+=1)
+            if (labels[i].live)
+                fprintf(stderr, "P%d: still allocated %s, %d blocks, "
+                        "%lu bytes\n", myrank, labels[i].name,
+                        labels[i].allocs - labels[i].frees,
+                        (unsigned long)labels[i].live);
+    }
+
+    if (myrank != 0) return;
 
-    free(ptr);
+    printf("\n===== Memory Information ======\n");
+    printf("%-22s %10s %10s %10s\n", "", "min", "max", "sum");
+    printf("%-22s %10.3f %10.3f %10.3f\n", "peak MB", lmin[0], lmax[0], lsum[0]);
+    printf("%-22s %10.3f %10.3f %10.3f\n", "live at exit MB",
+           lmin[1], lmax[1], lsum[1]);
+    printf("%-22s %10.0f %10.0f %10.0f\n", "blocks at exit",
+           lmin[2], lmax[2], lsum[2]);
+    printf("latest peak reached at %.2fs, P0 peak at %.2fs\n",
+           ptimes, peaktime);
+    fflush(stdout);
+    printLabels(stdout, MEM_TOP);
 }
 
 